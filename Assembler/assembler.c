@@ -7,6 +7,23 @@
 
 #define DELIMITERS " $(),%\n\t\v\f"
 
+/*
+    Encoder table generated from the instruction specification, extension
+    instructions included.
+*/
+static const encoding_t encodings[] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) \
+    {#mnemonic, code, length, LAYOUT_##layout, FLOW_##flow, 0},
+#define EXTENSION(code, mnemonic, length, layout, flow, class, fn) \
+    {#mnemonic, code, length, LAYOUT_##layout, FLOW_##flow, 1},
+#include "instructions.def"
+#undef INSTRUCTION
+#undef EXTENSION
+    {NULL, 0, 0, LAYOUT_NONE, FLOW_NEXT, 0}
+};
+
+static const char *registerNames[] = { EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI };
+
 /*
     Returns the integer corresponding to the string register indicated
     by the string.
@@ -40,234 +57,338 @@ static int getRegisterCode(char *reg) {
     }
 }
 
-static char getNextRegister() {
+static int getNextRegister() {
     char *reg = strtok(NULL, DELIMITERS);
-    int rA = getRegisterCode(reg);
-    return rA != -1 ? rA + '0' : '\0';
+    return getRegisterCode(reg);
 }
 
 /*
     Prints a standard error message and exits the program.
     Arguments:
-        const char *fn_c - the string containing the code corresponding to the
-        instruction with which there is a problem
+        int code - the opcode of the instruction with which there is a problem
         const char *message - the error message to be printed
 */
-static void invalidArguments(const char *fn_c, const char *message) {
-    fprintf(stderr, "ERROR: Instruction <%s> | %s\nProgram is exiting.\n", fn_c, message);
+static void invalidArguments(int code, const char *message) {
+    fprintf(stderr, "ERROR: Instruction <%02x> | %s\nProgram is exiting.\n", code, message);
     exit(EXIT_FAILURE);
 }
 
 /*
     Handles assembling the jump and call instructions into ascii form
     Arguments:
-        const char *fn_c - the code corresponding to the y86 instruction
+        int code - the opcode of the y86 instruction
 */
-static void jump(const char *fn_c) {
+static void jump(int code, insn_t *in) {
     char *destToken = strtok(NULL, DELIMITERS);
     if(!destToken) {
-        invalidArguments(fn_c, "expected 8 character hex address\n");
+        invalidArguments(code, "expected 8 character hex address\n");
     }
     int32_t destValue;
     int scan = sscanf(destToken, "%x", &destValue);
     if(scan == EOF) {
-        invalidArguments(fn_c, "could not parse destination address\n");
+        invalidArguments(code, "could not parse destination address\n");
     }
-    printf("%s", fn_c);
-    printInt32LittleEndian(destValue);
+    in->val = destValue;
 }
 
 /*
     Handles assembling the operation and rrmov instructions into ascii form
     Arguments:
-        const char *fn_c - the code corresponding to the y86 instruction
+        int code - the opcode of the y86 instruction
 */
-static void op(const char *fn_c) {
-    char rA = getNextRegister();
-    char rB = getNextRegister();
-    if(!rA || !rB) {
-        invalidArguments(fn_c, "expected two registers\n");
-        return;
+static void op(int code, insn_t *in) {
+    in->rA = getNextRegister();
+    in->rB = getNextRegister();
+    if(in->rA == -1 || in->rB == -1) {
+        invalidArguments(code, "expected two registers\n");
     }
-    printf("%s%c%c", fn_c, rA, rB);
 }
 
 /*
     Handles assembling the push and pop instructions.
     Arguments:
-        const char *fn_c - the code corresponding to the y86 instruction
+        int code - the opcode of the y86 instruction
 */
-static void stackInstr(const char *fn_c) {
-    char rA = getNextRegister();
-    if(!rA) {
-        invalidArguments(fn_c, "expected one register\n");
+static void stackInstr(int code, insn_t *in) {
+    in->rA = getNextRegister();
+    if(in->rA == -1) {
+        invalidArguments(code, "expected one register\n");
     }
-    printf("%s%cf", fn_c, rA);
 }
 
 /*
     Handles assembling the read and write instructions.
     Arguments:
-        const char *fn_c - the code corresponding to the y86 instruction
+        int code - the opcode of the y86 instruction
 */
-static void readWrite(const char *fn_c) {
+static void readWrite(int code, insn_t *in) {
     char *displacementStr = strtok(NULL, DELIMITERS);
     if(!displacementStr) {
-        invalidArguments(fn_c, "expected decimal displacement\n");        
+        invalidArguments(code, "expected decimal displacement\n");        
     }
     int32_t displacement;
     int scan = sscanf(displacementStr, "%d", &displacement);
     if(scan == EOF) {
-        invalidArguments(fn_c, "could not parse displacement amount\n");
+        invalidArguments(code, "could not parse displacement amount\n");
     }
-    char rA = getNextRegister();
-    if(!rA) {
-        invalidArguments(fn_c, "expected register\n");
+    in->val = displacement;
+    in->rA = getNextRegister();
+    if(in->rA == -1) {
+        invalidArguments(code, "expected register\n");
     }
-    printf("%s%cf", fn_c, rA);
-    printInt32LittleEndian(displacement);
 }
 
 /*
     Handles assembling the movsbl and mrmovl instructions
     Arguments:
-        const char *fn_c - the code corresponding to the y86 instruction
+        int code - the opcode of the y86 instruction
 */
-static void sblmr(const char *fn_c) {
+static void sblmr(int code, insn_t *in) {
     char *displacementStr = strtok(NULL, DELIMITERS);
     if(!displacementStr) {
-        invalidArguments(fn_c, "expected decimal displacement\n");        
+        invalidArguments(code, "expected decimal displacement\n");        
     }
     int32_t displacement;
     int scan = sscanf(displacementStr, "%d", &displacement);
     if(scan == EOF) {
-        invalidArguments(fn_c, "could not parse displacement amount\n");
+        invalidArguments(code, "could not parse displacement amount\n");
     }
-    char rB = getNextRegister();
-    char rA = getNextRegister();
-    if(!rA || !rB) {
-        invalidArguments(fn_c, "expected two registers\n");
+    in->val = displacement;
+    in->rB = getNextRegister();
+    in->rA = getNextRegister();
+    if(in->rA == -1 || in->rB == -1) {
+        invalidArguments(code, "expected two registers\n");
     }
-
-    printf("%s%c%c", fn_c, rA, rB);
-    printInt32LittleEndian(displacement);
-
-    
 }
 
 /*
     Handles assembling the irmovl instruction
+    Arguments:
+        int code - the opcode of the y86 instruction
 */
-static void irmovl() {
+static void irmovl(int code, insn_t *in) {
     char *immediateStr = strtok(NULL, DELIMITERS);
     if(!immediateStr) {
-        invalidArguments(IRMOVL_C, "expected decimal immediate value\n");
+        invalidArguments(code, "expected decimal immediate value\n");
     }
     int32_t immediate;
     int scan = sscanf(immediateStr, "%d", &immediate);
     if(scan == EOF) {
-        invalidArguments(IRMOVL_C, "could not parse immediate value\n");
+        invalidArguments(code, "could not parse immediate value\n");
     }
-    char rA = getNextRegister();
-    if(rA == -1) {
-        invalidArguments(IRMOVL_C, "expected register\n");
+    in->val = immediate;
+    in->rB = getNextRegister();
+    if(in->rB == -1) {
+        invalidArguments(code, "expected register\n");
     }
-    printf("%sf%c", IRMOVL_C, rA);
-    printInt32LittleEndian(immediate);
-
-    
 }
 
 /*
-    Handles assembling the rmmovl instruction
+    Handles assembling the rmmovl instruction, and the extension
+    instructions that share its operands
+    Arguments:
+        int code - the opcode of the y86 instruction
 */
-static void rmmovl() {
-    char rA = getNextRegister();
+static void rmmovl(int code, insn_t *in) {
+    in->rA = getNextRegister();
     char *displacementStr = strtok(NULL, DELIMITERS);
     if(!displacementStr) {
-        invalidArguments(RMMOVL_C, "expected decimal displacement value\n");
+        invalidArguments(code, "expected decimal displacement value\n");
     }
     int32_t displacement;
     int scan = sscanf(displacementStr, "%d", &displacement);
     if(scan == EOF) {
-        invalidArguments(RMMOVL_C, "could not parse displacement amount\n");
+        invalidArguments(code, "could not parse displacement amount\n");
     }
-    char rB = getNextRegister();
-    if(!rA || !rB) {
-        invalidArguments(RMMOVL_C, "expected two registers\n");
+    in->val = displacement;
+    in->rB = getNextRegister();
+    if(in->rA == -1 || in->rB == -1) {
+        invalidArguments(code, "expected two registers\n");
+    }
+}
+
+/*
+    Return:
+        The encoding of the opcode; NULL if it is not a y86 instruction.
+*/
+const encoding_t *encodingOf(int code) {
+    const encoding_t *enc;
+    for(enc = encodings; enc->mnemonic; enc++) {
+        if(enc->code == code) {
+            return enc;
+        }
     }
-    printf("%s%c%c", RMMOVL_C, rA, rB);
-    printInt32LittleEndian(displacement);
-    
+    return NULL;
 }
 
 /*
-    Main loop of the assembler. Loops through every instruction in the program
-    and calls the appropriate helper functions. These 
+    Finds the encoding of an instruction by its mnemonic.
+    Return:
+        The encoding if the mnemonic is a y86 instruction; NULL otherwise.
 */
-void assemble(char *program) {
+static const encoding_t *findEncoding(const char *mnemonic) {
+    const encoding_t *enc;
+    for(enc = encodings; enc->mnemonic; enc++) {
+        if(STREQ(enc->mnemonic, mnemonic)) {
+            return enc;
+        }
+    }
+    return NULL;
+}
+
+static int appendInstruction(program_t *prog, const insn_t *in) {
+    if(prog->count == prog->cap) {
+        int cap = prog->cap ? prog->cap * 2 : 64;
+        insn_t *grown = realloc(prog->insns, cap * sizeof(insn_t));
+        if(!grown) {
+            return 0;
+        }
+        prog->insns = grown;
+        prog->cap = cap;
+    }
+    prog->insns[prog->count++] = *in;
+    return 1;
+}
+
+/*
+    Main loop of the assembler. Loops through every instruction in the program,
+    looks up its encoding and calls the helper for its operand layout, which
+    decodes the operands into the instruction list.
+    Arguments:
+        char *program - the text of the program; it is modified
+        program_t *prog - receives the instructions
+        int extensions - accept the extension instructions
+    Return:
+        1 if the instructions were decoded; 0 if there was no memory for them
+*/
+int parseProgram(char *program, program_t *prog, int extensions) {
     char *token = NULL;
+    memset(prog, 0, sizeof(program_t));
     token = strtok(program, DELIMITERS);
     while( token ) {
-        if(STREQ(token, NOP)) {
-            printf(NOP_C);
-        } else if(STREQ(token, HALT)) {
-            printf(HALT_C);
-        } else if(STREQ(token, RRMOVL)) {
-            op(RRMOVL_C);
-        } else if(STREQ(token, IRMOVL)) {
-            irmovl();
-        } else if(STREQ(token, RMMOVL)) {
-            rmmovl();
-        } else if(STREQ(token, MRMOVL)) {
-            sblmr(MRMOVL_C);
-        } else if(STREQ(token, ADDL)) {
-            op(ADDL_C);
-        } else if(STREQ(token, SUBL)) {
-            op(SUBL_C);
-        } else if(STREQ(token, ANDL)) {
-            op(ANDL_C);
-        } else if(STREQ(token, XORL)) {
-            op(XORL_C);
-        } else if(STREQ(token, MULL)) {
-            op(MULL_C);
-        } else if(STREQ(token, CMPL)) {
-            op(CMPL_C);
-        } else if(STREQ(token, JMP)) {
-            jump(JMP_C);
-        } else if(STREQ(token, JLE)) {
-            jump(JLE_C);
-        } else if(STREQ(token, JL)) {
-            jump(JL_C);
-        } else if(STREQ(token, JE)) {
-            jump(JE_C);
-        } else if(STREQ(token, JNE)) {
-            jump(JNE_C);
-        } else if(STREQ(token, JGE)) {
-            jump(JGE_C);
-        } else if(STREQ(token, JG)) {
-            jump(JG_C);
-        } else if(STREQ(token, CALL)) {
-            jump(CALL_C);
-        } else if(STREQ(token, RET)) {
-            printf(RET_C);
-        } else if(STREQ(token, PUSHL)) {
-            stackInstr(PUSHL_C);
-        } else if(STREQ(token, POPL)) {
-            stackInstr(POPL_C);
-        } else if(STREQ(token, READB)) {
-            readWrite(READB_C);
-        } else if(STREQ(token, READL)) {
-            readWrite(READL_C);
-        } else if(STREQ(token, WRITEB)) {
-            readWrite(WRITEB_C);
-        } else if(STREQ(token, WRITEL)) {
-            readWrite(WRITEL_C);
-        } else if(STREQ(token, MOVSBL)) {
-            sblmr(MOVSBL_C);
-        } else {
+        const encoding_t *enc = findEncoding(token);
+        if(!enc) {
             fprintf(stderr, "ERROR: Invalid instruction %s encountered\nProgram is exiting.\n", token);
+            token = strtok(NULL, DELIMITERS);
+            continue;
+        }
+        /* Operands of rejected extension instructions are still consumed */
+        int rejected = enc->extension && !extensions;
+        if(rejected) {
+            fprintf(stderr, "ERROR: %s is an extension instruction; assemble with -x to use it\n", token);
+        }
+        insn_t in = { enc, NO_REGISTER, NO_REGISTER, 0 };
+        switch(enc->layout) {
+            case LAYOUT_NONE:
+            break;
+            case LAYOUT_RR:
+                op(enc->code, &in);
+            break;
+            case LAYOUT_IR:
+                irmovl(enc->code, &in);
+            break;
+            case LAYOUT_RM:
+                rmmovl(enc->code, &in);
+            break;
+            case LAYOUT_MR:
+                sblmr(enc->code, &in);
+            break;
+            case LAYOUT_DEST:
+                jump(enc->code, &in);
+            break;
+            case LAYOUT_R:
+                stackInstr(enc->code, &in);
+            break;
+            case LAYOUT_D:
+                readWrite(enc->code, &in);
+            break;
+        }
+        if(!rejected && !appendInstruction(prog, &in)) {
+            fprintf(stderr, "ERROR: Memory allocation failed\n");
+            return 0;
         }
         token = strtok(NULL, DELIMITERS);
     }
+    return 1;
+}
+
+void freeProgram(program_t *prog) {
+    free(prog->insns);
+    memset(prog, 0, sizeof(program_t));
+}
+
+/*
+    Prints the machine code of an instruction in ascii hex. Register fields
+    the layout does not use are f.
+*/
+static void encodeInstruction(const insn_t *in) {
+    printf("%02x", in->enc->code);
+    switch(in->enc->layout) {
+        case LAYOUT_NONE:
+        break;
+        case LAYOUT_RR:
+            printf("%x%x", in->rA, in->rB);
+        break;
+        case LAYOUT_IR:
+            printf("f%x", in->rB);
+            printInt32LittleEndian(in->val);
+        break;
+        case LAYOUT_RM:
+        case LAYOUT_MR:
+            printf("%x%x", in->rA, in->rB);
+            printInt32LittleEndian(in->val);
+        break;
+        case LAYOUT_DEST:
+            printInt32LittleEndian(in->val);
+        break;
+        case LAYOUT_R:
+            printf("%xf", in->rA);
+        break;
+        case LAYOUT_D:
+            printf("%xf", in->rA);
+            printInt32LittleEndian(in->val);
+        break;
+    }
+}
+
+void encodeProgram(const program_t *prog) {
+    int i;
+    for(i = 0; i < prog->count; i++) {
+        encodeInstruction(&prog->insns[i]);
+    }
+}
+
+/*
+    Prints an instruction in the syntax the assembler reads.
+*/
+void printInstruction(const insn_t *in, FILE *out) {
+    const char *rA = in->rA >= 0 && in->rA < 8 ? registerNames[in->rA] : "?";
+    const char *rB = in->rB >= 0 && in->rB < 8 ? registerNames[in->rB] : "?";
+    fprintf(out, "%s", in->enc->mnemonic);
+    switch(in->enc->layout) {
+        case LAYOUT_NONE:
+        break;
+        case LAYOUT_RR:
+            fprintf(out, " %%%s, %%%s", rA, rB);
+        break;
+        case LAYOUT_IR:
+            fprintf(out, " $%d, %%%s", in->val, rB);
+        break;
+        case LAYOUT_RM:
+            fprintf(out, " %%%s, %d(%%%s)", rA, in->val, rB);
+        break;
+        case LAYOUT_MR:
+            fprintf(out, " %d(%%%s), %%%s", in->val, rB, rA);
+        break;
+        case LAYOUT_DEST:
+            fprintf(out, " 0x%X", in->val);
+        break;
+        case LAYOUT_R:
+            fprintf(out, " %%%s", rA);
+        break;
+        case LAYOUT_D:
+            fprintf(out, " %d(%%%s)", in->val, rA);
+        break;
+    }
+    fprintf(out, "\n");
 }
@@ -1,6 +1,11 @@
 #ifndef assembler_h
 #define assembler_h
 
+#include <stdio.h>
+#include <stdint.h>
+
+#include "flows.h"
+
 #define EAX "eax"
 #define ECX "ecx"
 #define EDX "edx"
@@ -18,65 +23,46 @@
 #define EBP_C 5
 #define ESI_C 6
 #define EDI_C 7
+#define NO_REGISTER 0xf
+
+/*
+    Operand layouts from the instruction specification. Each one is assembled
+    by its own routine.
+*/
+typedef enum layout_e {
+    LAYOUT_NONE, LAYOUT_RR, LAYOUT_IR, LAYOUT_RM, LAYOUT_MR, LAYOUT_DEST, LAYOUT_R, LAYOUT_D
+} layout_t;
+
+typedef struct encoding_s {
+    const char *mnemonic;
+    int code;
+    int length;
+    layout_t layout;
+    int flow;               /* FLOW_ */
+    int extension;          /* only accepted with extensions enabled */
+} encoding_t;
 
-#define NOP "nop"
-#define HALT "halt"
-#define RRMOVL "rrmovl"
-#define IRMOVL "irmovl"
-#define RMMOVL "rmmovl"
-#define MRMOVL "mrmovl"
-#define ADDL "addl"
-#define SUBL "subl"
-#define ANDL "andl"
-#define XORL "xorl"
-#define MULL "mull"
-#define CMPL "cmpl"
-#define JMP "jmp"
-#define JLE "jle"
-#define JL "jl"
-#define JE "je"
-#define JNE "jne"
-#define JGE "jge"
-#define JG "jg"
-#define CALL "call"
-#define RET "ret"
-#define PUSHL "pushl"
-#define POPL "popl"
-#define READB "readb"
-#define READL "readl"
-#define WRITEB "writeb"
-#define WRITEL "writel"
-#define MOVSBL "movsbl"
+/*
+    A decoded instruction. Register fields the layout does not use hold
+    NO_REGISTER; val is the immediate, displacement or destination.
+*/
+typedef struct insn_s {
+    const encoding_t *enc;
+    int rA;
+    int rB;
+    int32_t val;
+} insn_t;
 
-#define NOP_C "00"
-#define HALT_C "10"
-#define RRMOVL_C "20"
-#define IRMOVL_C "30"
-#define RMMOVL_C "40"
-#define MRMOVL_C "50"
-#define ADDL_C "60"
-#define SUBL_C "61"
-#define ANDL_C "62"
-#define XORL_C "63"
-#define MULL_C "64"
-#define CMPL_C "65"
-#define JMP_C "70"
-#define JLE_C "71"
-#define JL_C "72"
-#define JE_C "73"
-#define JNE_C "74"
-#define JGE_C "75"
-#define JG_C "76"
-#define CALL_C "80"
-#define RET_C "90"
-#define PUSHL_C "a0"
-#define POPL_C "b0"
-#define READB_C "c0"
-#define READL_C "c1"
-#define WRITEB_C "d0"
-#define WRITEL_C "d1"
-#define MOVSBL_C "e0"
+typedef struct program_s {
+    insn_t *insns;
+    int count;
+    int cap;
+} program_t;
 
-void assemble(char*);
+const encoding_t *encodingOf(int);
+int parseProgram(char*, program_t*, int);
+void freeProgram(program_t*);
+void encodeProgram(const program_t*);
+void printInstruction(const insn_t*, FILE*);
 
 #endif
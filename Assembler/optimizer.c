@@ -0,0 +1,584 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "optimizer.h"
+
+/*
+    Peephole optimizer. Works on the decoded instruction list of a program
+    whose first instruction is placed at a known origin. Jump and call
+    destinations are turned into instruction indexes, the passes below are
+    repeated until none of them changes anything, and the survivors are laid
+    out again with their destinations moved to the new addresses:
+        threading     jumps and calls to a jmp go straight to its destination
+        inversion     jXX over a jmp becomes the opposite jXX to the jmp's
+                      destination
+        jumps         jmp and jXX to the next instruction are removed
+        unreachable   instructions no path from the first one reaches are
+                      removed
+        constants     irmovl and rrmovl are removed when the register
+                      already holds the value on every path to them
+        moves         rrmovl between registers known to be equal since the
+                      start of the basic block are removed
+    The program must only enter its code through jumps, calls, returns and
+    falling through, and must not read or write its code as data; every
+    destination must be an instruction of the program or its end. Programs
+    that use spawn are left as they are: the code a new CPU starts at is
+    only known at run time, so no pass could tell what is reachable from it.
+*/
+
+#define NUM_REGISTERS 8
+#define UNREACHED 0xffff
+
+/*
+    What is known about the registers before an instruction: a register
+    whose bit is set in known holds vals[register].
+*/
+typedef struct regstate_s {
+    uint32_t known;         /* UNREACHED until a path reaches the instruction */
+    int32_t vals[NUM_REGISTERS];
+} regstate_t;
+
+typedef struct optimizer_s {
+    program_t *prog;
+    int *target;            /* destination of each jump or call; count for the end */
+    uint8_t *removed;
+    uint8_t *isTarget;
+    int moves;
+    int constants;
+    int jumps;
+    int threaded;
+    int inverted;
+    int unreachable;
+} optimizer_t;
+
+static int isJump(const insn_t *in) {
+    return in->enc->layout == LAYOUT_DEST;
+}
+
+/*
+    Return:
+        The first instruction at or after i that was not removed; the
+        number of instructions if there is none.
+*/
+static int live(const optimizer_t *o, int i) {
+    while(i < o->prog->count && o->removed[i]) {
+        i++;
+    }
+    return i;
+}
+
+static int next(const optimizer_t *o, int i) {
+    return live(o, i + 1);
+}
+
+static int32_t programLength(const program_t *prog) {
+    int32_t len = 0;
+    int i;
+    for(i = 0; i < prog->count; i++) {
+        len += prog->insns[i].enc->length;
+    }
+    return len;
+}
+
+/*
+    Turns the destinations of jumps and calls into instruction indexes.
+    Return:
+        1 if every destination is an instruction of the program or its end;
+        0 otherwise
+*/
+static int resolveTargets(optimizer_t *o, int32_t origin) {
+    program_t *prog = o->prog;
+    int32_t *addrs = malloc((prog->count + 1) * sizeof(int32_t));
+    int i;
+    int ok = 1;
+    if(!addrs) {
+        return 0;
+    }
+    addrs[0] = origin;
+    for(i = 0; i < prog->count; i++) {
+        addrs[i + 1] = addrs[i] + prog->insns[i].enc->length;
+    }
+    for(i = 0; i < prog->count && ok; i++) {
+        if(!isJump(&prog->insns[i])) {
+            continue;
+        }
+        int lo = 0;
+        int hi = prog->count;
+        while(lo < hi) {
+            int mid = (lo + hi) / 2;
+            if(addrs[mid] < prog->insns[i].val) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if(addrs[lo] != prog->insns[i].val) {
+            fprintf(stderr, "WARNING: %s 0x%X at 0x%X does not lead to an instruction; not optimizing\n",
+                    prog->insns[i].enc->mnemonic, prog->insns[i].val, addrs[i]);
+            ok = 0;
+        }
+        o->target[i] = lo;
+    }
+    free(addrs);
+    return ok;
+}
+
+/*
+    Checks that the program does not start other CPUs.
+    Return:
+        1 if no instruction is a spawn; 0 after a warning otherwise
+*/
+static int singleThreaded(optimizer_t *o) {
+    int i;
+    for(i = 0; i < o->prog->count; i++) {
+        if(o->prog->insns[i].enc->code == 0xF2) {
+            fprintf(stderr, "WARNING: the program uses spawn; not optimizing\n");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void markTargets(optimizer_t *o) {
+    int i;
+    memset(o->isTarget, 0, o->prog->count + 1);
+    for(i = live(o, 0); i < o->prog->count; i = next(o, i)) {
+        if(isJump(&o->prog->insns[i])) {
+            o->isTarget[live(o, o->target[i])] = 1;
+        }
+    }
+}
+
+static int threadJumps(optimizer_t *o) {
+    const insn_t *insns = o->prog->insns;
+    int changed = 0;
+    int i;
+    for(i = live(o, 0); i < o->prog->count; i = next(o, i)) {
+        if(!isJump(&insns[i])) {
+            continue;
+        }
+        int first = live(o, o->target[i]);
+        int t = first;
+        int hops = 0;
+        while(t < o->prog->count && insns[t].enc->flow == FLOW_JUMP && hops++ < o->prog->count) {
+            t = live(o, o->target[t]);
+        }
+        if(t != first && hops <= o->prog->count) {
+            o->target[i] = t;
+            o->threaded++;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/*
+    Return:
+        The opcode of the branch taken exactly when the given one is not.
+*/
+static int invertedBranch(int code) {
+    switch(code) {
+        case 0x71: return 0x76;     /* jle - jg */
+        case 0x76: return 0x71;
+        case 0x72: return 0x75;     /* jl - jge */
+        case 0x75: return 0x72;
+        case 0x73: return 0x74;     /* je - jne */
+        case 0x74: return 0x73;
+    }
+    return -1;
+}
+
+static int invertBranches(optimizer_t *o) {
+    insn_t *insns = o->prog->insns;
+    int changed = 0;
+    int i;
+    markTargets(o);
+    for(i = live(o, 0); i < o->prog->count; i = next(o, i)) {
+        int j = next(o, i);
+        if(insns[i].enc->flow != FLOW_BRANCH || j == o->prog->count || insns[j].enc->flow != FLOW_JUMP ||
+           o->isTarget[j] || live(o, o->target[i]) != next(o, j)) {
+            continue;
+        }
+        insns[i].enc = encodingOf(invertedBranch(insns[i].enc->code));
+        o->target[i] = o->target[j];
+        o->removed[j] = 1;
+        o->inverted++;
+        changed = 1;
+    }
+    return changed;
+}
+
+static int removeJumpsToNext(optimizer_t *o) {
+    const insn_t *insns = o->prog->insns;
+    int changed = 0;
+    int i;
+    for(i = live(o, 0); i < o->prog->count; i = next(o, i)) {
+        int flow = insns[i].enc->flow;
+        if((flow == FLOW_JUMP || flow == FLOW_BRANCH) && live(o, o->target[i]) == next(o, i)) {
+            o->removed[i] = 1;
+            o->jumps++;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+static int removeUnreachable(optimizer_t *o) {
+    const insn_t *insns = o->prog->insns;
+    int count = o->prog->count;
+    uint8_t *reached = calloc(count + 1, 1);
+    int *work = malloc((count + 1) * sizeof(int));
+    int numWork = 0;
+    int changed = 0;
+    int i;
+    if(!reached || !work) {
+        free(reached);
+        free(work);
+        return 0;
+    }
+    work[numWork++] = live(o, 0);
+    reached[live(o, 0)] = 1;
+    while(numWork) {
+        int succ[2];
+        int numSucc = 0;
+        i = work[--numWork];
+        if(i == count) {
+            continue;
+        }
+        int flow = insns[i].enc->flow;
+        if(flow == FLOW_NEXT || flow == FLOW_BRANCH || flow == FLOW_CALL) {
+            succ[numSucc++] = next(o, i);
+        }
+        if(flow == FLOW_JUMP || flow == FLOW_BRANCH || flow == FLOW_CALL) {
+            succ[numSucc++] = live(o, o->target[i]);
+        }
+        while(numSucc--) {
+            if(!reached[succ[numSucc]]) {
+                reached[succ[numSucc]] = 1;
+                work[numWork++] = succ[numSucc];
+            }
+        }
+    }
+    for(i = live(o, 0); i < count; i = next(o, i)) {
+        if(!reached[i]) {
+            o->removed[i] = 1;
+            o->unreachable++;
+            changed = 1;
+        }
+    }
+    free(reached);
+    free(work);
+    return changed;
+}
+
+static void forget(regstate_t *s, int reg) {
+    if(reg >= 0 && reg < NUM_REGISTERS) {
+        s->known &= ~(1u << reg);
+    }
+}
+
+/*
+    Merges a state into the state before instruction i.
+    Return:
+        1 if the state before i changed; 0 otherwise
+*/
+static int mergeState(regstate_t *states, int i, const regstate_t *s) {
+    regstate_t *into = &states[i];
+    int r;
+    if(into->known == UNREACHED) {
+        *into = *s;
+        return 1;
+    }
+    uint32_t known = into->known & s->known;
+    for(r = 0; r < NUM_REGISTERS; r++) {
+        if((known & (1u << r)) && into->vals[r] != s->vals[r]) {
+            known &= ~(1u << r);
+        }
+    }
+    if(known == into->known) {
+        return 0;
+    }
+    into->known = known;
+    return 1;
+}
+
+/*
+    Computes the registers holding known constants before each instruction,
+    then removes the loads that would not change them.
+*/
+static int propagateConstants(optimizer_t *o) {
+    const insn_t *insns = o->prog->insns;
+    int count = o->prog->count;
+    regstate_t *states = malloc((count + 1) * sizeof(regstate_t));
+    int *work = malloc((count + 1) * sizeof(int));
+    uint8_t *queued = calloc(count + 1, 1);
+    int numWork = 0;
+    int changed = 0;
+    int i;
+    if(!states || !work || !queued) {
+        free(states);
+        free(work);
+        free(queued);
+        return 0;
+    }
+    for(i = 0; i <= count; i++) {
+        states[i].known = UNREACHED;
+    }
+    regstate_t entry = { 0 };
+    mergeState(states, live(o, 0), &entry);
+    work[numWork++] = live(o, 0);
+    queued[live(o, 0)] = 1;
+    while(numWork) {
+        i = work[--numWork];
+        queued[i] = 0;
+        if(i == count) {
+            continue;
+        }
+        const insn_t *in = &insns[i];
+        regstate_t out = states[i];
+        regstate_t taken;
+        int hasNext = 1;
+        int hasTarget = 0;
+        switch(in->enc->code) {
+            case 0x20:      /* rrmovl */
+                if(out.known & (1u << in->rA)) {
+                    out.known |= 1u << in->rB;
+                    out.vals[in->rB] = out.vals[in->rA];
+                } else {
+                    forget(&out, in->rB);
+                }
+                break;
+            case 0x30:      /* irmovl */
+                out.known |= 1u << in->rB;
+                out.vals[in->rB] = in->val;
+                break;
+            case 0x50:      /* mrmovl */
+            case 0xE0:      /* movsbl */
+            case 0xC2:      /* readn sets rA to the bytes read */
+            case 0xF1:      /* xadd sets rA to the old value in memory */
+                forget(&out, in->rA);
+                break;
+            case 0xF0:      /* cas loads %eax when the comparison fails */
+                forget(&out, EAX_C);
+                break;
+            case 0x65:      /* cmpl only sets the flags */
+                break;
+            case 0xA0:      /* pushl */
+                forget(&out, ESP_C);
+                break;
+            case 0xB0:      /* popl */
+                forget(&out, ESP_C);
+                forget(&out, in->rA);
+                break;
+            default:
+                if(in->enc->layout == LAYOUT_RR) {
+                    forget(&out, in->rB);
+                }
+                break;
+        }
+        taken = out;
+        switch(in->enc->flow) {
+            case FLOW_JUMP:
+                hasNext = 0;
+                hasTarget = 1;
+                break;
+            case FLOW_BRANCH:
+                hasTarget = 1;
+                break;
+            case FLOW_CALL:
+                /* The callee may change anything before it returns */
+                hasTarget = 1;
+                forget(&taken, ESP_C);
+                out.known = 0;
+                break;
+            case FLOW_RET:
+            case FLOW_HALT:
+                hasNext = 0;
+                break;
+            default:
+                break;
+        }
+        int succ[2];
+        const regstate_t *succState[2];
+        int numSucc = 0;
+        if(hasNext) {
+            succ[numSucc] = next(o, i);
+            succState[numSucc++] = &out;
+        }
+        if(hasTarget) {
+            succ[numSucc] = live(o, o->target[i]);
+            succState[numSucc++] = &taken;
+        }
+        while(numSucc--) {
+            int s = succ[numSucc];
+            if(mergeState(states, s, succState[numSucc]) && !queued[s]) {
+                queued[s] = 1;
+                work[numWork++] = s;
+            }
+        }
+    }
+    for(i = live(o, 0); i < count; i = next(o, i)) {
+        const insn_t *in = &insns[i];
+        const regstate_t *s = &states[i];
+        if(s->known == UNREACHED) {
+            continue;
+        }
+        int redundant = 0;
+        if(in->enc->code == 0x30) {
+            redundant = (s->known & (1u << in->rB)) && s->vals[in->rB] == in->val;
+        } else if(in->enc->code == 0x20) {
+            uint32_t both = (1u << in->rA) | (1u << in->rB);
+            redundant = (s->known & both) == both && s->vals[in->rA] == s->vals[in->rB];
+        }
+        if(redundant) {
+            o->removed[i] = 1;
+            o->constants++;
+            changed = 1;
+        }
+    }
+    free(states);
+    free(work);
+    free(queued);
+    return changed;
+}
+
+/*
+    Removes moves between registers that already hold the same value. Each
+    register gets a value number at the start of a basic block and a new one
+    whenever it is written, and rrmovl copies the number.
+*/
+static int removeRedundantMoves(optimizer_t *o) {
+    const insn_t *insns = o->prog->insns;
+    int numbers[NUM_REGISTERS];
+    int fresh = 0;
+    int changed = 0;
+    int leader = 1;
+    int i;
+    int r;
+    markTargets(o);
+    for(i = live(o, 0); i < o->prog->count; i = next(o, i)) {
+        const insn_t *in = &insns[i];
+        if(leader || o->isTarget[i]) {
+            for(r = 0; r < NUM_REGISTERS; r++) {
+                numbers[r] = fresh++;
+            }
+        }
+        leader = in->enc->flow != FLOW_NEXT;
+        switch(in->enc->code) {
+            case 0x20:      /* rrmovl */
+                if(numbers[in->rA] == numbers[in->rB]) {
+                    o->removed[i] = 1;
+                    o->moves++;
+                    changed = 1;
+                } else {
+                    numbers[in->rB] = numbers[in->rA];
+                }
+                break;
+            case 0x30:      /* irmovl */
+                numbers[in->rB] = fresh++;
+                break;
+            case 0x50:      /* mrmovl */
+            case 0xE0:      /* movsbl */
+            case 0xC2:      /* readn */
+            case 0xF1:      /* xadd */
+                numbers[in->rA] = fresh++;
+                break;
+            case 0xF0:      /* cas */
+                numbers[EAX_C] = fresh++;
+                break;
+            case 0x65:      /* cmpl */
+                break;
+            case 0xA0:      /* pushl */
+                numbers[ESP_C] = fresh++;
+                break;
+            case 0xB0:      /* popl */
+                numbers[ESP_C] = fresh++;
+                numbers[in->rA] = fresh++;
+                break;
+            default:
+                if(in->enc->layout == LAYOUT_RR) {
+                    numbers[in->rB] = fresh++;
+                }
+                break;
+        }
+    }
+    return changed;
+}
+
+/*
+    Drops the removed instructions and moves every destination to the new
+    address of its instruction.
+*/
+static void layOut(optimizer_t *o, int32_t origin) {
+    program_t *prog = o->prog;
+    int32_t *addrs = malloc((prog->count + 1) * sizeof(int32_t));
+    int32_t addr = origin;
+    int kept = 0;
+    int i;
+    if(!addrs) {
+        return;
+    }
+    for(i = 0; i < prog->count; i++) {
+        addrs[i] = addr;
+        if(!o->removed[i]) {
+            addr += prog->insns[i].enc->length;
+        }
+    }
+    addrs[prog->count] = addr;
+    for(i = 0; i < prog->count; i++) {
+        if(o->removed[i]) {
+            continue;
+        }
+        insn_t in = prog->insns[i];
+        if(isJump(&in)) {
+            in.val = addrs[live(o, o->target[i])];
+        }
+        prog->insns[kept++] = in;
+    }
+    prog->count = kept;
+    free(addrs);
+}
+
+/*
+    Optimizes a program in place and reports what was done on stderr.
+    Arguments:
+        program_t *prog - the program
+        int32_t origin - the address of its first instruction
+    Return:
+        1 if the program was optimized; 0 if it was left as it was because
+        it uses spawn, a destination is not an instruction or memory ran out
+*/
+int optimizeProgram(program_t *prog, int32_t origin) {
+    optimizer_t o;
+    int before = prog->count;
+    int32_t bytesBefore = programLength(prog);
+    int ok = 0;
+    memset(&o, 0, sizeof(o));
+    o.prog = prog;
+    o.target = calloc(prog->count + 1, sizeof(int));
+    o.removed = calloc(prog->count + 1, 1);
+    o.isTarget = calloc(prog->count + 1, 1);
+    if(o.target && o.removed && o.isTarget && prog->count && singleThreaded(&o) &&
+            resolveTargets(&o, origin)) {
+        int changed = 1;
+        while(changed) {
+            changed = threadJumps(&o);
+            changed |= invertBranches(&o);
+            changed |= removeJumpsToNext(&o);
+            changed |= removeUnreachable(&o);
+            changed |= propagateConstants(&o);
+            changed |= removeRedundantMoves(&o);
+        }
+        layOut(&o, origin);
+        fprintf(stderr, "Optimizer: %d -> %d instructions, %d -> %d bytes; removed %d moves, %d constant "
+                "loads, %d jumps, %d unreachable; threaded %d, inverted %d\n",
+                before, prog->count, bytesBefore, programLength(prog), o.moves, o.constants, o.jumps,
+                o.unreachable, o.threaded, o.inverted);
+        ok = 1;
+    }
+    free(o.target);
+    free(o.removed);
+    free(o.isTarget);
+    return ok;
+}
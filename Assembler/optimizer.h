@@ -0,0 +1,8 @@
+#ifndef optimizer_h
+#define optimizer_h
+
+#include "assembler.h"
+
+int optimizeProgram(program_t*, int32_t);
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Assembles a program with and without -O, runs both versions through the
+# emulator on the same input and reports their dynamic instruction counts.
+# The two runs must print the same output.
+#
+# Usage: optreport.sh <source> [image] [input]
+#     image - a .y86 file whose .text is replaced by the assembled code; its
+#             other directives are kept. Without one the code is placed at 0
+#             in 64 KB of memory.
+#     input - a file both runs read as stdin; empty input if not given
+#
+# Set Y86AS and Y86EMUL to use other binaries.
+
+DIR=$(dirname "$0")
+Y86AS=${Y86AS:-$DIR/y86as}
+Y86EMUL=${Y86EMUL:-$DIR/../Emulator/y86emul}
+SOURCE=$1
+IMAGE=$2
+INPUT=${3:-/dev/null}
+if [ -z "$SOURCE" ]; then
+    echo "Usage: optreport.sh <source> [image] [input]" >&2
+    exit 1
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+if [ -n "$IMAGE" ]; then
+    ORIGIN=$(awk '$1 == ".text" { print $2 }' "$IMAGE")
+else
+    ORIGIN=0
+    printf ".size 10000\n.text 0 00\n" > "$TMP/image"
+    IMAGE=$TMP/image
+fi
+
+printf "%-10s %12s %8s\n" version instructions bytes
+for version in original optimized; do
+    flags=
+    [ $version = optimized ] && flags="-O -b $ORIGIN"
+    code=$("$Y86AS" $flags "$SOURCE" | tail -n 1)
+    [ -n "$code" ] || exit 1
+    awk -v code="$code" '$1 == ".text" { $3 = code } { print }' "$IMAGE" > "$TMP/$version.y86"
+    "$Y86EMUL" -s "$TMP/$version.y86" < "$INPUT" > "$TMP/$version.out"
+    count=$(sed -n 's/^y86_instructions_retired_total //p' "$TMP/$version.out")
+    printf "%-10s %12d %8d\n" $version "$count" $((${#code} / 2))
+    sed -i '/^#\|^y86_/d' "$TMP/$version.out"
+done
+if ! cmp -s "$TMP/original.out" "$TMP/optimized.out"; then
+    echo "ERROR: The optimized program printed something else" >&2
+    exit 1
+fi
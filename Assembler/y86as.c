@@ -1,21 +1,64 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "assembler.h"
 #include "loader.h"
+#include "optimizer.h"
 #include "util.h"
 
+static void usage() {
+    printf("Usage: y86as [options] <inputfile>\n");
+    printf("Options:\n");
+    printf("    -O              optimize the program before assembling it\n");
+    printf("    -b <hexaddr>    the address the program is loaded at, for -O (default 0)\n");
+    printf("    -x              accept the extension instructions readn, writen, cas,\n");
+    printf("                    xadd and spawn\n");
+}
+
 int main(int argc, char **argv) {
-    if(argc < 2) {
+    int optimize = 0;
+    int extensions = 0;
+    int32_t origin = 0;
+    char *fileName = NULL;
+    int i;
+    for(i = 1; i < argc; i++) {
+        if(strcmp("-h", argv[i]) == 0) {
+            usage();
+            return 0;
+        } else if(strcmp("-O", argv[i]) == 0) {
+            optimize = 1;
+        } else if(strcmp("-x", argv[i]) == 0) {
+            extensions = 1;
+        } else if(strcmp("-b", argv[i]) == 0 && i + 1 < argc) {
+            origin = (int32_t)strtol(argv[++i], NULL, 16);
+        } else {
+            fileName = argv[i];
+        }
+    }
+    if(!fileName) {
         fprintf(stderr, "ERROR: No input file given\n");
         return 1;
     }
-    char *programString = getInstructions(argv[1]);
+    char *programString = getInstructions(fileName);
     if(programString) {
-        printf("Input:\n%sAssembled:\n", programString);
-        assemble(programString);
-        free(programString);
+        program_t prog;
+        printf("Input:\n%s", programString);
+        if(!parseProgram(programString, &prog, extensions)) {
+            free(programString);
+            return 1;
+        }
+        if(optimize && optimizeProgram(&prog, origin)) {
+            printf("Optimized:\n");
+            for(i = 0; i < prog.count; i++) {
+                printInstruction(&prog.insns[i], stdout);
+            }
+        }
+        printf("Assembled:\n");
+        encodeProgram(&prog);
         printf("\n");
+        freeProgram(&prog);
+        free(programString);
     }
     return 0;
 }
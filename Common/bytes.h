@@ -0,0 +1,38 @@
+#ifndef bytes_h
+#define bytes_h
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Loads and stores of the little endian values found in Y86 images and
+    guest memory. They go through memcpy, so the pointer may be unaligned
+    and may point into any byte buffer without breaking strict aliasing;
+    on x86-64 each compiles to a single move. Big endian hosts swap the
+    bytes after loading and before storing.
+*/
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FROM_LE32(x) __builtin_bswap32(x)
+#else
+#define FROM_LE32(x) (x)
+#endif
+
+/*
+    The register byte of an instruction holds rA in its high nibble and rB
+    in its low nibble.
+*/
+#define HIGH_NIBBLE(b) (((uint8_t)(b) >> 4) & 0xF)
+#define LOW_NIBBLE(b) ((uint8_t)(b) & 0xF)
+
+static inline uint32_t loadLE32(const void *p) {
+    uint32_t val;
+    memcpy(&val, p, 4);
+    return FROM_LE32(val);
+}
+
+static inline void storeLE32(void *p, uint32_t val) {
+    val = FROM_LE32(val);
+    memcpy(p, &val, 4);
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef flows_h
+#define flows_h
+
+/*
+    How control passes on after an instruction. The flow column of
+    instructions.def names one of these without the FLOW_ prefix.
+*/
+#define FLOW_NEXT   0   /* continues with the following instruction */
+#define FLOW_JUMP   1   /* always continues at its destination */
+#define FLOW_BRANCH 2   /* continues at its destination or the following instruction */
+#define FLOW_CALL   3   /* calls its destination and returns to the following instruction */
+#define FLOW_RET    4   /* continues at an address popped off the stack */
+#define FLOW_HALT   5   /* stops the machine */
+#define FLOW_TRAP   6   /* a breakpoint; only used for the emulator's translated blocks */
+
+#endif
@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+
+#define M_START  0x01   /* first byte of a decoded instruction */
+#define M_BODY   0x02   /* operand byte of a decoded instruction */
+#define M_LEADER 0x04   /* first instruction of a basic block */
+#define M_BAD    0x08   /* decoding failed at this byte */
+
+#define LINE 128
+
+static const char *flowNames[] = {"next", "jump", "branch", "call", "ret", "halt"};
+
+/*
+    Growable array of addresses used both as the traversal work list and as
+    the list of function entries.
+*/
+typedef struct addrs_s {
+    int32_t *items;
+    size_t len;
+    size_t cap;
+} addrs_t;
+
+static int addrsPush(addrs_t *list, int32_t addr) {
+    if(list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        int32_t *items = realloc(list->items, cap * sizeof(int32_t));
+        if(!items) {
+            fprintf(stderr, "ERROR: Memory allocation failed\n");
+            return 0;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    list->items[list->len++] = addr;
+    return 1;
+}
+
+static int addrsContains(const addrs_t *list, int32_t addr) {
+    size_t i;
+    for(i = 0; i < list->len; i++) {
+        if(list->items[i] == addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Marks the given address as the start of a basic block and queues it for
+    traversal. Addresses outside of the code are ignored.
+*/
+static int addLeader(uint8_t *map, const cfg_t *cfg, addrs_t *work, int32_t addr) {
+    int64_t pos = (int64_t)addr - cfg->startAddr;
+    if(pos < 0 || pos >= (int64_t)cfg->length || (map[pos] & M_LEADER)) {
+        return 1;
+    }
+    map[pos] |= M_LEADER;
+    return addrsPush(work, addr);
+}
+
+/*
+    Follows the control flow from every queued address, decoding instructions
+    until one of them transfers control elsewhere. Every destination that is
+    found is queued in turn.
+*/
+static int traverse(const uint8_t *bytes, uint8_t *map, cfg_t *cfg, addrs_t *work, addrs_t *functions) {
+    insn_t insn;
+    while(work->len) {
+        size_t pos = (size_t)(work->items[--work->len] - cfg->startAddr);
+        int done = 0;
+        while(!done && pos < cfg->length) {
+            if(map[pos] & M_START) {
+                break;
+            }
+            if(map[pos] & M_BODY) {
+                fprintf(stderr, "WARNING: Jump into the middle of an instruction at 0x%X\n", cfg->startAddr + (int32_t)pos);
+                break;
+            }
+            int32_t addr = cfg->startAddr + (int32_t)pos;
+            int n = decodeInstruction(bytes + pos, cfg->length - pos, addr, &insn);
+            if(n <= 0) {
+                map[pos] |= M_BAD;
+                break;
+            }
+            map[pos] |= M_START;
+            memset(map + pos + 1, M_BODY, n - 1);
+            pos += n;
+            int ok = 1;
+            switch(opcodeTable[insn.opcode].flow) {
+                case FLOW_NEXT:
+                break;
+                case FLOW_JUMP:
+                    ok = addLeader(map, cfg, work, insn.val);
+                    done = 1;
+                break;
+                case FLOW_BRANCH:
+                    ok = addLeader(map, cfg, work, insn.val) &&
+                         addLeader(map, cfg, work, addr + n);
+                    done = 1;
+                break;
+                case FLOW_CALL:
+                    if(!addrsContains(functions, insn.val)) {
+                        ok = addrsPush(functions, insn.val);
+                    }
+                    ok = ok && addLeader(map, cfg, work, insn.val) &&
+                         addLeader(map, cfg, work, addr + n);
+                    done = 1;
+                break;
+                default:
+                    done = 1;
+            }
+            if(!ok) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static block_t *newBlock(cfg_t *cfg, size_t *cap) {
+    if(cfg->numBlocks == *cap) {
+        size_t newCap = *cap ? *cap * 2 : 64;
+        block_t *blocks = realloc(cfg->blocks, newCap * sizeof(block_t));
+        if(!blocks) {
+            fprintf(stderr, "ERROR: Memory allocation failed\n");
+            return NULL;
+        }
+        cfg->blocks = blocks;
+        *cap = newCap;
+    }
+    block_t *block = &cfg->blocks[cfg->numBlocks++];
+    block->count = 0;
+    block->target = NO_ADDR;
+    block->next = NO_ADDR;
+    block->function = NO_ADDR;
+    block->exit = FLOW_NEXT;
+    block->bad = 0;
+    return block;
+}
+
+/*
+    Splits the decoded instructions into basic blocks. A block ends after an
+    instruction that transfers control, before a leader, or at a byte that
+    could not be decoded.
+*/
+static int formBlocks(const uint8_t *bytes, const uint8_t *map, cfg_t *cfg) {
+    size_t cap = 0;
+    size_t pos = 0;
+    insn_t insn;
+    while(pos < cfg->length) {
+        if(!(map[pos] & M_START) && !((map[pos] & M_BAD) && (map[pos] & M_LEADER))) {
+            pos++;
+            continue;
+        }
+        block_t *block = newBlock(cfg, &cap);
+        if(!block) {
+            return 0;
+        }
+        block->start = cfg->startAddr + (int32_t)pos;
+        for(;;) {
+            if(map[pos] & M_BAD) {
+                if(block->count && (map[pos] & M_LEADER)) {
+                    block->next = cfg->startAddr + (int32_t)pos;
+                } else {
+                    block->bad = 1;
+                    pos++;
+                }
+                break;
+            }
+            int32_t addr = cfg->startAddr + (int32_t)pos;
+            int n = decodeInstruction(bytes + pos, cfg->length - pos, addr, &insn);
+            pos += n;
+            block->count++;
+            block->exit = opcodeTable[insn.opcode].flow;
+            if(block->exit == FLOW_JUMP) {
+                block->target = insn.val;
+            } else if(block->exit == FLOW_BRANCH || block->exit == FLOW_CALL) {
+                block->target = insn.val;
+                block->next = cfg->startAddr + (int32_t)pos;
+            }
+            if(block->exit != FLOW_NEXT || pos >= cfg->length) {
+                break;
+            }
+            if(map[pos] & M_LEADER) {
+                block->next = cfg->startAddr + (int32_t)pos;
+                break;
+            }
+            if(!(map[pos] & (M_START | M_BAD))) {
+                break;
+            }
+        }
+        block->end = cfg->startAddr + (int32_t)pos - block->bad;
+    }
+    return 1;
+}
+
+/*
+    Finds the block containing the given address using a binary search.
+    Return:
+        The block if the address belongs to one; NULL otherwise.
+*/
+const block_t *findBlock(const cfg_t *cfg, int32_t addr) {
+    size_t lo = 0;
+    size_t hi = cfg->numBlocks;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const block_t *block = &cfg->blocks[mid];
+        if(addr < block->start) {
+            hi = mid;
+        } else if(addr >= block->end && !(addr == block->start)) {
+            lo = mid + 1;
+        } else {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/*
+    Assigns every block to the first function that reaches it without going
+    through a call. Function entries always belong to their own function.
+*/
+static int assignFunctions(cfg_t *cfg, addrs_t *functions) {
+    addrs_t work = {NULL, 0, 0};
+    size_t i;
+    for(i = 0; i < functions->len; i++) {
+        block_t *entry = (block_t*)findBlock(cfg, functions->items[i]);
+        if(entry) {
+            entry->function = functions->items[i];
+        }
+    }
+    for(i = 0; i < functions->len; i++) {
+        int32_t function = functions->items[i];
+        if(!addrsPush(&work, function)) {
+            free(work.items);
+            return 0;
+        }
+        while(work.len) {
+            int32_t addr = work.items[--work.len];
+            block_t *block = (block_t*)findBlock(cfg, addr);
+            if(!block || (block->function != NO_ADDR && block->function != function) ||
+               (block->function == function && addr != function)) {
+                continue;
+            }
+            block->function = function;
+            int ok = 1;
+            if(block->next != NO_ADDR) {
+                ok = addrsPush(&work, block->next);
+            }
+            if(block->target != NO_ADDR && block->exit != FLOW_CALL) {
+                ok = ok && addrsPush(&work, block->target);
+            }
+            if(!ok) {
+                free(work.items);
+                return 0;
+            }
+        }
+    }
+    free(work.items);
+    return 1;
+}
+
+/*
+    Builds the control flow graph of a piece of machine code by recursive
+    traversal: only code reachable from the entry through jXX, call and
+    fall-through edges is decoded, so data placed among the instructions
+    is never mistaken for code.
+    Arguments:
+        const uint8_t *bytes - the machine code
+        size_t len - the number of bytes of machine code
+        int32_t startAddr - the address of the first byte
+        int32_t entry - the address where execution starts
+        cfg_t *cfg - receives the graph; release it with freeCFG
+    Return:
+        1 if the graph was built; 0 otherwise
+*/
+int buildCFG(const uint8_t *bytes, size_t len, int32_t startAddr, int32_t entry, cfg_t *cfg) {
+    memset(cfg, 0, sizeof(cfg_t));
+    cfg->startAddr = startAddr;
+    cfg->length = len;
+    uint8_t *map = calloc(len ? len : 1, 1);
+    addrs_t work = {NULL, 0, 0};
+    addrs_t functions = {NULL, 0, 0};
+    int ok = map && addrsPush(&functions, entry) &&
+             addLeader(map, cfg, &work, entry) &&
+             traverse(bytes, map, cfg, &work, &functions) &&
+             formBlocks(bytes, map, cfg) &&
+             assignFunctions(cfg, &functions);
+    free(map);
+    free(work.items);
+    cfg->functions = functions.items;
+    cfg->numFunctions = functions.len;
+    if(!ok) {
+        freeCFG(cfg);
+    }
+    return ok;
+}
+
+void freeCFG(cfg_t *cfg) {
+    free(cfg->blocks);
+    free(cfg->functions);
+    cfg->blocks = NULL;
+    cfg->functions = NULL;
+    cfg->numBlocks = cfg->numFunctions = 0;
+}
+
+/*
+    Prints the bytes between two blocks as data.
+*/
+static void writeData(const uint8_t *bytes, const cfg_t *cfg, int32_t from, int32_t to, sink_t *sink) {
+    char line[LINE];
+    while(from < to) {
+        int n = snprintf(line, LINE, "0x%-5X| .byte", from);
+        int i;
+        for(i = 0; i < 8 && from < to; i++, from++) {
+            n += snprintf(line + n, LINE - n, "%s0x%02x", i ? ", " : " ", bytes[from - cfg->startAddr]);
+        }
+        line[n++] = '\n';
+        sinkWrite(sink, line, n);
+    }
+}
+
+/*
+    Prints the reachable instructions in address order. Bytes that are not
+    reached from the entry are printed as data and every function entry is
+    preceded by a label.
+*/
+void disassembleCFG(const uint8_t *bytes, const cfg_t *cfg, sink_t *sink) {
+    char line[LINE];
+    int32_t pos = cfg->startAddr;
+    size_t i;
+    for(i = 0; i < cfg->numBlocks; i++) {
+        const block_t *block = &cfg->blocks[i];
+        writeData(bytes, cfg, pos, block->start, sink);
+        if(block->function == block->start) {
+            int n = snprintf(line, LINE, "fn_0x%X:\n", block->start);
+            sinkWrite(sink, line, n);
+        }
+        disassembleBytes(bytes + (block->start - cfg->startAddr), block->end - block->start, block->start, sink);
+        pos = block->end;
+        if(block->bad) {
+            writeData(bytes, cfg, pos, pos + 1, sink);
+            pos++;
+        }
+    }
+    writeData(bytes, cfg, pos, cfg->startAddr + (int32_t)cfg->length, sink);
+}
+
+static void writeEdge(sink_t *sink, int32_t from, int32_t to, const char *kind) {
+    char line[LINE];
+    int n = snprintf(line, LINE, "    b_0x%X -> b_0x%X [label=\"%s\"%s];\n", from, to, kind,
+                     strcmp(kind, "call") == 0 ? ", style=dashed" : "");
+    sinkWrite(sink, line, n);
+}
+
+/*
+    Writes the graph in the DOT language with one cluster per function.
+*/
+void writeCFGDot(const cfg_t *cfg, sink_t *sink) {
+    char line[LINE];
+    int n;
+    size_t f, i;
+    n = snprintf(line, LINE, "digraph cfg {\n    node [shape=box, fontname=\"monospace\"];\n");
+    sinkWrite(sink, line, n);
+    for(f = 0; f < cfg->numFunctions; f++) {
+        int32_t function = cfg->functions[f];
+        n = snprintf(line, LINE, "    subgraph cluster_%u {\n        label=\"fn_0x%X\";\n", (unsigned)f, function);
+        sinkWrite(sink, line, n);
+        for(i = 0; i < cfg->numBlocks; i++) {
+            const block_t *block = &cfg->blocks[i];
+            if(block->function != function) {
+                continue;
+            }
+            n = snprintf(line, LINE, "        b_0x%X [label=\"0x%X-0x%X\\n%d instructions%s\"];\n",
+                         block->start, block->start, block->end, block->count, block->bad ? "\\ninvalid" : "");
+            sinkWrite(sink, line, n);
+        }
+        sinkWrite(sink, "    }\n", 6);
+    }
+    for(i = 0; i < cfg->numBlocks; i++) {
+        const block_t *block = &cfg->blocks[i];
+        if(block->exit == FLOW_JUMP) {
+            writeEdge(sink, block->start, block->target, "jump");
+        } else if(block->exit == FLOW_BRANCH) {
+            writeEdge(sink, block->start, block->target, "taken");
+        } else if(block->exit == FLOW_CALL) {
+            writeEdge(sink, block->start, block->target, "call");
+        }
+        if(block->next != NO_ADDR) {
+            writeEdge(sink, block->start, block->next, block->exit == FLOW_CALL ? "return" : "fallthrough");
+        }
+    }
+    sinkWrite(sink, "}\n", 2);
+}
+
+/*
+    Writes the graph as a JSON document listing the functions and, for every
+    block, its bounds, instruction count and outgoing edges.
+*/
+void writeCFGJson(const cfg_t *cfg, sink_t *sink) {
+    char line[LINE];
+    int n;
+    size_t f, i;
+    n = snprintf(line, LINE, "{\n  \"entry\": %d,\n  \"functions\": [", cfg->numFunctions ? cfg->functions[0] : NO_ADDR);
+    sinkWrite(sink, line, n);
+    for(f = 0; f < cfg->numFunctions; f++) {
+        int32_t function = cfg->functions[f];
+        int32_t count = 0;
+        int first = 1;
+        n = snprintf(line, LINE, "%s\n    {\"entry\": %d, \"blocks\": [", f ? "," : "", function);
+        sinkWrite(sink, line, n);
+        for(i = 0; i < cfg->numBlocks; i++) {
+            if(cfg->blocks[i].function != function) {
+                continue;
+            }
+            n = snprintf(line, LINE, "%s%d", first ? "" : ", ", cfg->blocks[i].start);
+            sinkWrite(sink, line, n);
+            count += cfg->blocks[i].count;
+            first = 0;
+        }
+        n = snprintf(line, LINE, "], \"instructions\": %d}", count);
+        sinkWrite(sink, line, n);
+    }
+    sinkWrite(sink, "\n  ],\n  \"blocks\": [", 19);
+    for(i = 0; i < cfg->numBlocks; i++) {
+        const block_t *block = &cfg->blocks[i];
+        n = snprintf(line, LINE, "%s\n    {\"start\": %d, \"end\": %d, \"instructions\": %d, \"function\": %d, ",
+                     i ? "," : "", block->start, block->end, block->count, block->function);
+        sinkWrite(sink, line, n);
+        n = snprintf(line, LINE, "\"exit\": \"%s\", \"target\": %d, \"next\": %d, \"bad\": %s}",
+                     block->bad ? "bad" : flowNames[block->exit], block->target, block->next,
+                     block->bad ? "true" : "false");
+        sinkWrite(sink, line, n);
+    }
+    sinkWrite(sink, "\n  ]\n}\n", 7);
+}
@@ -0,0 +1,46 @@
+#ifndef cfg_h
+#define cfg_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "disasm.h"
+
+#define NO_ADDR -1
+
+/*
+    A basic block: a run of instructions that is only entered at its first
+    instruction and only left after its last one.
+*/
+typedef struct block_s {
+    int32_t start;
+    int32_t end;        /* address following the last instruction */
+    int32_t count;      /* number of instructions */
+    int32_t target;     /* destination of a closing jXX or call; NO_ADDR otherwise */
+    int32_t next;       /* block reached by falling through; NO_ADDR otherwise */
+    int32_t function;   /* entry of the function the block belongs to */
+    uint8_t exit;       /* FLOW_ of the last instruction */
+    uint8_t bad;        /* the block runs into an undecodable instruction */
+} block_t;
+
+/*
+    Control flow graph of the code reachable from an entry point. Blocks are
+    sorted by address and functions are listed in the order they were found.
+*/
+typedef struct cfg_s {
+    int32_t startAddr;
+    size_t length;
+    block_t *blocks;
+    size_t numBlocks;
+    int32_t *functions;
+    size_t numFunctions;
+} cfg_t;
+
+int buildCFG(const uint8_t*, size_t, int32_t, int32_t, cfg_t*);
+void freeCFG(cfg_t*);
+const block_t *findBlock(const cfg_t*, int32_t);
+void disassembleCFG(const uint8_t*, const cfg_t*, sink_t*);
+void writeCFGDot(const cfg_t*, sink_t*);
+void writeCFGJson(const cfg_t*, sink_t*);
+
+#endif
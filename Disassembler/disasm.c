@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytes.h"
+#include "disasm.h"
+
+#define SINK_SIZE 65536
+#define MAX_LINE 64
+
+const char *registerNames[16] = {
+    "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
+    "%r8", "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%none"
+};
+
+/*
+    Descriptor for every possible opcode byte, generated from the instruction
+    specification. Anything not listed there is an invalid instruction. The
+    second table adds the extension instructions.
+*/
+static const opdesc_t stockTable[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) \
+    [code] = {#mnemonic, length, OPND_##layout, FLOW_##flow},
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+static const opdesc_t extendedTable[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) \
+    [code] = {#mnemonic, length, OPND_##layout, FLOW_##flow},
+#define EXTENSION INSTRUCTION
+#include "instructions.def"
+#undef INSTRUCTION
+#undef EXTENSION
+};
+
+const opdesc_t *opcodeTable = stockTable;
+
+/*
+    Makes decoding accept the extension instructions, or stop accepting them.
+    Must not be called while other threads are decoding.
+*/
+void enableExtensions(int enabled) {
+    opcodeTable = enabled ? extendedTable : stockTable;
+}
+
+/*
+    Reads a little endian 32 bit value regardless of the byte order of the host.
+*/
+static int32_t readLong(const uint8_t *bytes) {
+    return (int32_t)loadLE32(bytes);
+}
+
+/*
+    Prepares a sink for use.
+    Arguments:
+        sink_t *sink - the sink to be initialized
+        FILE *stream - the stream the sink flushes to, or NULL to collect the
+                       output in memory
+    Return:
+        1 if the buffer could be allocated; 0 otherwise
+*/
+int sinkInit(sink_t *sink, FILE *stream) {
+    sink->len = 0;
+    sink->cap = SINK_SIZE;
+    sink->stream = stream;
+    sink->buf = malloc(sink->cap);
+    return sink->buf != NULL;
+}
+
+/*
+    Makes sure there is room for at least n more bytes in the sink, either by
+    flushing it to its stream or by growing the buffer.
+*/
+static int sinkReserve(sink_t *sink, size_t n) {
+    if(sink->len + n <= sink->cap) {
+        return 1;
+    }
+    if(sink->stream) {
+        sinkFlush(sink);
+        if(n <= sink->cap) {
+            return 1;
+        }
+    }
+    size_t cap = sink->cap;
+    while(cap < sink->len + n) {
+        cap *= 2;
+    }
+    char *buf = realloc(sink->buf, cap);
+    if(!buf) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 0;
+    }
+    sink->buf = buf;
+    sink->cap = cap;
+    return 1;
+}
+
+void sinkWrite(sink_t *sink, const char *data, size_t n) {
+    if(sink->stream && n > sink->cap) {
+        /* Too big to be worth buffering */
+        sinkFlush(sink);
+        fwrite(data, 1, n, sink->stream);
+    } else if(sinkReserve(sink, n)) {
+        memcpy(sink->buf + sink->len, data, n);
+        sink->len += n;
+    }
+}
+
+/*
+    Writes everything buffered so far to the stream of the sink. Does nothing
+    for in-memory sinks.
+*/
+void sinkFlush(sink_t *sink) {
+    if(sink->stream && sink->len) {
+        fwrite(sink->buf, 1, sink->len, sink->stream);
+        sink->len = 0;
+    }
+}
+
+void sinkFree(sink_t *sink) {
+    sinkFlush(sink);
+    free(sink->buf);
+    sink->buf = NULL;
+    sink->len = sink->cap = 0;
+}
+
+/*
+    Decodes the instruction at the start of the given buffer.
+    Arguments:
+        const uint8_t *bytes - the machine code
+        size_t avail - the number of bytes available in the buffer
+        int32_t addr - the address of the first byte
+        insn_t *insn - receives the decoded instruction
+    Return:
+        The length of the instruction if it was decoded; 0 if the opcode is
+        not a valid instruction; -1 if the buffer ends in the middle of the
+        instruction.
+*/
+int decodeInstruction(const uint8_t *bytes, size_t avail, int32_t addr, insn_t *insn) {
+    const opdesc_t *desc = &opcodeTable[bytes[0]];
+    if(!desc->mnemonic) {
+        return 0;
+    }
+    if(desc->length > avail) {
+        return -1;
+    }
+    insn->addr = addr;
+    insn->opcode = bytes[0];
+    insn->length = desc->length;
+    insn->rA = 0;
+    insn->rB = 0;
+    insn->val = 0;
+    switch(desc->operands) {
+        case OPND_RR:
+        case OPND_R:
+            insn->rA = HIGH_NIBBLE(bytes[1]);
+            insn->rB = LOW_NIBBLE(bytes[1]);
+        break;
+        case OPND_IR:
+        case OPND_RM:
+        case OPND_MR:
+        case OPND_D:
+            insn->rA = HIGH_NIBBLE(bytes[1]);
+            insn->rB = LOW_NIBBLE(bytes[1]);
+            insn->val = readLong(bytes + 2);
+        break;
+        case OPND_DEST:
+            insn->val = readLong(bytes + 1);
+        break;
+    }
+    return desc->length;
+}
+
+/*
+    Appends the assembly text of a decoded instruction to the sink.
+*/
+void formatInstruction(const insn_t *insn, sink_t *sink) {
+    if(!sinkReserve(sink, MAX_LINE)) {
+        return;
+    }
+    const opdesc_t *desc = &opcodeTable[insn->opcode];
+    const char *rA = registerNames[insn->rA];
+    const char *rB = registerNames[insn->rB];
+    char *out = sink->buf + sink->len;
+    int n = 0;
+    switch(desc->operands) {
+        case OPND_NONE:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s\n", insn->addr, desc->mnemonic);
+        break;
+        case OPND_RR:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s %s, %s\n", insn->addr, desc->mnemonic, rA, rB);
+        break;
+        case OPND_IR:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s $%d, %s\n", insn->addr, desc->mnemonic, insn->val, rB);
+        break;
+        case OPND_RM:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s %s, %d(%s)\n", insn->addr, desc->mnemonic, rA, insn->val, rB);
+        break;
+        case OPND_MR:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s %d(%s), %s\n", insn->addr, desc->mnemonic, insn->val, rB, rA);
+        break;
+        case OPND_DEST:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s 0x%X\n", insn->addr, desc->mnemonic, insn->val);
+        break;
+        case OPND_R:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s %s\n", insn->addr, desc->mnemonic, rA);
+        break;
+        case OPND_D:
+            n = snprintf(out, MAX_LINE, "0x%-5X| %s %d(%s)\n", insn->addr, desc->mnemonic, insn->val, rA);
+        break;
+    }
+    if(n > 0) {
+        sink->len += n < MAX_LINE ? n : MAX_LINE - 1;
+    }
+}
+
+/*
+    Disassembles a buffer of machine code with a linear sweep. Invalid opcodes
+    are reported and skipped one byte at a time.
+    Arguments:
+        const uint8_t *bytes - the machine code
+        size_t len - the number of bytes of machine code
+        int32_t startAddr - the address of the first byte
+        sink_t *sink - where the assembly text is written
+    Return:
+        The number of bytes that were consumed. This is less than len only
+        if the last instruction is truncated.
+*/
+size_t disassembleBytes(const uint8_t *bytes, size_t len, int32_t startAddr, sink_t *sink) {
+    size_t pos = 0;
+    insn_t insn;
+    while(pos < len) {
+        int32_t addr = startAddr + (int32_t)pos;
+        int n = decodeInstruction(bytes + pos, len - pos, addr, &insn);
+        if(n > 0) {
+            formatInstruction(&insn, sink);
+            pos += n;
+        } else if(n == 0) {
+            sinkFlush(sink);
+            fprintf(stderr, "ERROR: Unknown Instruction Encountered %02x[0x%X] at 0x%X\n", bytes[pos], bytes[pos], addr);
+            pos += 1;
+        } else {
+            sinkFlush(sink);
+            fprintf(stderr, "ERROR: Truncated instruction at 0x%X\n", addr);
+            break;
+        }
+    }
+    return pos;
+}
@@ -0,0 +1,74 @@
+#ifndef disasm_h
+#define disasm_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "flows.h"
+
+/*
+    Operand layouts of the y86 instructions. The layout decides both how the
+    bytes following the opcode are decoded and how the operands are printed.
+*/
+typedef enum operand_e {
+    OPND_NONE,  /* halt, nop, ret */
+    OPND_RR,    /* rA, rB */
+    OPND_IR,    /* $V, rB */
+    OPND_RM,    /* rA, D(rB) */
+    OPND_MR,    /* D(rB), rA */
+    OPND_DEST,  /* Dest */
+    OPND_R,     /* rA */
+    OPND_D      /* D(rA) */
+} operand_t;
+
+/*
+    Describes a single opcode byte. Opcodes that are not part of the
+    instruction set have a NULL mnemonic and a length of 0.
+*/
+typedef struct opdesc_s {
+    const char *mnemonic;
+    uint8_t length;
+    uint8_t operands;
+    uint8_t flow;       /* FLOW_ */
+} opdesc_t;
+
+/*
+    A decoded instruction. Fields that the operand layout does not use
+    are left as 0.
+*/
+typedef struct insn_s {
+    int32_t addr;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t rA;
+    uint8_t rB;
+    int32_t val;
+} insn_t;
+
+/*
+    Output buffer for disassembled text. A sink bound to a stream is flushed
+    to it whenever it fills up; a sink without a stream grows in memory so
+    the text can be collected and written later.
+*/
+typedef struct sink_s {
+    char *buf;
+    size_t len;
+    size_t cap;
+    FILE *stream;
+} sink_t;
+
+extern const opdesc_t *opcodeTable;
+extern const char *registerNames[16];
+
+int sinkInit(sink_t*, FILE*);
+void sinkWrite(sink_t*, const char*, size_t);
+void sinkFlush(sink_t*);
+void sinkFree(sink_t*);
+
+void enableExtensions(int);
+int decodeInstruction(const uint8_t*, size_t, int32_t, insn_t*);
+void formatInstruction(const insn_t*, sink_t*);
+size_t disassembleBytes(const uint8_t*, size_t, int32_t, sink_t*);
+
+#endif
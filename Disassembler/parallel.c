@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "parallel.h"
+
+#define MIN_CHUNK 16384
+
+/*
+    The range of machine code handled by one thread and the buffer its text
+    is collected in.
+*/
+typedef struct chunk_s {
+    const uint8_t *bytes;
+    size_t start;
+    size_t end;
+    int32_t startAddr;
+    sink_t sink;
+    pthread_t thread;
+} chunk_t;
+
+static void *disassembleChunk(void *arg) {
+    chunk_t *chunk = arg;
+    disassembleBytes(chunk->bytes + chunk->start, chunk->end - chunk->start,
+                     chunk->startAddr + (int32_t)chunk->start, &chunk->sink);
+    return NULL;
+}
+
+/*
+    Finds the instruction boundary at or after the given offset by walking
+    the instruction lengths from a known boundary. This follows the same
+    rules as disassembleBytes (invalid opcodes are one byte long), so every
+    thread starts decoding exactly where the sequential sweep would.
+*/
+static size_t nextBoundary(const uint8_t *bytes, size_t len, size_t from, size_t target) {
+    while(from < target && from < len) {
+        uint8_t length = opcodeTable[bytes[from]].length;
+        from += length ? length : 1;
+    }
+    return from < len ? from : len;
+}
+
+/*
+    Disassembles a buffer of machine code with a linear sweep split across
+    several threads. Each thread formats its range into its own buffer and
+    the buffers are written out in address order, so the output is identical
+    to that of disassembleBytes.
+    Arguments:
+        const uint8_t *bytes - the machine code
+        size_t len - the number of bytes of machine code
+        int32_t startAddr - the address of the first byte
+        int threads - the maximum number of threads to use
+        sink_t *sink - where the assembly text is written
+*/
+void disassembleParallel(const uint8_t *bytes, size_t len, int32_t startAddr, int threads, sink_t *sink) {
+    size_t perThread = len / (threads > 0 ? threads : 1) + 1;
+    if(perThread < MIN_CHUNK) {
+        perThread = MIN_CHUNK;
+    }
+    int numChunks = (int)((len + perThread - 1) / perThread);
+    if(numChunks <= 1) {
+        disassembleBytes(bytes, len, startAddr, sink);
+        return;
+    }
+    chunk_t *chunks = calloc(numChunks, sizeof(chunk_t));
+    if(!chunks) {
+        disassembleBytes(bytes, len, startAddr, sink);
+        return;
+    }
+    size_t pos = 0;
+    int i;
+    for(i = 0; i < numChunks; i++) {
+        chunk_t *chunk = &chunks[i];
+        chunk->bytes = bytes;
+        chunk->startAddr = startAddr;
+        chunk->start = pos;
+        chunk->end = i == numChunks - 1 ? len : nextBoundary(bytes, len, pos, pos + perThread);
+        pos = chunk->end;
+    }
+    int started = 0;
+    for(i = 0; i < numChunks; i++) {
+        chunk_t *chunk = &chunks[i];
+        if(!sinkInit(&chunk->sink, NULL) ||
+           pthread_create(&chunk->thread, NULL, disassembleChunk, chunk) != 0) {
+            break;
+        }
+        started++;
+    }
+    for(i = 0; i < numChunks; i++) {
+        chunk_t *chunk = &chunks[i];
+        if(i < started) {
+            pthread_join(chunk->thread, NULL);
+        } else {
+            /* Threads could not be started, so the rest is done here */
+            if(!chunk->sink.buf && !sinkInit(&chunk->sink, NULL)) {
+                sinkFlush(sink);
+                disassembleBytes(bytes + chunk->start, chunk->end - chunk->start,
+                                 startAddr + (int32_t)chunk->start, sink);
+                continue;
+            }
+            disassembleChunk(chunk);
+        }
+        sinkWrite(sink, chunk->sink.buf, chunk->sink.len);
+        sinkFree(&chunk->sink);
+    }
+    free(chunks);
+}
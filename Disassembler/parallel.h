@@ -0,0 +1,11 @@
+#ifndef parallel_h
+#define parallel_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "disasm.h"
+
+void disassembleParallel(const uint8_t*, size_t, int32_t, int, sink_t*);
+
+#endif
@@ -64,3 +64,37 @@ char *nt_strncpy(const char *src, size_t n) {
     }
     return result;
 }
+
+static int hexDigit(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 0;
+}
+
+/*
+    Converts a string of ascii hex digit pairs into the bytes they represent.
+    A trailing unpaired digit is ignored. Freeing the result is left to the caller.
+    Arguments:
+        const char *hex - the hex string
+        size_t *length - receives the number of bytes in the result
+    Return:
+        The array of bytes if successful; NULL otherwise
+*/
+uint8_t *hexToBytes(const char *hex, size_t *length) {
+    size_t n = strlen(hex) / 2;
+    uint8_t *bytes = malloc(n ? n : 1);
+    if(!bytes) {
+        return NULL;
+    }
+    size_t i;
+    for(i = 0; i < n; i++) {
+        bytes[i] = (uint8_t)( (hexDigit(hex[2 * i]) << 4) | hexDigit(hex[2 * i + 1]) );
+    }
+    *length = n;
+    return bytes;
+}
@@ -1,10 +1,12 @@
 #ifndef util_h
 #define util_h
 #include <stdint.h>
+#include <stddef.h>
 
 int searchStringArray(char**, char*);
 int32_t hexToDec(char*);
 int32_t hexToDecLittleEndian(char*);
 char *nt_strncpy(const char*, size_t);
+uint8_t *hexToBytes(const char*, size_t*);
 
 #endif
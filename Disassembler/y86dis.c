@@ -1,16 +1,56 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "loader.h"
 #include "disassembler.h"
+#include "disasm.h"
+#include "util.h"
+
+static void usage() {
+    printf("Usage: y86dis [options] <inputfile>\n");
+    printf("Options:\n");
+    printf("    -r          disassemble only code reachable from the entry point\n");
+    printf("    -dot        print the control flow graph in the DOT language\n");
+    printf("    -json       print the control flow graph as JSON\n");
+    printf("    -e <addr>   entry point in hex (defaults to the start of .text)\n");
+    printf("    -j <n>      split the linear sweep across n threads\n");
+    printf("    -x          decode the extension instructions readn, writen, cas,\n");
+    printf("                xadd and spawn\n");
+}
 
 int main(int argc, char **argv) {
-    if(argc < 2) {
+    int mode = MODE_LINEAR;
+    int32_t entry = NO_ENTRY;
+    int threads = 1;
+    char *fileName = NULL;
+    int i;
+    for(i = 1; i < argc; i++) {
+        if(strcmp("-h", argv[i]) == 0) {
+            usage();
+            return 0;
+        } else if(strcmp("-r", argv[i]) == 0) {
+            mode = MODE_RECURSIVE;
+        } else if(strcmp("-dot", argv[i]) == 0) {
+            mode = MODE_DOT;
+        } else if(strcmp("-json", argv[i]) == 0) {
+            mode = MODE_JSON;
+        } else if(strcmp("-e", argv[i]) == 0 && i + 1 < argc) {
+            entry = hexToDec(argv[++i]);
+        } else if(strcmp("-x", argv[i]) == 0) {
+            enableExtensions(1);
+        } else if(strcmp("-j", argv[i]) == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            fileName = argv[i];
+        }
+    }
+    if(!fileName) {
         fprintf(stderr, "ERROR: No input file given\n");
         return 1;
     }
-    char **instructions = getInstructions(argv[1]);
+    char **instructions = getInstructions(fileName);
     if(instructions) {
-        disassemble(instructions);
+        disassemble(instructions, mode, entry, threads);
     }
     return 0;
 }
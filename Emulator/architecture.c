@@ -1,41 +1,208 @@
+#include <stdio.h>
 #include <string.h>
 #include <malloc.h>
 #include <ctype.h>
 #include <time.h>
 
 #include "architecture.h"
+#include "machine.h"
+#include "smp.h"
 #include "util.h"
+#include "verifier.h"
 
-static cpu_t cpu;
-static char *memory;
-static int32_t size;
-static status_t status = AOK;
+/*
+    Instruction lengths and control flow generated from the instruction
+    specification, extension instructions included. A length of 0 marks an
+    invalid opcode. The tables shared with other modules follow; see
+    architecture.h.
+*/
+#define EXTENSION INSTRUCTION
+
+static const uint8_t lengths[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = length,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+const uint8_t opFlows[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = FLOW_##flow,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+const uint8_t opClasses[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = CLASS_##class,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+const uint8_t opFns[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = fn,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+const uint8_t opRegisters[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = USES_##layout,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+#undef EXTENSION
+
+/*
+    The extension instructions, only decoded for machines that enabled them.
+*/
+static const uint8_t isExtension[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn)
+#define EXTENSION(code, mnemonic, length, layout, flow, class, fn) [code] = 1,
+#include "instructions.def"
+#undef INSTRUCTION
+#undef EXTENSION
+};
+
+/*
+    Checks that the n bytes starting at addr lie inside guest memory and sets
+    the status to ADR if they do not.
+    Return:
+        1 if the access is in bounds; 0 otherwise
+*/
+static int checkrange(machine_t *m, int32_t addr, int32_t n) {
+    int32_t size = m->mem->size;
+    if((uint32_t)addr > (uint32_t)size || (uint32_t)(size - addr) < (uint32_t)n) {
+        char text[64];
+        snprintf(text, sizeof(text), "Attemped to access out of bound address 0x%x\n", addr);
+        m->message(m->user, text);
+        m->status = ADR;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+    Stops the machine with ADR when the page holding addr could not be
+    given storage for a store. The guest stops; the host goes on.
+    Return:
+        0
+*/
+static int pageFault(machine_t *m, int32_t addr) {
+    char text[64];
+    snprintf(text, sizeof(text), "Out of memory for the page at address 0x%x\n", addr);
+    m->message(m->user, text);
+    m->status = ADR;
+    return 0;
+}
+
+static int checkbound(machine_t *m, int32_t addr) {
+    return checkrange(m, addr, 1);
+}
+
+/*
+    The I/O of a machine that was not given callbacks: stdin and stdout.
+*/
+static int stdInput(void *user, int size, int32_t *value) {
+    int set;
+    int consumed = 0;
+    if(size == 1) {
+        char c = 0;
+        set = scanf("%c%n", &c, &consumed);
+        *value = c;
+    } else {
+        int32_t l = 0;
+        set = scanf("%i%n", &l, &consumed);
+        *value = l;
+    }
+    return set == EOF ? -1 : consumed;
+}
+
+static int stdOutput(void *user, int size, int32_t value) {
+    return size == 1 ? printf("%c", (char)value) : printf("%d", value);
+}
+
+static void stdMessage(void *user, const char *text) {
+    printf("%s", text);
+}
+
+static int32_t stdRead(void *user, void *buf, int32_t len) {
+    return (int32_t)fread(buf, 1, len, stdin);
+}
+
+static int32_t stdWrite(void *user, const void *buf, int32_t len) {
+    return (int32_t)fwrite(buf, 1, len, stdout);
+}
+
+/*
+    Creates a machine without any memory; it has to be initialized before
+    it can run.
+    Return:
+        The machine; NULL if it could not be allocated.
+*/
+machine_t *createMachine() {
+    machine_t *m = calloc(1, sizeof(machine_t));
+    if(!m) {
+        return NULL;
+    }
+    m->mem = &m->memory;
+    m->resumeAddr = -1;
+    m->input = stdInput;
+    m->output = stdOutput;
+    m->message = stdMessage;
+    m->readBlock = stdRead;
+    m->writeBlock = stdWrite;
+    return m;
+}
 
-static void checkbound(int32_t addr) {
-    if(addr >= size) {
-        printf("Attemped to access out of bound address 0x%x\n", addr);
-        status = ADR;
+void destroyMachine(machine_t *m) {
+    if(!m) {
+        return;
     }
+    freeCache(m->cache);
+    freeVerified(m->verified);
+    freeMemory(&m->memory);
+    free(m->breakpoints);
+    free(m->watchpoints);
+    free(m);
 }
 
 /*
-    Allocates the necessary amount of memory needed for program execution
+    Sets up a guest memory of the given size, replacing the previous one,
+    and resets the machine. Pages are only allocated once they are written,
+    so this is cheap even for large sizes. Breakpoints and watchpoints are
+    kept; the watchpoints take effect once the machine runs, so loading the
+    program does not trigger them.
     Arguments:
-        int32_t amt - the amount (in bytes) of memory to be allocated
+        machine_t *m - the machine
+        int32_t amt - the size (in bytes) of guest memory
     Return:
         1 if memory allocation is successful; 0 otherwise
 */
-int initialize(int32_t amt) {
-    size = amt;
-    memory = malloc(amt);
-    return memory != NULL;
+int initialize(machine_t *m, int32_t amt) {
+    freeCache(m->cache);
+    freeVerified(m->verified);
+    freeMemory(&m->memory);
+    memset(&m->cpu, 0, sizeof(cpu_t));
+    memset(m->ras, 0, sizeof(m->ras));
+    m->cache = NULL;
+    m->verified = NULL;
+    m->mem = &m->memory;
+    m->status = AOK;
+    m->executed = 0;
+    m->rasTop = 0;
+    m->resumeAddr = -1;
+    m->watchStale = 1;
+    resetMetrics(&m->metrics);
+    if(!initMemory(m->mem, amt)) {
+        return 0;
+    }
+    m->cache = createCache(m->mem);
+    return m->cache != NULL;
 }
 
-int bss(int32_t amt, int32_t addr) {
+int bss(machine_t *m, int32_t amt, int32_t addr) {
     int i;
     int ok = 1;
     for(i = 0; i < amt; i++) {
-        ok *= putByte(0, addr + i);
+        ok *= putByte(m, 0, addr + i);
     }
     return ok;
 }
@@ -48,17 +215,18 @@ int bss(int32_t amt, int32_t addr) {
         int32_t addr - the address where the instructions will be stored and
                        where the instruction pointer will be set
     Return:
-        1 if there were no issues storing the instructions; 0 otherwise  
+        1 if there were no issues storing the instructions; 0 otherwise
 */
-int insertInstructions(char *instructions, int32_t addr) {
-    cpu.ipointer = addr;
+int insertInstructions(machine_t *m, char *instructions, int32_t addr) {
+    m->cpu.ipointer = addr;
     size_t instrLength = strlen(instructions);
     int ok = 1;
     int i = 0;
     while( (i < instrLength) && ok) {
         char *byteString = nt_strncpy(instructions + i, 2);
         char byte = (char) hexToDec(byteString);
-        ok *= putByte(byte, addr + (i / 2));
+        free(byteString);
+        ok *= putByte(m, byte, addr + (i / 2));
         i += 2;
     }
     return ok;
@@ -72,32 +240,88 @@ int insertInstructions(char *instructions, int32_t addr) {
     Return:
         1 if the entire string was successfully stored in memory; 0 otherwise
 */
-int putString(char *str, int32_t addr) {
+int putString(machine_t *m, char *str, int32_t addr) {
     int i = 0;
     int ok = 1;
     while(str[i] && ok) {
-        ok *= putByte(str[i], addr + i);
+        ok *= putByte(m, str[i], addr + i);
         i++;
     }
     return ok;
 }
 
+static int isWatched(const machine_t *m, int32_t addr, int32_t len) {
+    int i;
+    for(i = 0; i < m->numWatchpoints; i++) {
+        const watch_t *w = &m->watchpoints[i];
+        if(addr < w->addr + w->len && w->addr < addr + len) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Handles stores into pages flagged by IS_SLOW_PAGE: translated code
+    overlapping the written bytes is invalidated, as is the proof of the
+    turbo interpreter if they overlap verified code, and a store into a
+    watched range stops the machine with DBG once the instruction
+    finishes. On
+    shared memory, a store into bytes that any machine translated bumps the
+    code epoch so that the others drop their translations too.
+*/
+static void slowStore(machine_t *m, int32_t addr, int32_t len) {
+    invalidateCode(m->cache, addr, len);
+    forgetVerified(m, addr, len);
+    if(m->mem->shared && isCode(m->mem, addr, len)) {
+        uint32_t epoch = __atomic_add_fetch(&m->mem->codeEpoch, 1, __ATOMIC_RELEASE);
+        if(epoch == m->codeEpoch + 1) {
+            /* Nobody else stored into code since; this cache is up to date */
+            m->codeEpoch = epoch;
+        }
+    }
+    if(m->numWatchpoints && m->status == AOK && isWatched(m, addr, len)) {
+        m->watchAddr = addr;
+        m->status = DBG;
+    }
+}
+
+/*
+    putLong() and getLong() for addresses already known to lie inside
+    guest memory.
+*/
+static inline int storeLong(machine_t *m, int32_t num, int32_t addr) {
+    if(!writeLong(m->mem, addr, num)) {
+        return pageFault(m, addr);
+    }
+    COUNT(m->metrics.memWrites, 1);
+    if(IS_SLOW_PAGE(m->mem, addr) || IS_SLOW_PAGE(m->mem, addr + 3)) {
+        slowStore(m, addr, 4);
+    }
+    return 1;
+}
+
+static inline int32_t loadLong(machine_t *m, int32_t addr) {
+    COUNT(m->metrics.memReads, 1);
+    return readLong(m->mem, addr);
+}
+
 /*
-    Stores a 4 byte integer in memory
+    Stores a 4 byte integer in memory. Stores into pages holding translated
+    code invalidate the blocks that overlap the written bytes.
     Arguments:
         int32_t num - the 32 bit integer that is to be stored in memory
         int32_t addr - the address of where the integer is to be stored
                        in memory
     Return:
         1 if the integer is successfully put in memory; 0 if the address
-        is out of range.
+        is out of range or its page could not be allocated.
 */
-int putLong(int32_t num, int32_t addr) {
-    checkbound(addr);
-    int32_t * loc = (int32_t*)(&memory[addr]);
-    *loc = num;
-
-    return 1;
+int putLong(machine_t *m, int32_t num, int32_t addr) {
+    if(!checkrange(m, addr, 4)) {
+        return 0;
+    }
+    return storeLong(m, num, addr);
 }
 
 /*
@@ -109,10 +333,11 @@ int putLong(int32_t num, int32_t addr) {
         the 32 bit integer stored at the given location in memory if there
         are no issues; 0 otherwise (which can also be a valid return)
 */
-int32_t getLong(int32_t addr) {
-    checkbound(addr);
-    int32_t *loc = (int32_t*)(&memory[addr]);
-    return *loc;
+int32_t getLong(machine_t *m, int32_t addr) {
+    if(!checkrange(m, addr, 4)) {
+        return 0;
+    }
+    return loadLong(m, addr);
 }
 
 /*
@@ -124,21 +349,27 @@ int32_t getLong(int32_t addr) {
         1 if no issues are encountered and the byte is successfully set in memory;
         0 otherwise
 */
-int putByte(char byte, int32_t addr) {
-    if(addr >= size) {
+int putByte(machine_t *m, char byte, int32_t addr) {
+    if((uint32_t)addr >= (uint32_t)m->mem->size) {
         return 0;
     }
-    memory[addr] = byte;
+    if(!writeByte(m->mem, addr, (uint8_t)byte)) {
+        return pageFault(m, addr);
+    }
+    COUNT(m->metrics.memWrites, 1);
+    if(IS_SLOW_PAGE(m->mem, addr)) {
+        slowStore(m, addr, 1);
+    }
     return 1;
 }
 
-static void halt() {
-    status = HLT;
-    cpu.ipointer += 1;
+static void halt(machine_t *m) {
+    m->status = HLT;
+    m->cpu.ipointer += 1;
 }
 
 /*
-    Performs mov instructions of the given type. There are 4 types of mov:
+    Performs mov instructions of the given type. There are 5 types of mov:
         1. RR - Register to Register move
                 2 byte length
         2. IR - Immediate to Register move
@@ -147,40 +378,40 @@ static void halt() {
                 6 byte length
         4. MR - Memory to Register move
                 6 byte length
+        5. SB - Memory to Register move of a sign extended byte
+                6 byte length
     Arguments:
         int fn - The type of mov instruction to be performed
-                
+        const decoded_t *in - the decoded instruction
 */
-static void mov(int fn) {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    int rB = parts.parts.first;
+static void mov(machine_t *m, int fn, const decoded_t *in) {
+    int rA = in->rA;
+    int rB = in->rB;
     if(fn == RR) {
         /*
             Register to Register move
             Behavior: rB <- rA
         */
-        cpu.registers[rB] = cpu.registers[rA];
-        cpu.ipointer += 2;
+        m->cpu.registers[rB] = m->cpu.registers[rA];
+        m->cpu.ipointer += 2;
         return;
     }
-    int32_t val = getLong(cpu.ipointer + 2);;
+    int32_t val = in->val;
     switch(fn) {
         case IR:
             /*
                 Immediate to Register move
                 Behavior: rB <- val
             */
-            cpu.registers[rB] = val;
+            m->cpu.registers[rB] = val;
         break;
         case RM: {
             /*
                 Register to Memory move
                 Behavior: val(rB) <- rA
             */
-            int32_t dst = cpu.registers[rB] + val;
-            putLong(cpu.registers[rA], dst);
+            int32_t dst = m->cpu.registers[rB] + val;
+            putLong(m, m->cpu.registers[rA], dst);
         }
         break;
         case MR: {
@@ -188,21 +419,24 @@ static void mov(int fn) {
                 Memory to Register move
                 rA <- val(rB)
             */
-            int32_t src = cpu.registers[rB] + val;
-            int32_t res = getLong(src);
-            cpu.registers[rA] = res;
+            int32_t src = m->cpu.registers[rB] + val;
+            int32_t res = getLong(m, src);
+            m->cpu.registers[rA] = res;
         }
         break;
         case SB: {
-            int32_t src = cpu.registers[rB] + val;
-            checkbound(src);
-            int8_t item = memory[src];
+            int32_t src = m->cpu.registers[rB] + val;
+            int8_t item = 0;
+            if(checkbound(m, src)) {
+                item = (int8_t)readByte(m->mem, src);
+                COUNT(m->metrics.memReads, 1);
+            }
             int32_t extended = (int32_t) item;
-            cpu.registers[rA] = extended;
+            m->cpu.registers[rA] = extended;
         }
         break;
     }
-    cpu.ipointer += 6;
+    m->cpu.ipointer += 6;
 }
 
 /*
@@ -215,15 +449,14 @@ static void mov(int fn) {
         6. CMP - rB - rA and set flags accordingly
     Arguments:
         int fn - the operation to be performed
+        const decoded_t *in - the decoded instruction
 */
-static void op(int fn) {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    int rB = parts.parts.first;
+static void op(machine_t *m, int fn, const decoded_t *in) {
+    int rA = in->rA;
+    int rB = in->rB;
     int32_t result = 0;
-    int32_t valA = cpu.registers[rA];
-    int32_t valB = cpu.registers[rB];
+    int32_t valA = m->cpu.registers[rA];
+    int32_t valB = m->cpu.registers[rB];
     switch(fn) {
         case ADD:
             result = valB + valA;
@@ -233,7 +466,7 @@ static void op(int fn) {
                     or
                     valA is negative, valB is negative, and result is positive
             */
-            cpu.OF = (valA > 0 && valB > 0 && result < 0) ||
+            m->cpu.OF = (valA > 0 && valB > 0 && result < 0) ||
                      (valA < 0 && valB < 0 && result > 0);
         break;
         case SUB:
@@ -245,7 +478,7 @@ static void op(int fn) {
                     or
                     valB is positive, valA is negative, and result is negative
             */
-            cpu.OF = (valB < 0 && valA > 0 && result > 0) ||
+            m->cpu.OF = (valB < 0 && valA > 0 && result > 0) ||
                      (valB > 0 && valA < 0 && result < 0);
         break;
         case AND:
@@ -253,14 +486,14 @@ static void op(int fn) {
             /*
                 There can't be overflow from 'and' operations.
             */
-            cpu.OF = 0;
+            m->cpu.OF = 0;
         break;
         case XOR:
             result = valB ^ valA;
             /*
                 There can't be overflow from 'xor' operations
             */
-            cpu.OF = 0;
+            m->cpu.OF = 0;
         break;
         case MUL:
             result = valB * valA;
@@ -272,7 +505,7 @@ static void op(int fn) {
                     or
                     one val is positive, one val is negative, and result is positive
             */
-            cpu.OF = (valA > 0 && valB > 0 && result < 0) ||
+            m->cpu.OF = (valA > 0 && valB > 0 && result < 0) ||
                      (valA < 0 && valB < 0 && result < 0) ||
                      (( (valA < 0) ^ (valB < 0) ) && ( (valA > 0) ^ (valB > 0) ) && result > 0);
         break;
@@ -281,131 +514,758 @@ static void op(int fn) {
         ZF is set if rA OP rB is 0
         SF is set if rA OP rB is less than 0
     */
-    cpu.ZF = result == 0;
-    cpu.SF = result < 0;
+    m->cpu.ZF = result == 0;
+    m->cpu.SF = result < 0;
     /*
         cmp does not change registers; it only sets flags
     */
     if(fn != CMP) {
-        cpu.registers[rB] = result;
+        m->cpu.registers[rB] = result;
     }
-    cpu.ipointer += 2;
+    m->cpu.ipointer += 2;
 }
 
 /*
-    Performs a given jump operation based on the cpu flags.
-    Arguments:
-        int fn - The jump operation to be performed
+    Return:
+        1 if the flags make the given jump operation jump; 0 otherwise
 */
-static void jXX(int fn) {
-    int shouldJump = 0;
-    int32_t destination = getLong(cpu.ipointer + 1);
-    checkbound(destination);
+static inline int shouldJump(const cpu_t *cpu, int fn) {
     switch(fn) {
         case JLE:
-            shouldJump = (cpu.SF ^ cpu.OF) || cpu.ZF;
-        break;
+            return (cpu->SF ^ cpu->OF) || cpu->ZF;
         case JL:
-            shouldJump = cpu.SF ^ cpu.OF;
-        break;
+            return cpu->SF ^ cpu->OF;
         case JE:
-            shouldJump = cpu.ZF;
-        break;
+            return cpu->ZF;
         case JNE:
-            shouldJump = !cpu.ZF;
-        break;
+            return !cpu->ZF;
         case JGE:
-            shouldJump = !(cpu.SF ^ cpu.OF);
-        break;
+            return !(cpu->SF ^ cpu->OF);
         case JG:
-            shouldJump = !(cpu.SF ^ cpu.OF) && !cpu.ZF;
-        break;
+            return !(cpu->SF ^ cpu->OF) && !cpu->ZF;
     }
+    return 1;
+}
 
-    if(shouldJump || fn == JMP) {
-        cpu.ipointer = destination;
+/*
+    Performs a given jump operation based on the cpu flags.
+    Arguments:
+        int fn - The jump operation to be performed
+        const decoded_t *in - the decoded instruction
+*/
+static void jXX(machine_t *m, int fn, const decoded_t *in) {
+    int32_t destination = in->val;
+    checkbound(m, destination);
+    if(shouldJump(&m->cpu, fn)) {
+        m->cpu.ipointer = destination;
     } else {
-        cpu.ipointer += 5;
+        m->cpu.ipointer += 5;
     }
 }
 
-static void push(int32_t data) {
-    cpu.registers[ESP] -= 4;
-    putLong(data, cpu.registers[ESP]);
+static void push(machine_t *m, int32_t data) {
+    m->cpu.registers[ESP] -= 4;
+    putLong(m, data, m->cpu.registers[ESP]);
 }
 
-static void pushl() {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    push(cpu.registers[rA]);
-    cpu.ipointer += 2;
+static void pushl(machine_t *m, const decoded_t *in) {
+    push(m, m->cpu.registers[in->rA]);
+    m->cpu.ipointer += 2;
 }
 
-int32_t pop() {
-    int32_t res = getLong(cpu.registers[ESP]);
-    cpu.registers[ESP] += 4;
+static int32_t pop(machine_t *m) {
+    int32_t res = getLong(m, m->cpu.registers[ESP]);
+    m->cpu.registers[ESP] += 4;
     return res;
 }
 
-static void popl() {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    cpu.registers[rA] = pop();
-    cpu.ipointer += 2;
+static void popl(machine_t *m, const decoded_t *in) {
+    m->cpu.registers[in->rA] = pop(m);
+    m->cpu.ipointer += 2;
 }
 
-static void call() {
-    int32_t destination = getLong(cpu.ipointer + 1);
-    checkbound(destination);
-    push(cpu.ipointer + 5); /* Push return address onto stack */
-    cpu.ipointer = destination;
+static void call(machine_t *m, const decoded_t *in) {
+    int32_t destination = in->val;
+    checkbound(m, destination);
+    push(m, m->cpu.ipointer + 5); /* Push return address onto stack */
+    m->cpu.ipointer = destination;
 }
 
-static void ret() {
-    int32_t returnAddr = pop();
-    cpu.ipointer = returnAddr;
+static void ret(machine_t *m) {
+    int32_t returnAddr = pop(m);
+    m->cpu.ipointer = returnAddr;
 }
 
-static void read(int fn) {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    int32_t displacement = getLong(cpu.ipointer + 2);
-    int32_t dst = cpu.registers[rA] + displacement;
-    
-    int set;
+/*
+    Reads up to len bytes of input into buf, with the block callback if the
+    machine has one and otherwise a byte at a time.
+    Return:
+        The number of bytes read; fewer than len only at end of input
+*/
+static int32_t readInto(machine_t *m, uint8_t *buf, int32_t len) {
+    int32_t got = 0;
+    if(m->readBlock) {
+        got = m->readBlock(m->user, buf, len);
+        return got > 0 ? got : 0;
+    }
+    while(got < len) {
+        int32_t value = 0;
+        if(m->input(m->user, 1, &value) < 0) {
+            break;
+        }
+        buf[got++] = (uint8_t)value;
+    }
+    return got;
+}
+
+/*
+    Writes the len bytes in buf to the output, with the block callback if the
+    machine has one and otherwise a byte at a time.
+    Return:
+        The number of output bytes produced
+*/
+static int32_t writeFrom(machine_t *m, const uint8_t *buf, int32_t len) {
+    int32_t written = 0;
+    int32_t i;
+    if(m->writeBlock) {
+        written = m->writeBlock(m->user, buf, len);
+        return written > 0 ? written : 0;
+    }
+    for(i = 0; i < len; i++) {
+        int n = m->output(m->user, 1, (char)buf[i]);
+        if(n > 0) {
+            written += n;
+        }
+    }
+    return written;
+}
+
+/*
+    readn: reads up to rA bytes of input straight into guest memory at
+    D(rB), a page at a time, and sets rA to the number of bytes read. ZF is
+    set if the input ended before rA bytes were read. A range outside of
+    guest memory, including a negative count, stops the machine with ADR
+    before anything is read.
+*/
+static void readBlock(machine_t *m, const decoded_t *in) {
+    int32_t len = m->cpu.registers[in->rA];
+    int32_t dst = m->cpu.registers[in->rB] + in->val;
+    int32_t total = 0;
+    m->cpu.ipointer += 6;
+    if(!checkrange(m, dst, len)) {
+        return;
+    }
+    while(total < len) {
+        int32_t addr = dst + total;
+        uint32_t page = PAGE_OF(addr);
+        int32_t n = PAGE_SIZE - (addr & PAGE_MASK);
+        if(n > len - total) {
+            n = len - total;
+        }
+        uint8_t *data = touchPage(m->mem, page);
+        if(!data) {
+            pageFault(m, addr);
+            break;
+        }
+        int32_t got = readInto(m, data + (addr & PAGE_MASK), n);
+        if(got > 0) {
+            markDirty(m->mem, page);
+            if(IS_SLOW_PAGE(m->mem, addr)) {
+                slowStore(m, addr, got);
+            }
+            total += got;
+        }
+        if(got < n) {
+            break;
+        }
+    }
+    if(total) {
+        COUNT(m->metrics.memWrites, 1);
+        COUNT(m->metrics.ioRead, total);
+    }
+    m->cpu.registers[in->rA] = total;
+    m->cpu.ZF = total < len;
+}
+
+/*
+    writen: writes the rA bytes at D(rB) to the output, a page at a time.
+    A range outside of guest memory stops the machine with ADR before
+    anything is written.
+*/
+static void writeBlock(machine_t *m, const decoded_t *in) {
+    int32_t len = m->cpu.registers[in->rA];
+    int32_t src = m->cpu.registers[in->rB] + in->val;
+    int32_t total = 0;
+    int32_t written = 0;
+    m->cpu.ipointer += 6;
+    if(!checkrange(m, src, len)) {
+        return;
+    }
+    while(total < len) {
+        int32_t addr = src + total;
+        int32_t n = PAGE_SIZE - (addr & PAGE_MASK);
+        if(n > len - total) {
+            n = len - total;
+        }
+        written += writeFrom(m, m->mem->pages[PAGE_OF(addr)] + (addr & PAGE_MASK), n);
+        total += n;
+    }
+    if(total) {
+        COUNT(m->metrics.memReads, 1);
+    }
+    if(written) {
+        COUNT(m->metrics.ioWritten, written);
+    }
+}
+
+static void read(machine_t *m, int fn, const decoded_t *in) {
+    if(fn == N) {
+        readBlock(m, in);
+        return;
+    }
+    int32_t dst = m->cpu.registers[in->rA] + in->val;
+
+    int32_t value = 0;
     int result;
+    int consumed = m->input(m->user, fn == B ? 1 : 4, &value);
     if(fn == B) {
-        char c = 0;
-        set = scanf("%c", &c);
-        result = putByte(c, dst);
+        result = putByte(m, (char)value, dst);
     } else {
-        int32_t l = 0;
-        set = scanf("%i", &l);
-        result = putLong(l, dst);
+        result = putLong(m, value, dst);
+    }
+    if(consumed > 0) {
+        COUNT(m->metrics.ioRead, consumed);
     }
 
-    cpu.ZF = set == EOF;
+    m->cpu.ZF = consumed < 0;
 
     if(!result) {
-        status = ADR;
+        m->status = ADR;
+    }
+
+    m->cpu.ipointer += 6;
+}
+
+static void write(machine_t *m, int fn, const decoded_t *in) {
+    if(fn == N) {
+        writeBlock(m, in);
+        return;
+    }
+    int32_t src = m->cpu.registers[in->rA] + in->val;
+    int written = 0;
+    if(fn == B) {
+        if(checkbound(m, src)) {
+            COUNT(m->metrics.memReads, 1);
+            written = m->output(m->user, 1, (char)readByte(m->mem, src));
+        }
+    } else {
+        int32_t val = getLong(m, src);
+        if(m->status == AOK) {
+            written = m->output(m->user, 4, val);
+        }
+    }
+    if(written > 0) {
+        COUNT(m->metrics.ioWritten, written);
+    }
+    m->cpu.ipointer += 6;
+}
+
+/*
+    Finds the storage of the 4 byte word an atomic instruction works on,
+    which holds it little endian like the rest of guest memory. Atomic
+    accesses must be aligned, so they never straddle two pages.
+    Return:
+        The word; NULL if the address is out of bounds or misaligned, or
+        its page could not be allocated, in which case the status is set
+        to ADR.
+*/
+static uint32_t *atomicWord(machine_t *m, int32_t addr) {
+    if(addr & 3) {
+        char text[64];
+        snprintf(text, sizeof(text), "Misaligned atomic access at address 0x%x\n", addr);
+        m->message(m->user, text);
+        m->status = ADR;
+        return NULL;
     }
-    
-    cpu.ipointer += 6;
+    if(!checkrange(m, addr, 4)) {
+        return NULL;
+    }
+    uint32_t page = PAGE_OF(addr);
+    uint8_t *data = (m->mem->flags[page] & PAGE_PRESENT) ? m->mem->pages[page] : touchPage(m->mem, page);
+    if(!data) {
+        pageFault(m, addr);
+        return NULL;
+    }
+    return (uint32_t*)(data + (addr & PAGE_MASK));
 }
 
-static void write(int fn) {
-    byteParts_t parts;
-    parts.c = memory[cpu.ipointer + 1];
-    int rA = parts.parts.second;
-    int32_t displacement = getLong(cpu.ipointer + 2);
-    int32_t src = cpu.registers[rA] + displacement;
-    checkbound(src);
-    int val = fn == B ? memory[src] : getLong(src);
-    printf(fn == B ? "%c" : "%d", val);
-    cpu.ipointer += 6;
+/*
+    Does for a word stored by an atomic instruction what writeLong() and
+    putLong() do for other stores.
+*/
+static void atomicStored(machine_t *m, int32_t addr) {
+    markDirty(m->mem, PAGE_OF(addr));
+    COUNT(m->metrics.memWrites, 1);
+    if(IS_SLOW_PAGE(m->mem, addr)) {
+        slowStore(m, addr, 4);
+    }
+}
+
+/*
+    cas: compares the word at D(rB) with %eax and, if they are equal,
+    replaces it with rA and sets ZF. Otherwise %eax is loaded with the word
+    and ZF is cleared.
+*/
+static void cas(machine_t *m, const decoded_t *in) {
+    int32_t addr = m->cpu.registers[in->rB] + in->val;
+    m->cpu.ipointer += 6;
+    uint32_t *word = atomicWord(m, addr);
+    if(!word) {
+        return;
+    }
+    uint32_t expected = FROM_LE32((uint32_t)m->cpu.registers[EAX]);
+    uint32_t desired = FROM_LE32((uint32_t)m->cpu.registers[in->rA]);
+    COUNT(m->metrics.memReads, 1);
+    if(__atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        m->cpu.ZF = 1;
+        atomicStored(m, addr);
+    } else {
+        m->cpu.registers[EAX] = (int32_t)FROM_LE32(expected);
+        m->cpu.ZF = 0;
+    }
+}
+
+/*
+    xadd: adds rA to the word at D(rB) and sets rA to the old value of the
+    word.
+*/
+static void xadd(machine_t *m, const decoded_t *in) {
+    int32_t addr = m->cpu.registers[in->rB] + in->val;
+    m->cpu.ipointer += 6;
+    uint32_t *word = atomicWord(m, addr);
+    if(!word) {
+        return;
+    }
+    uint32_t n = (uint32_t)m->cpu.registers[in->rA];
+    uint32_t old;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    old = __atomic_load_n(word, __ATOMIC_RELAXED);
+    while(!__atomic_compare_exchange_n(word, &old, FROM_LE32(FROM_LE32(old) + n), 1,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    }
+    old = FROM_LE32(old);
+#else
+    old = __atomic_fetch_add(word, n, __ATOMIC_SEQ_CST);
+#endif
+    COUNT(m->metrics.memReads, 1);
+    atomicStored(m, addr);
+    m->cpu.registers[in->rA] = (int32_t)old;
+}
+
+/*
+    spawn: starts the next idle CPU of the machine at rA with its stack at
+    rB, and sets rA to the number of the CPU, or to -1 if none was started.
+    A machine that is not part of an SMP guest has no other CPU to start.
+*/
+static void spawn(machine_t *m, const decoded_t *in) {
+    int32_t pc = m->cpu.registers[in->rA];
+    int32_t sp = m->cpu.registers[in->rB];
+    m->cpu.ipointer += 2;
+    m->cpu.registers[in->rA] = m->smp ? startCpu(m->smp, pc, sp) : -1;
+}
+
+static void smp(machine_t *m, int fn, const decoded_t *in) {
+    switch(fn) {
+        case CAS:
+            cas(m, in);
+            break;
+        case XADD:
+            xadd(m, in);
+            break;
+        case SPAWN:
+            spawn(m, in);
+            break;
+    }
+}
+
+/*
+    Maps the class column of the instruction specification onto the routine
+    that implements it.
+*/
+#define EXEC_NOP(fn)   m->cpu.ipointer += 1
+#define EXEC_HALT(fn)  halt(m)
+#define EXEC_MOV(fn)   mov(m, fn, in)
+#define EXEC_OP(fn)    op(m, fn, in)
+#define EXEC_JXX(fn)   jXX(m, fn, in)
+#define EXEC_CALL(fn)  call(m, in)
+#define EXEC_RET(fn)   ret(m)
+#define EXEC_PUSH(fn)  pushl(m, in)
+#define EXEC_POP(fn)   popl(m, in)
+#define EXEC_READ(fn)  read(m, fn, in)
+#define EXEC_WRITE(fn) write(m, fn, in)
+#define EXEC_SMP(fn)   smp(m, fn, in)
+
+/*
+    Carries out a single decoded instruction. Every instruction is counted
+    under its class; the number retired is the sum over all classes.
+*/
+static void exec(machine_t *m, const decoded_t *in) {
+    switch(in->opcode) {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) \
+        case code: COUNT(m->metrics.classes[CLASS_##class], 1); EXEC_##class(fn); break;
+#define EXTENSION INSTRUCTION
+#include "instructions.def"
+#undef INSTRUCTION
+#undef EXTENSION
+    }
+}
+
+/*
+    Decodes the instruction at the given address from guest memory.
+    Arguments:
+        const machine_t *m - the machine
+        int32_t pc - the address of the instruction
+        decoded_t *in - receives the decoded instruction
+    Return:
+        1 if a valid instruction lies entirely inside guest memory and only
+        names existing registers; 0 otherwise. Extension instructions are
+        only valid on machines that enabled them.
+*/
+int decode(const machine_t *m, int32_t pc, decoded_t *in) {
+    int32_t size = m->mem->size;
+    if((uint32_t)pc >= (uint32_t)size) {
+        return 0;
+    }
+    uint8_t opcode = readByte(m->mem, pc);
+    uint8_t length = lengths[opcode];
+    if(!length || (uint32_t)(size - pc) < length || (isExtension[opcode] && !m->extensions)) {
+        return 0;
+    }
+    in->opcode = opcode;
+    in->length = length;
+    in->rA = 0;
+    in->rB = 0;
+    in->val = 0;
+    if(length == 2 || length == 6) {
+        uint8_t regs = readByte(m->mem, pc + 1);
+        in->rA = HIGH_NIBBLE(regs);
+        in->rB = LOW_NIBBLE(regs);
+        if( ((opRegisters[opcode] & USES_A) && in->rA >= NUM_REGISTERS) ||
+            ((opRegisters[opcode] & USES_B) && in->rB >= NUM_REGISTERS) ) {
+            return 0;
+        }
+    }
+    if(length == 6) {
+        in->val = readLong(m->mem, pc + 2);
+    } else if(length == 5) {
+        in->val = readLong(m->mem, pc + 1);
+    }
+    return 1;
+}
+
+/*
+    Fetches, decodes and carries out the instruction at the instruction
+    pointer.
+*/
+void step(machine_t *m) {
+    decoded_t insn;
+    m->executed++;
+    if(decode(m, m->cpu.ipointer, &insn)) {
+        exec(m, &insn);
+    } else if(checkbound(m, m->cpu.ipointer)) {
+        m->status = INS;
+        m->message(m->user, "Unknown Instruction Encountered\n");
+    }
+}
+
+/*
+    Breakpoints are kept in a plain array; it is only searched when code is
+    translated, or before every instruction by the reference interpreter
+    while there are any.
+*/
+static int isBreakpoint(const machine_t *m, int32_t addr) {
+    int i;
+    for(i = 0; i < m->numBreakpoints; i++) {
+        if(m->breakpoints[i] == addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Drops the translations overlapping addr so that the next translation
+    sees the breakpoints as they are now.
+*/
+static void retranslate(machine_t *m, int32_t addr) {
+    if(m->cache && (uint32_t)addr < (uint32_t)m->mem->size) {
+        invalidateCode(m->cache, addr, 1);
+        releaseInvalidated(m->cache);
+    }
+}
+
+/*
+    Return:
+        1 if the breakpoint was added; 0 if it already existed or there was
+        no memory for it
+*/
+int addBreakpoint(machine_t *m, int32_t addr) {
+    if(isBreakpoint(m, addr)) {
+        return 0;
+    }
+    int32_t *grown = realloc(m->breakpoints, (m->numBreakpoints + 1) * sizeof(int32_t));
+    if(!grown) {
+        return 0;
+    }
+    m->breakpoints = grown;
+    m->breakpoints[m->numBreakpoints++] = addr;
+    retranslate(m, addr);
+    return 1;
+}
+
+/*
+    Return:
+        1 if the breakpoint was removed; 0 if there was none at addr
+*/
+int removeBreakpoint(machine_t *m, int32_t addr) {
+    int i;
+    for(i = 0; i < m->numBreakpoints; i++) {
+        if(m->breakpoints[i] == addr) {
+            m->breakpoints[i] = m->breakpoints[--m->numBreakpoints];
+            retranslate(m, addr);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Sets the PAGE_WATCH flag of exactly the pages covered by watchpoints.
+*/
+static void armWatchpoints(machine_t *m) {
+    uint32_t page;
+    int i;
+    m->watchStale = 0;
+    if(!m->mem->flags) {
+        return;
+    }
+    for(page = 0; page < m->mem->numPages; page++) {
+        m->mem->flags[page] &= ~PAGE_WATCH;
+    }
+    for(i = 0; i < m->numWatchpoints; i++) {
+        int64_t first = m->watchpoints[i].addr;
+        int64_t last = first + m->watchpoints[i].len - 1;
+        if(first < 0) {
+            first = 0;
+        }
+        if(last >= m->mem->size) {
+            last = m->mem->size - 1;
+        }
+        for(; first <= last; first = (first | PAGE_MASK) + 1) {
+            m->mem->flags[PAGE_OF(first)] |= PAGE_WATCH;
+        }
+    }
+}
+
+/*
+    Watches the len bytes starting at addr: a run stops with STOP_WATCHPOINT
+    after any instruction that stores into them. Watching costs nothing for
+    stores to other pages.
+    Return:
+        1 if the watchpoint was added; 0 otherwise
+*/
+int addWatchpoint(machine_t *m, int32_t addr, int32_t len) {
+    if(len <= 0) {
+        return 0;
+    }
+    watch_t *grown = realloc(m->watchpoints, (m->numWatchpoints + 1) * sizeof(watch_t));
+    if(!grown) {
+        return 0;
+    }
+    m->watchpoints = grown;
+    m->watchpoints[m->numWatchpoints].addr = addr;
+    m->watchpoints[m->numWatchpoints].len = len;
+    m->numWatchpoints++;
+    armWatchpoints(m);
+    return 1;
+}
+
+/*
+    Return:
+        1 if a watchpoint starting at addr was removed; 0 otherwise
+*/
+int removeWatchpoint(machine_t *m, int32_t addr) {
+    int i;
+    for(i = 0; i < m->numWatchpoints; i++) {
+        if(m->watchpoints[i].addr == addr) {
+            m->watchpoints[i] = m->watchpoints[--m->numWatchpoints];
+            armWatchpoints(m);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Decodes the straight-line code starting at the given address into a new
+    block and adds it to the translation cache. Blocks end before breakpoints,
+    and a breakpoint itself becomes an empty block with the flow FLOW_TRAP,
+    so breakpoints cost nothing while no translated code reaches them.
+    Return:
+        The new block; NULL if the first instruction cannot be decoded.
+*/
+static tblock_t *translate(machine_t *m, int32_t pc) {
+    decoded_t insns[BLOCK_MAX];
+    int32_t count = 0;
+    int32_t addr = pc;
+    uint8_t flow = FLOW_NEXT;
+    if(m->numBreakpoints && isBreakpoint(m, pc)) {
+        flow = FLOW_TRAP;
+    } else {
+        while(count < BLOCK_MAX && decode(m, addr, &insns[count])) {
+            flow = opFlows[insns[count].opcode];
+            addr += insns[count].length;
+            count++;
+            if(flow != FLOW_NEXT || (m->numBreakpoints && isBreakpoint(m, addr))) {
+                break;
+            }
+        }
+        if(!count) {
+            return NULL;
+        }
+    }
+    tblock_t *block = allocBlock(count);
+    if(!block) {
+        return NULL;
+    }
+    memcpy(block->insns, insns, count * sizeof(decoded_t));
+    block->start = pc;
+    block->end = addr;
+    block->count = count;
+    block->flow = flow;
+    block->target = count ? insns[count - 1].val : pc;
+    insertBlock(m->cache, block);
+    return block;
+}
+
+/*
+    Runs the instructions of a block until the block ends, the machine stops
+    or one of the instructions overwrites the block itself.
+    Return:
+        The number of instructions executed.
+*/
+static int32_t runBlock(machine_t *m, const tblock_t *block) {
+    const decoded_t *in = block->insns;
+    const decoded_t *end = in + block->count;
+    for(; in < end; in++) {
+        exec(m, in);
+        if(m->status != AOK || !block->valid) {
+            return in - block->insns + 1;
+        }
+    }
+    return block->count;
+}
+
+/*
+    Finds the block at the instruction pointer, translating it if needed.
+*/
+static tblock_t *dispatch(machine_t *m) {
+    tblock_t *block = lookupBlock(m->cache, m->cpu.ipointer);
+    return block ? block : translate(m, m->cpu.ipointer);
+}
+
+/*
+    Remembers the continuation of a call block: the block at its return
+    address, translated now if it has not been already.
+*/
+static void pushReturn(machine_t *m, tblock_t *callBlock) {
+    tblock_t *cont = callBlock->fallthrough;
+    if(!cont && (cont = lookupBlock(m->cache, callBlock->end)) == NULL) {
+        cont = translate(m, callBlock->end);
+    }
+    if(cont && !callBlock->fallthrough) {
+        chainBlock(callBlock, CHAIN_FALLTHROUGH, cont);
+    }
+    rasentry_t *entry = &m->ras[m->rasTop++ & (RAS_SIZE - 1)];
+    entry->addr = callBlock->end;
+    entry->epoch = m->cache->epoch;
+    entry->block = cont;
+}
+
+/*
+    Predicts the block a ret continues at. The prediction is only used if the
+    address popped by the guest is the one the matching call pushed and no
+    block has been invalidated since.
+*/
+static tblock_t *popReturn(machine_t *m) {
+    rasentry_t *entry = &m->ras[--m->rasTop & (RAS_SIZE - 1)];
+    if(entry->block && entry->addr == m->cpu.ipointer && entry->epoch == m->cache->epoch) {
+        return entry->block;
+    }
+    return dispatch(m);
+}
+
+/*
+    Watchdog. The instruction budget is exact: runs stop right at it, like
+    they stop at the limit given to run(). Reading the clock costs more than
+    a block, so the time budget is only looked at every CLOCK_INTERVAL
+    blocks (instructions for the reference interpreter).
+*/
+#define CLOCK_INTERVAL 1024
+
+/*
+    Limits how long the program may run from now on. Running out of either
+    budget stops the machine with the status TMO.
+    Arguments:
+        machine_t *m - the machine
+        uint64_t instructions - the number of instructions; 0 for no limit
+        int32_t milliseconds - the wall clock time; 0 for no limit
+*/
+void setBudget(machine_t *m, uint64_t instructions, int32_t milliseconds) {
+    m->executed = 0;
+    m->instructionBudget = instructions;
+    m->timeBudget = milliseconds;
+    m->untilClock = CLOCK_INTERVAL;
+    clock_gettime(CLOCK_MONOTONIC, &m->deadline);
+    m->deadline.tv_sec += milliseconds / 1000;
+    m->deadline.tv_nsec += (long)(milliseconds % 1000) * 1000000;
+    if(m->deadline.tv_nsec >= 1000000000) {
+        m->deadline.tv_sec++;
+        m->deadline.tv_nsec -= 1000000000;
+    }
+}
+
+/*
+    Return:
+        1 if the time budget has run out; 0 otherwise
+*/
+static int timeExpired(machine_t *m) {
+    if(--m->untilClock) {
+        return 0;
+    }
+    struct timespec now;
+    m->untilClock = CLOCK_INTERVAL;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > m->deadline.tv_sec ||
+           (now.tv_sec == m->deadline.tv_sec && now.tv_nsec >= m->deadline.tv_nsec);
+}
+
+/*
+    Makes the current or next run return STOP_INTERRUPT before the next
+    instruction (block for the block engine). It only stores a flag, so it
+    may be called from a signal handler or from another thread.
+*/
+void interruptMachine(machine_t *m) {
+    __atomic_store_n(&m->interrupt, 1, __ATOMIC_RELAXED);
+}
+
+/*
+    Return:
+        1 if the machine was interrupted since this was last called; 0 otherwise
+*/
+static int interrupted(machine_t *m) {
+    return __atomic_load_n(&m->interrupt, __ATOMIC_RELAXED) &&
+           __atomic_exchange_n(&m->interrupt, 0, __ATOMIC_RELAXED);
 }
 
 /*
@@ -414,101 +1274,327 @@ static void write(int fn) {
     HLT - This is a normal halt and is specified by the user in the machine instructions
     ADR - An invalid address has been encountered
     INS - An invalid Instruction has been encountered
+    A fourth, TMO, is added when a budget set with setBudget runs out.
+    This is the reference interpreter: every instruction is fetched and decoded
+    from memory each time it is executed.
+    Arguments:
+        machine_t *m - the machine
+        uint64_t horizon - the value of m->executed to stop at
     Return:
-        The status of the machine when it stops.
-*/
-status_t execute() {
-    while(status == AOK) {
-        unsigned char instruction = (unsigned char)memory[cpu.ipointer];
-        switch(instruction) {
-            case 0x00: /* nop */
-                cpu.ipointer += 1;
-            break;
-            case 0x10: /* halt */
-                halt();
-            break;
-            case 0x20: /* rrmovl */
-                mov(RR);
-            break;
-            case 0x30: /* irmovl */
-                mov(IR);
-            break;
-            case 0x40: /* rmmovl */
-                mov(RM);
-            break;
-            case 0x50: /* mrmovl */
-                mov(MR);
-            break;
-            case 0x60: /* addl */
-                op(ADD);
-            break;
-            case 0x61: /* subl */
-                op(SUB);
-            break;
-            case 0x62: /* andl */
-                op(AND);
-            break;
-            case 0x63: /* xorl */
-                op(XOR);
-            break;
-            case 0x64: /* mull */
-                op(MUL);
-            break;
-            case 0x65: /* cmpl */
-                op(CMP);
-            break;
-            case 0x70: /* jmp */
-                jXX(JMP);
-            break;
-            case 0x71: /* jle */
-                jXX(JLE);
-            break;
-            case 0x72: /* jl */
-                jXX(JL);
-            break;
-            case 0x73: /* je */
-                jXX(JE);
-            break;
-            case 0x74: /* jne */
-                jXX(JNE);
-            break;
-            case 0x75: /* jge */
-                jXX(JGE);
-            break;
-            case 0x76: /* jg */
-                jXX(JG);
-            break;
-            case 0x80: /* call */
-                call();
-            break;
-            case 0x90: /* ret */
-                ret();
-            break;
-            case 0xA0: /* pushl */
-                pushl();
-            break;
-            case 0xB0: /* popl */
-                popl();
-            break;
-            case 0xC0: /* readb */
-                read(B);
-            break;
-            case 0xC1: /* readl */
-                read(L);
+        One of the STOP_ reasons.
+*/
+static int execute(machine_t *m, uint64_t horizon) {
+    while(m->status == AOK) {
+        if(m->executed >= horizon) {
+            return STOP_LIMIT;
+        }
+        if(m->timeBudget && timeExpired(m)) {
+            m->status = TMO;
             break;
-            case 0xD0: /* writeb */
-                write(B);
+        }
+        if(interrupted(m)) {
+            return STOP_INTERRUPT;
+        }
+        if(m->numBreakpoints && isBreakpoint(m, m->cpu.ipointer)) {
+            return STOP_BREAKPOINT;
+        }
+        step(m);
+    }
+    return STOP_STATUS;
+}
+
+/*
+    The instructions of the turbo interpreter that use the stack. They
+    leave out the bounds check while %esp stays inside the stack the
+    verifier checked against the code, and otherwise run the checked
+    instruction. Each returns the verified instruction to continue at.
+*/
+static inline const tinsn_t *turboCall(machine_t *m, const verified_t *v, const tinsn_t *t) {
+    int32_t sp = m->cpu.registers[ESP] - 4;
+    if(inStack(v, sp)) {
+        m->cpu.registers[ESP] = sp;
+        storeLong(m, m->cpu.ipointer + 5, sp);
+        m->cpu.ipointer = t->in.val;
+    } else {
+        call(m, &t->in);
+    }
+    return &v->insns[t->target];
+}
+
+static inline const tinsn_t *turboRet(machine_t *m, const verified_t *v) {
+    int32_t sp = m->cpu.registers[ESP];
+    if(inStack(v, sp)) {
+        m->cpu.ipointer = loadLong(m, sp);
+        m->cpu.registers[ESP] = sp + 4;
+    } else {
+        ret(m);
+    }
+    return findVerified(v, m->cpu.ipointer);
+}
+
+static inline const tinsn_t *turboPush(machine_t *m, const verified_t *v, const tinsn_t *t) {
+    int32_t sp = m->cpu.registers[ESP] - 4;
+    if(inStack(v, sp)) {
+        int32_t data = m->cpu.registers[t->in.rA];
+        m->cpu.registers[ESP] = sp;
+        storeLong(m, data, sp);
+        m->cpu.ipointer += 2;
+    } else {
+        pushl(m, &t->in);
+    }
+    return &v->insns[t->next];
+}
+
+static inline const tinsn_t *turboPop(machine_t *m, const verified_t *v, const tinsn_t *t) {
+    int32_t sp = m->cpu.registers[ESP];
+    if(inStack(v, sp)) {
+        int32_t data = loadLong(m, sp);
+        m->cpu.registers[ESP] = sp + 4;
+        m->cpu.registers[t->in.rA] = data;
+        m->cpu.ipointer += 2;
+    } else {
+        popl(m, &t->in);
+    }
+    return &v->insns[t->next];
+}
+
+static inline const tinsn_t *turboJump(machine_t *m, const verified_t *v, const tinsn_t *t, int fn) {
+    if(shouldJump(&m->cpu, fn)) {
+        m->cpu.ipointer = t->in.val;
+        return &v->insns[t->target];
+    }
+    m->cpu.ipointer += 5;
+    return &v->insns[t->next];
+}
+
+/*
+    Maps the class column of the instruction specification onto the turbo
+    interpreter. Instructions that do not transfer control run like they
+    do everywhere else and continue with the following instruction.
+*/
+#define TURBO_NOP(fn)   EXEC_NOP(fn); t = &v->insns[t->next]
+#define TURBO_HALT(fn)  EXEC_HALT(fn)
+#define TURBO_MOV(fn)   EXEC_MOV(fn); t = &v->insns[t->next]
+#define TURBO_OP(fn)    EXEC_OP(fn); t = &v->insns[t->next]
+#define TURBO_JXX(fn)   t = turboJump(m, v, t, fn)
+#define TURBO_CALL(fn)  t = turboCall(m, v, t)
+#define TURBO_RET(fn)   t = turboRet(m, v)
+#define TURBO_PUSH(fn)  t = turboPush(m, v, t)
+#define TURBO_POP(fn)   t = turboPop(m, v, t)
+#define TURBO_READ(fn)  EXEC_READ(fn); t = &v->insns[t->next]
+#define TURBO_WRITE(fn) EXEC_WRITE(fn); t = &v->insns[t->next]
+#define TURBO_SMP(fn)   EXEC_SMP(fn); t = &v->insns[t->next]
+
+/*
+    The turbo variant of execute() for programs that passed verification.
+    It runs the instructions the verifier decoded, going from each straight
+    to the next, so there is no fetch, no decode, no invalid instruction to
+    report and no destination to check. Budgets, interrupts and limits work
+    as in execute(), but are only checked when control may have been
+    transferred: each check covers the run of instructions up to the next
+    jXX, call, ret or halt, cut short so the horizon is still met exactly.
+    Returns with the status still AOK once the program leaves the verified
+    code, through a ret or by overwriting it; the checked engines carry on
+    from there.
+    Return:
+        One of the STOP_ reasons.
+*/
+static int executeTurbo(machine_t *m, uint64_t horizon) {
+    const verified_t *v = m->verified;
+    const tinsn_t *t = findVerified(v, m->cpu.ipointer);
+    while(t && v->valid) {
+        if(m->executed >= horizon) {
+            return STOP_LIMIT;
+        }
+        if(m->timeBudget && timeExpired(m)) {
+            m->status = TMO;
             break;
-            case 0xD1: /* writel */
-                write(L);
+        }
+        if(interrupted(m)) {
+            return STOP_INTERRUPT;
+        }
+        uint64_t run = t->run;
+        if(run > horizon - m->executed) {
+            run = horizon - m->executed;
+        }
+        do {
+            const decoded_t *in = &t->in;
+            m->executed++;
+            switch(in->opcode) {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) \
+                case code: COUNT(m->metrics.classes[CLASS_##class], 1); TURBO_##class(fn); break;
+#define EXTENSION INSTRUCTION
+#include "instructions.def"
+#undef INSTRUCTION
+#undef EXTENSION
+            }
+            if(m->status != AOK) {
+                return STOP_STATUS;
+            }
+        } while(--run && v->valid);
+    }
+    return STOP_STATUS;
+}
+
+/*
+    Return:
+        1 if the next run may use the turbo interpreter; 0 if it needs
+        the checked engines, for breakpoints, watchpoints, coverage or
+        other CPUs, or because the proof no longer holds
+*/
+static int turbo(const machine_t *m) {
+    const verified_t *v = m->verified;
+    return v && v->valid && v->extensions == m->extensions &&
+           !m->numBreakpoints && !m->numWatchpoints && !m->coverage && !m->smp;
+}
+
+/*
+    Executes the program like execute(), but runs translated blocks from the
+    translation cache. Each block remembers the blocks found at its jump
+    destination and at its fall-through address, so the cache is searched
+    only when a successor is seen for the first time. Returns are predicted
+    with the shadow return address stack and only fall back to a search
+    when the prediction misses. Blocks that would run past the horizon are
+    finished one instruction at a time.
+    Return:
+        One of the STOP_ reasons.
+*/
+static int executeBlocks(machine_t *m, uint64_t horizon) {
+    tblock_t *block = NULL;
+    int shared = m->mem->shared;
+    while(m->status == AOK) {
+        if(shared) {
+            uint32_t epoch = __atomic_load_n(&m->mem->codeEpoch, __ATOMIC_ACQUIRE);
+            if(epoch != m->codeEpoch) {
+                /* Another machine stored into translated code */
+                m->codeEpoch = epoch;
+                flushCache(m->cache);
+                block = NULL;
+            }
+        }
+        if(m->timeBudget && timeExpired(m)) {
+            m->status = TMO;
             break;
-            case 0xE0: /* movsbl */
-                mov(SB);
+        }
+        if(interrupted(m)) {
+            return STOP_INTERRUPT;
+        }
+        if(!block && !(block = dispatch(m))) {
+            /* Not translatable; let the interpreter report why */
+            if(m->executed >= horizon) {
+                return STOP_LIMIT;
+            }
+            step(m);
+            continue;
+        }
+        if(m->executed + block->count > horizon) {
+            if(m->executed >= horizon) {
+                return STOP_LIMIT;
+            }
+            step(m);
+            block = NULL;
+            continue;
+        }
+        m->executed += runBlock(m, block);
+        if(m->status != AOK) {
             break;
-            default:
-                status = INS;
-                printf("Unknown Instruction Encountered\n");
         }
+        if(m->coverage) {
+            m->coverage[EDGE_INDEX(block->end, m->cpu.ipointer)]++;
+        }
+        if(!block->valid) {
+            releaseInvalidated(m->cache);
+            block = NULL;
+            continue;
+        }
+        tblock_t *next = NULL;
+        if(block->flow == FLOW_RET) {
+            next = popReturn(m);
+        } else if(block->flow == FLOW_HALT) {
+            next = dispatch(m);
+        } else if(block->flow == FLOW_TRAP) {
+            return STOP_BREAKPOINT;
+        } else if(m->cpu.ipointer == block->end && block->flow != FLOW_JUMP) {
+            if(!(next = block->fallthrough) && (next = dispatch(m))) {
+                chainBlock(block, CHAIN_FALLTHROUGH, next);
+            }
+        } else if(m->cpu.ipointer == block->target) {
+            if(!(next = block->taken) && (next = dispatch(m))) {
+                chainBlock(block, CHAIN_TAKEN, next);
+            }
+            if(block->flow == FLOW_CALL) {
+                pushReturn(m, block);
+            }
+        } else {
+            next = dispatch(m);
+        }
+        block = next;
+    }
+    return STOP_STATUS;
+}
+
+/*
+    Executes just the block at the instruction pointer, on the same path
+    executeBlocks() takes, including the shadow return stack, stopping with
+    status TMO once the instruction budget is spent. Used to check the block
+    engine against the reference interpreter one block at a time.
+    Return:
+        The number of instructions executed.
+*/
+uint64_t stepBlock(machine_t *m) {
+    uint64_t before = m->executed;
+    tblock_t *block = dispatch(m);
+    if(m->status == AOK) {
+        uint64_t horizon = m->executed + (block && block->count ? block->count : 1);
+        if(m->instructionBudget && m->instructionBudget < horizon) {
+            horizon = m->instructionBudget;
+        }
+        if(executeBlocks(m, horizon) == STOP_LIMIT && m->instructionBudget && m->executed >= m->instructionBudget) {
+            m->status = TMO;
+        }
+    }
+    setMetricsStatus(&m->metrics, m->status);
+    return m->executed - before;
+}
+
+/*
+    Runs the machine until it stops, reaches a breakpoint or has executed
+    the given number of instructions. A run that starts at the breakpoint
+    the previous run stopped at steps over it.
+    Arguments:
+        machine_t *m - the machine
+        uint64_t limit - the most instructions to execute; 0 for no limit
+    Return:
+        One of the STOP_ reasons. Running out of the instruction budget is
+        reported as STOP_STATUS with the status TMO.
+*/
+int run(machine_t *m, uint64_t limit) {
+    uint64_t horizon = limit ? m->executed + limit : UINT64_MAX;
+    if(m->instructionBudget && m->instructionBudget < horizon) {
+        horizon = m->instructionBudget;
+    }
+    int stop = STOP_STATUS;
+    if(m->watchStale) {
+        armWatchpoints(m);
+    }
+    if(m->status == AOK && m->resumeAddr == m->cpu.ipointer && m->executed < horizon) {
+        step(m);
+    }
+    if(m->status == AOK && turbo(m)) {
+        stop = executeTurbo(m, horizon);
+    }
+    if(m->status == AOK && stop == STOP_STATUS) {
+        stop = m->reference ? execute(m, horizon) : executeBlocks(m, horizon);
+    }
+    if(m->status == DBG) {
+        m->status = AOK;
+        stop = STOP_WATCHPOINT;
+    }
+    if(stop == STOP_LIMIT && m->instructionBudget && m->executed >= m->instructionBudget) {
+        m->status = TMO;
+        stop = STOP_STATUS;
     }
-    return status;
+    m->resumeAddr = stop == STOP_BREAKPOINT ? m->cpu.ipointer : -1;
+    setMetricsStatus(&m->metrics, m->status);
+    return stop;
 }
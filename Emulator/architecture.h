@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "flows.h"
+
 #define NUM_REGISTERS 8
 
 #define EAX 0
@@ -37,19 +39,54 @@
 
 #define B 0
 #define L 1
+#define N 2
+
+#define CAS   0
+#define XADD  1
+#define SPAWN 2
+
+/*
+    The register fields each operand layout actually uses. Decoding rejects
+    instructions that name a register outside of the register file in one of
+    these fields.
+*/
+#define USES_A 1
+#define USES_B 2
+#define USES_NONE 0
+#define USES_RR   (USES_A | USES_B)
+#define USES_IR   USES_B
+#define USES_RM   (USES_A | USES_B)
+#define USES_MR   (USES_A | USES_B)
+#define USES_DEST 0
+#define USES_R    USES_A
+#define USES_D    USES_A
 
-typedef union byteParts_u {
-    struct {
-        unsigned int first:4;
-        unsigned int second:4;
-    } parts;
-    char c;
-} byteParts_t;
+/*
+    Tables generated from the instruction specification in architecture.c,
+    extension instructions included, indexed by opcode.
+    opFlows     - the FLOW_ of the instruction
+    opClasses   - the CLASS_ the instruction is counted under (metrics.h)
+    opFns       - the fn column, like ADD, IR or SPAWN
+    opRegisters - the USES_ bits of its operand layout
+*/
+extern const uint8_t opFlows[256];
+extern const uint8_t opClasses[256];
+extern const uint8_t opFns[256];
+extern const uint8_t opRegisters[256];
 
 typedef int32_t reg_t;
 
+/*
+    Machine status
+    AOK - running
+    HLT - halted by the program
+    ADR - an invalid address was accessed
+    INS - an invalid instruction was encountered
+    TMO - the instruction or time budget ran out
+    DBG - a watchpoint was hit; run() turns this back into AOK
+*/
 typedef enum status_e {
-    AOK, HLT, ADR, INS
+    AOK, HLT, ADR, INS, TMO, DBG
 } status_t;
 
 typedef struct cpu_s {
@@ -60,16 +97,43 @@ typedef struct cpu_s {
     int8_t ZF;
 } cpu_t;
 
-status_t execute(void);
+/*
+    Reasons for run() to return
+    STOP_STATUS     - the status of the machine is no longer AOK
+    STOP_BREAKPOINT - the instruction pointer reached a breakpoint
+    STOP_LIMIT      - the requested number of instructions were executed
+    STOP_WATCHPOINT - the last instruction wrote to a watched address
+    STOP_INTERRUPT  - interruptMachine() was called during the run
+*/
+#define STOP_STATUS     0
+#define STOP_BREAKPOINT 1
+#define STOP_LIMIT      2
+#define STOP_WATCHPOINT 3
+#define STOP_INTERRUPT  4
+
+typedef struct machine_s machine_t;
+struct decoded_s;
+
+machine_t *createMachine(void);
+void destroyMachine(machine_t*);
+int initialize(machine_t*, int32_t);
+int run(machine_t*, uint64_t);
+uint64_t stepBlock(machine_t*);
+void step(machine_t*);
+int decode(const machine_t*, int32_t, struct decoded_s*);
+void setBudget(machine_t*, uint64_t, int32_t);
+void interruptMachine(machine_t*);
+int addBreakpoint(machine_t*, int32_t);
+int removeBreakpoint(machine_t*, int32_t);
+int addWatchpoint(machine_t*, int32_t, int32_t);
+int removeWatchpoint(machine_t*, int32_t);
 
-int initialize(int32_t);
-void printCPU(void);
-void printMemory(void);
-int insertInstructions(char*, int32_t);
-int putString(char*, int32_t);
-int putByte(char, int32_t);
-int putLong(int32_t, int32_t);
-int bss(int32_t, int32_t);
+int insertInstructions(machine_t*, char*, int32_t);
+int putString(machine_t*, char*, int32_t);
+int putByte(machine_t*, char, int32_t);
+int putLong(machine_t*, int32_t, int32_t);
+int32_t getLong(machine_t*, int32_t);
+int bss(machine_t*, int32_t, int32_t);
 
 
 #endif
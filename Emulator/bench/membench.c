@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "../memory.h"
+
+/*
+    Times the guest memory accessors on their own: aligned, unaligned and
+    page crossing loads and stores over a few pages of guest memory.
+*/
+
+#define MEMORY_SIZE (16 * PAGE_SIZE)
+#define SPAN (8 * PAGE_SIZE)
+#define ITERATIONS 50000000
+
+static volatile int32_t sink;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+    Stores to and loads from addresses that start at first and advance by
+    stride, wrapping after SPAN bytes.
+    Return:
+        nanoseconds per store and load pair
+*/
+static double timeAccess(memory_t *mem, int32_t first, int32_t stride) {
+    int32_t sum = 0;
+    long i;
+    double start = now();
+    for(i = 0; i < ITERATIONS; i++) {
+        int32_t addr = first + (int32_t)((i * stride) & (SPAN - 1));
+        writeLong(mem, addr, (int32_t)i);
+        sum += readLong(mem, addr);
+    }
+    sink = sum;
+    return (now() - start) * 1e9 / ITERATIONS;
+}
+
+int main() {
+    memory_t mem;
+    if(!initMemory(&mem, MEMORY_SIZE)) {
+        fprintf(stderr, "ERROR: Could not allocate guest memory\n");
+        return 1;
+    }
+    printf("aligned         %6.2f ns\n", timeAccess(&mem, 0, 4));
+    printf("unaligned       %6.2f ns\n", timeAccess(&mem, 1, 4));
+    printf("page crossing   %6.2f ns\n", timeAccess(&mem, PAGE_SIZE - 2, PAGE_SIZE));
+    freeMemory(&mem);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Runs the benchmark kernels a few times on each emulator binary and prints
+# the best MIPS of each, with the speedup over the first binary.
+#
+# Usage: report.sh baseline [other ...]
+
+RUNS=${RUNS:-3}
+DIR=$(dirname "$0")
+
+for emul in "$@"; do
+    i=0
+    while [ $i -lt $RUNS ]; do
+        "$DIR/run.sh" "$emul" | sed -n "2,\$s|^|$emul |p"
+        i=$((i + 1))
+    done
+done | awk '
+    {
+        key = $1 " " $2
+        if(!(key in best)) {
+            order[n++] = key
+            best[key] = 0
+        }
+        if($5 > best[key]) {
+            best[key] = $5
+        }
+        if(!($1 in base)) {
+            base[$1] = ++binaries
+        }
+    }
+    END {
+        printf "%-28s %-8s %8s %8s\n", "binary", "kernel", "MIPS", "speedup"
+        for(i = 0; i < n; i++) {
+            split(order[i], parts, " ")
+            if(base[parts[1]] == 1) {
+                reference[parts[2]] = best[order[i]]
+            }
+            printf "%-28s %-8s %8.1f %7.2fx\n", parts[1], parts[2], best[order[i]],
+                   best[order[i]] / reference[parts[2]]
+        }
+    }'
@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Times the benchmark kernels on an emulator binary and reports millions of
+# guest instructions per second.
+#     fib.y86    - recursive fib(30): calls, returns, pushes and pops
+#     memory.y86 - 4M iterations of loads and stores, including unaligned
+#                  and page crossing ones
+#     loop.y86   - a 150M instruction arithmetic loop
+#
+# Usage: run.sh [emulator] [emulator options]
+
+EMUL=${1:-./y86emul}
+[ $# -gt 0 ] && shift
+DIR=$(dirname "$0")
+
+printf "%-12s %12s %8s %8s\n" kernel instructions seconds MIPS
+for kernel in fib memory loop; do
+    start=$(date +%s.%N)
+    count=$("$EMUL" -s "$@" "$DIR/$kernel.y86" | sed -n 's/^y86_instructions_retired_total //p')
+    end=$(date +%s.%N)
+    awk -v k=$kernel -v n="$count" -v s="$start" -v e="$end" \
+        'BEGIN { t = e - s; printf "%-12s %12d %8.3f %8.1f\n", k, n, t, n / t / 1e6 }'
+done
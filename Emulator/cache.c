@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define HASH(pc) ( ((uint32_t)(pc) * 2654435761u) >> (32 - HASH_BITS) )
+
+/*
+    Creates an empty translation cache for the given guest memory.
+    Return:
+        The cache; NULL if it could not be allocated.
+*/
+cache_t *createCache(memory_t *mem) {
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if(!cache) {
+        return NULL;
+    }
+    cache->mem = mem;
+    cache->codePages = calloc(mem->numPages, sizeof(plink_t*));
+    if(!cache->codePages) {
+        free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/*
+    Frees every block of the cache, leaving it empty, and clears the
+    PAGE_CODE flags it set unless other machines share the memory, since
+    their caches may rely on them. The epoch moves on, so block pointers
+    held elsewhere, like in the return address stack, are not used again.
+*/
+void flushCache(cache_t *cache) {
+    int i;
+    uint32_t page;
+    for(i = 0; i < HASH_SIZE; i++) {
+        while(cache->buckets[i]) {
+            tblock_t *next = cache->buckets[i]->hashNext;
+            free(cache->buckets[i]);
+            cache->buckets[i] = next;
+        }
+    }
+    releaseInvalidated(cache);
+    for(page = 0; page < cache->mem->numPages; page++) {
+        cache->codePages[page] = NULL;
+        if(!cache->mem->shared) {
+            __atomic_and_fetch(&cache->mem->flags[page], (uint8_t)~PAGE_CODE, __ATOMIC_RELAXED);
+        }
+    }
+    cache->epoch++;
+}
+
+/*
+    Frees every block of the cache, along with the cache itself.
+*/
+void freeCache(cache_t *cache) {
+    if(!cache) {
+        return;
+    }
+    flushCache(cache);
+    free(cache->codePages);
+    free(cache);
+}
+
+/*
+    Allocates a block with room for the given number of instructions. The
+    caller fills in the instructions and bounds before inserting it.
+*/
+tblock_t *allocBlock(int32_t count) {
+    tblock_t *block = calloc(1, sizeof(tblock_t) + count * sizeof(decoded_t));
+    if(!block) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+    }
+    return block;
+}
+
+static void linkPage(cache_t *cache, tblock_t *block, int which, int32_t addr) {
+    plink_t *link = &block->links[which];
+    uint32_t page = PAGE_OF(addr);
+    link->block = block;
+    link->next = cache->codePages[page];
+    cache->codePages[page] = link;
+    __atomic_or_fetch(&cache->mem->flags[page], PAGE_CODE, __ATOMIC_RELAXED);
+}
+
+static void unlinkPage(cache_t *cache, tblock_t *block, int which, int32_t addr) {
+    uint32_t page = PAGE_OF(addr);
+    plink_t **link = &cache->codePages[page];
+    while(*link) {
+        if(*link == &block->links[which]) {
+            *link = (*link)->next;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    if(!cache->codePages[page] && !cache->mem->shared) {
+        __atomic_and_fetch(&cache->mem->flags[page], (uint8_t)~PAGE_CODE, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+    Adds a translated block to the cache and marks the pages it was decoded
+    from as holding code, so that stores into them invalidate it.
+*/
+void insertBlock(cache_t *cache, tblock_t *block) {
+    uint32_t bucket = HASH(block->start);
+    block->valid = 1;
+    block->hashNext = cache->buckets[bucket];
+    cache->buckets[bucket] = block;
+    int32_t last = block->end > block->start ? block->end - 1 : block->start;
+    if(cache->mem->shared) {
+        markCode(cache->mem, block->start, block->end - block->start);
+    }
+    linkPage(cache, block, 0, block->start);
+    if(PAGE_OF(last) != PAGE_OF(block->start)) {
+        linkPage(cache, block, 1, last);
+    }
+}
+
+/*
+    Finds the translated block that starts at the given address.
+    Return:
+        The block if the address has been translated; NULL otherwise.
+*/
+tblock_t *lookupBlock(const cache_t *cache, int32_t pc) {
+    tblock_t *block = cache->buckets[HASH(pc)];
+    while(block && block->start != pc) {
+        block = block->hashNext;
+    }
+    return block;
+}
+
+/*
+    Chains a block to the one it continues at, through its taken or its
+    fallthrough successor, and records the chain in the successor so that
+    removing it only has to visit the blocks chained into it.
+    Arguments:
+        tblock_t *from - the block, whose successor is not chained yet
+        int which - CHAIN_TAKEN or CHAIN_FALLTHROUGH
+        tblock_t *to - the block to continue at
+*/
+void chainBlock(tblock_t *from, int which, tblock_t *to) {
+    plink_t *link = &from->chains[which];
+    *(which == CHAIN_TAKEN ? &from->taken : &from->fallthrough) = to;
+    link->block = from;
+    link->next = to->preds;
+    to->preds = link;
+}
+
+/*
+    Undoes the chains leading out of a block, taking them out of the preds
+    of its successors.
+*/
+static void unchainSuccessors(tblock_t *block) {
+    tblock_t *succ[2] = { block->taken, block->fallthrough };
+    int which;
+    for(which = 0; which < 2; which++) {
+        plink_t **link;
+        if(!succ[which]) {
+            continue;
+        }
+        for(link = &succ[which]->preds; *link; link = &(*link)->next) {
+            if(*link == &block->chains[which]) {
+                *link = (*link)->next;
+                break;
+            }
+        }
+    }
+    block->taken = NULL;
+    block->fallthrough = NULL;
+}
+
+/*
+    Removes a block from the cache and from every chain leading into it. The
+    memory is kept until releaseInvalidated because the block may still be
+    running. Bumping the epoch tells holders of other block pointers, like
+    the return address stack, that theirs may be stale.
+*/
+static void removeBlock(cache_t *cache, tblock_t *block) {
+    tblock_t **entry = &cache->buckets[HASH(block->start)];
+    while(*entry != block) {
+        entry = &(*entry)->hashNext;
+    }
+    *entry = block->hashNext;
+    unlinkPage(cache, block, 0, block->start);
+    if(block->links[1].block) {
+        unlinkPage(cache, block, 1, block->end - 1);
+    }
+    unchainSuccessors(block);
+    while(block->preds) {
+        plink_t *link = block->preds;
+        tblock_t *pred = link->block;
+        block->preds = link->next;
+        if(link == &pred->chains[CHAIN_TAKEN]) {
+            pred->taken = NULL;
+        } else {
+            pred->fallthrough = NULL;
+        }
+    }
+    block->valid = 0;
+    cache->epoch++;
+    block->zombieNext = cache->zombies;
+    cache->zombies = block;
+}
+
+/*
+    Called for stores into pages that hold translated code. Invalidates every
+    block whose instructions overlap the bytes being written.
+    Arguments:
+        cache_t *cache - the cache of the machine doing the store
+        int32_t addr - the first byte written
+        int32_t len - the number of bytes written
+    Return:
+        1 if any block was invalidated; 0 otherwise
+*/
+int invalidateCode(cache_t *cache, int32_t addr, int32_t len) {
+    int32_t last = addr + len - 1;
+    uint32_t page = PAGE_OF(addr);
+    uint32_t lastPage = PAGE_OF(last);
+    int found = 0;
+    for(; page <= lastPage && page < cache->mem->numPages; page++) {
+        plink_t *link = cache->codePages[page];
+        while(link) {
+            tblock_t *block = link->block;
+            link = link->next;
+            if(block->start <= last && (addr < block->end || addr == block->start)) {
+                removeBlock(cache, block);
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+/*
+    Frees the blocks that were invalidated. Must only be called when no
+    block is running.
+*/
+void releaseInvalidated(cache_t *cache) {
+    while(cache->zombies) {
+        tblock_t *next = cache->zombies->zombieNext;
+        free(cache->zombies);
+        cache->zombies = next;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef cache_h
+#define cache_h
+
+#include <stdint.h>
+
+#include "memory.h"
+
+#define BLOCK_MAX 64
+
+/*
+    An instruction decoded once at translation time. Unused operands are 0.
+*/
+typedef struct decoded_s {
+    uint8_t opcode;
+    uint8_t rA;
+    uint8_t rB;
+    uint8_t length;
+    int32_t val;
+} decoded_t;
+
+typedef struct tblock_s tblock_t;
+
+/*
+    Entry in a list of blocks: those overlapping a page of guest memory, or
+    those chained into a block.
+*/
+typedef struct plink_s {
+    tblock_t *block;
+    struct plink_s *next;
+} plink_t;
+
+/*
+    A translated block: straight-line guest code ending with the first
+    instruction that transfers control. The successors are filled in the
+    first time they are followed so that later runs go straight from one
+    block to the next.
+*/
+struct tblock_s {
+    int32_t start;
+    int32_t end;            /* address following the last instruction */
+    int32_t count;
+    int32_t target;         /* destination of a closing jXX or call */
+    uint8_t flow;           /* flow of the last instruction */
+    uint8_t valid;          /* cleared when the code underneath is overwritten */
+    tblock_t *taken;        /* chained block at target */
+    tblock_t *fallthrough;  /* chained block at end */
+    tblock_t *hashNext;
+    tblock_t *zombieNext;
+    plink_t links[2];       /* the pages holding the first and the last byte */
+    plink_t chains[2];      /* entries in the preds of taken and fallthrough */
+    plink_t *preds;         /* the chains leading into this block */
+    decoded_t insns[];
+};
+
+#define CHAIN_TAKEN       0
+#define CHAIN_FALLTHROUGH 1
+
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+/*
+    The translation cache of one machine. The PAGE_CODE flag of a page of
+    its memory is set while blocks decoded from the page are cached; on
+    shared memory it stays set for good once any cache set it.
+*/
+typedef struct cache_s {
+    memory_t *mem;
+    plink_t **codePages;    /* blocks overlapping each page */
+    tblock_t *buckets[HASH_SIZE];
+    tblock_t *zombies;      /* invalidated blocks waiting to be freed */
+    uint32_t epoch;         /* bumped whenever a block is removed */
+} cache_t;
+
+/*
+    Evaluates to true if translated code overlaps the page holding addr.
+*/
+#define IS_CODE_PAGE(mem, addr) ((mem)->flags[PAGE_OF(addr)] & PAGE_CODE)
+
+cache_t *createCache(memory_t*);
+void flushCache(cache_t*);
+void freeCache(cache_t*);
+tblock_t *allocBlock(int32_t);
+void insertBlock(cache_t*, tblock_t*);
+tblock_t *lookupBlock(const cache_t*, int32_t);
+void chainBlock(tblock_t*, int, tblock_t*);
+int invalidateCode(cache_t*, int32_t, int32_t);
+void releaseInvalidated(cache_t*);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debugger.h"
+
+/*
+    A small interactive debugger on top of the embedding interface. Its
+    output goes to stderr so that it does not mix with the output of the
+    program; commands are read from stdin, like the program's input.
+*/
+
+#define LINE_MAX_D 256
+
+static const char *registerNames[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "pc"
+};
+
+void printRegisters(const y86_t *guest) {
+    int i;
+    for(i = Y86_EAX; i <= Y86_EDI; i++) {
+        fprintf(stderr, "%s 0x%08x%s", registerNames[i], y86GetRegister(guest, i), i % 4 == 3 ? "\n" : "  ");
+    }
+    int flags = y86GetFlags(guest);
+    fprintf(stderr, "pc  0x%08x  ZF=%d SF=%d OF=%d\n", y86GetRegister(guest, Y86_PC),
+            (flags & Y86_ZF) != 0, (flags & Y86_SF) != 0, (flags & Y86_OF) != 0);
+}
+
+/*
+    Tells the user why a run returned.
+    Arguments:
+        const y86_t *guest - the guest that stopped
+        int stop - the reason returned by y86Run
+*/
+void reportStop(const y86_t *guest, int stop) {
+    int32_t pc = y86GetRegister(guest, Y86_PC);
+    switch(stop) {
+        case Y86_BREAKPOINT:
+            fprintf(stderr, "Breakpoint at 0x%x\n", pc);
+        break;
+        case Y86_WATCHPOINT:
+            fprintf(stderr, "Watchpoint: store to 0x%x, next instruction at 0x%x\n", y86WatchAddress(guest), pc);
+        break;
+        case Y86_LIMIT:
+            fprintf(stderr, "Stepped to 0x%x\n", pc);
+        break;
+        case Y86_INTERRUPTED:
+            fprintf(stderr, "Interrupted at 0x%x\n", pc);
+        break;
+        default:
+            fprintf(stderr, "Program stopped with status %s at 0x%x\n", y86StatusName(y86Status(guest)), pc);
+        break;
+    }
+}
+
+static int registerNumber(const char *name) {
+    int i;
+    for(i = Y86_EAX; i <= Y86_PC; i++) {
+        if(strcmp(name, registerNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void dumpMemory(y86_t *guest, int32_t addr, int32_t len) {
+    int32_t i;
+    for(i = 0; i < len; i++) {
+        uint8_t byte;
+        if(!y86ReadMemory(guest, addr + i, &byte, 1)) {
+            fprintf(stderr, "\nAddress 0x%x is out of bounds", addr + i);
+            break;
+        }
+        if(i % 16 == 0) {
+            fprintf(stderr, "%s0x%08x:", i ? "\n" : "", addr + i);
+        }
+        fprintf(stderr, " %02x", byte);
+    }
+    fprintf(stderr, "\n");
+}
+
+static void help() {
+    fprintf(stderr, "Commands (addresses, lengths and values are hexadecimal):\n");
+    fprintf(stderr, "    b <addr>          set a breakpoint\n");
+    fprintf(stderr, "    d <addr>          delete a breakpoint\n");
+    fprintf(stderr, "    w <addr> [len]    stop after stores into len bytes (default 4)\n");
+    fprintf(stderr, "    dw <addr>         delete a watchpoint\n");
+    fprintf(stderr, "    c                 continue\n");
+    fprintf(stderr, "    s [n]             execute n instructions, n in decimal (default 1)\n");
+    fprintf(stderr, "    r                 show the registers\n");
+    fprintf(stderr, "    x <addr> [len]    show len bytes of memory (default 16)\n");
+    fprintf(stderr, "    set <reg> <val>   change a register (eax..edi, pc)\n");
+    fprintf(stderr, "    q                 quit\n");
+}
+
+/*
+    Runs the guest under the control of the user until it stops or the user
+    quits.
+*/
+void debugShell(y86_t *guest) {
+    char line[LINE_MAX_D];
+    fprintf(stderr, "Type h for help\n");
+    while(y86Status(guest) == Y86_AOK) {
+        fprintf(stderr, "(y86) ");
+        if(!fgets(line, sizeof(line), stdin)) {
+            break;
+        }
+        char cmd[16] = "";
+        char arg1[64] = "";
+        char arg2[64] = "";
+        if(sscanf(line, "%15s %63s %63s", cmd, arg1, arg2) < 1) {
+            continue;
+        }
+        int32_t addr = (int32_t)strtol(arg1, NULL, 16);
+        if(strcmp(cmd, "h") == 0) {
+            help();
+        } else if(strcmp(cmd, "b") == 0 && *arg1) {
+            if(!y86AddBreakpoint(guest, addr)) {
+                fprintf(stderr, "Breakpoint already set at 0x%x\n", addr);
+            }
+        } else if(strcmp(cmd, "d") == 0 && *arg1) {
+            if(!y86RemoveBreakpoint(guest, addr)) {
+                fprintf(stderr, "No breakpoint at 0x%x\n", addr);
+            }
+        } else if(strcmp(cmd, "w") == 0 && *arg1) {
+            int32_t len = *arg2 ? (int32_t)strtol(arg2, NULL, 16) : 4;
+            if(!y86AddWatchpoint(guest, addr, len)) {
+                fprintf(stderr, "Could not watch 0x%x\n", addr);
+            }
+        } else if(strcmp(cmd, "dw") == 0 && *arg1) {
+            if(!y86RemoveWatchpoint(guest, addr)) {
+                fprintf(stderr, "No watchpoint at 0x%x\n", addr);
+            }
+        } else if(strcmp(cmd, "c") == 0) {
+            reportStop(guest, y86Run(guest, 0));
+        } else if(strcmp(cmd, "s") == 0) {
+            uint64_t n = *arg1 ? strtoull(arg1, NULL, 10) : 1;
+            reportStop(guest, y86Run(guest, n ? n : 1));
+        } else if(strcmp(cmd, "r") == 0) {
+            printRegisters(guest);
+        } else if(strcmp(cmd, "x") == 0 && *arg1) {
+            dumpMemory(guest, addr, *arg2 ? (int32_t)strtol(arg2, NULL, 16) : 16);
+        } else if(strcmp(cmd, "set") == 0 && *arg2 && registerNumber(arg1) >= 0) {
+            y86SetRegister(guest, registerNumber(arg1), (int32_t)strtoul(arg2, NULL, 16));
+        } else if(strcmp(cmd, "q") == 0) {
+            break;
+        } else {
+            fprintf(stderr, "Unknown command; type h for help\n");
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef debugger_h
+#define debugger_h
+
+#include "y86.h"
+
+void printRegisters(const y86_t*);
+void reportStop(const y86_t*, int);
+void debugShell(y86_t*);
+
+#endif
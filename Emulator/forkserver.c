@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+
+#include "forkserver.h"
+#include "sockets.h"
+
+/*
+    Fork server. The image is loaded once; every job is run by a forked
+    child that inherits the loaded guest copy-on-write, so starting a job
+    costs about as much as a fork. A job is a connection on a Unix socket
+    carrying the client's stdin, stdout and stderr as SCM_RIGHTS descriptors.
+    The child runs with those as its own standard streams, so its output is
+    the same as that of a run without the server, and then answers on the
+    connection with a line holding the end status and the instruction count:
+        <status> <executed>\n
+    A connection that closes without an answer means the job failed. A job
+    lives no longer than its client: the child interrupts the guest once
+    the client hangs up, and is killed when the server stops.
+*/
+
+#define NUM_STREAMS 3
+
+typedef struct watch_s {
+    y86_t *guest;
+    int conn;
+} watch_t;
+
+/*
+    Receives the standard streams of a job.
+    Arguments:
+        int conn - the connection of the job
+        int *fds - receives NUM_STREAMS descriptors
+    Return:
+        1 if the descriptors were received; 0 otherwise
+*/
+static int receiveStreams(int conn, int *fds) {
+    char byte;
+    char control[CMSG_SPACE(NUM_STREAMS * sizeof(int))];
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if(recvmsg(conn, &msg, 0) != 1) {
+        return 0;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(NUM_STREAMS * sizeof(int))) {
+        return 0;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), NUM_STREAMS * sizeof(int));
+    return 1;
+}
+
+/*
+    Runs on a thread of the child. The client sends nothing after its
+    streams, so the connection only becomes readable when the client hangs
+    up; the job is then interrupted like one of the job server whose
+    client has gone.
+*/
+static void *watchClient(void *arg) {
+    const watch_t *watch = arg;
+    struct pollfd pfd = { watch->conn, POLLIN, 0 };
+    while(poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+    }
+    y86Interrupt(watch->guest);
+    return NULL;
+}
+
+/*
+    Runs in the child: takes over the job's streams, runs the job and
+    answers the client.
+*/
+static void runChild(y86_t *guest, int conn, const int *fds, forkjob_t job, void *arg, pid_t server) {
+    char reply[64];
+    watch_t watch = { guest, conn };
+    pthread_t watcher;
+    int i;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    /* Die with the server, even if it stopped before this line */
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if(getppid() != server) {
+        _exit(1);
+    }
+    for(i = 0; i < NUM_STREAMS; i++) {
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    if(pthread_create(&watcher, NULL, watchClient, &watch) == 0) {
+        pthread_detach(watcher);
+    }
+    job(guest, arg);
+    fflush(NULL);
+    int len = snprintf(reply, sizeof(reply), "%d %llu\n", y86Status(guest), (unsigned long long)y86Executed(guest));
+    if(write(conn, reply, len) != len) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+/*
+    Serves jobs until the server is sent SIGINT or SIGTERM. Jobs still
+    running then are killed.
+    Arguments:
+        y86_t *guest - the loaded guest every job starts from
+        const char *path - the path of the Unix socket
+        forkjob_t job - runs a job on the child's copy of the guest
+        void *arg - passed to job
+    Return:
+        1 if the server ran; 0 if the socket could not be opened
+*/
+int forkServe(y86_t *guest, const char *path, forkjob_t job, void *arg) {
+    int server = listenUnix(path, SOMAXCONN);
+    if(server < 0) {
+        fprintf(stderr, "ERROR: Could not listen on %s\n", path);
+        return 0;
+    }
+    /* Children are reaped by the system; they report to their client */
+    signal(SIGCHLD, SIG_IGN);
+    catchStopSignals(NULL);
+    fprintf(stderr, "Fork server listening on %s\n", path);
+    pid_t self = getpid();
+    while(!stopRequested) {
+        int fds[NUM_STREAMS];
+        int i;
+        int conn = accept(server, NULL, NULL);
+        if(conn < 0) {
+            if(errno != EINTR) {
+                perror("accept");
+            }
+            continue;
+        }
+        if(!receiveStreams(conn, fds)) {
+            close(conn);
+            continue;
+        }
+        fflush(NULL);
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(server);
+            runChild(guest, conn, fds, job, arg, self);
+        } else if(pid < 0) {
+            perror("fork");
+        }
+        for(i = 0; i < NUM_STREAMS; i++) {
+            close(fds[i]);
+        }
+        close(conn);
+    }
+    close(server);
+    unlink(path);
+    return 1;
+}
+
+/*
+    Runs a job on a fork server with the standard streams of this process
+    and waits for it to finish.
+    Arguments:
+        const char *path - the path of the server's Unix socket
+    Return:
+        1 if the job ran; 0 if the server could not be reached or the job
+        failed
+*/
+int submitJob(const char *path) {
+    int fds[NUM_STREAMS] = { 0, 1, 2 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    struct msghdr msg;
+    char reply[64];
+    size_t len = 0;
+    ssize_t got;
+    int fd = connectUnix(path);
+    if(fd < 0) {
+        fprintf(stderr, "ERROR: Could not connect to %s\n", path);
+        return 0;
+    }
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if(sendmsg(fd, &msg, 0) != 1) {
+        close(fd);
+        return 0;
+    }
+    while(len < sizeof(reply) - 1 && (got = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0) {
+        len += got;
+    }
+    close(fd);
+    reply[len] = '\0';
+    if(!strchr(reply, '\n')) {
+        fprintf(stderr, "ERROR: The job did not finish\n");
+        return 0;
+    }
+    return 1;
+}
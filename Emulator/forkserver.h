@@ -0,0 +1,11 @@
+#ifndef forkserver_h
+#define forkserver_h
+
+#include "y86.h"
+
+typedef void (*forkjob_t)(y86_t*, void*);
+
+int forkServe(y86_t*, const char*, forkjob_t, void*);
+int submitJob(const char*);
+
+#endif
@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fuzzer.h"
+#include "sockets.h"
+
+/*
+    Persistent mode fuzzer. The program is loaded once and every run starts
+    from that state again inside the same process: after a run only the
+    pages the run dirtied are compared with a copy taken after loading, and
+    the chunks that differ are copied back. Translated blocks stay cached
+    across runs; only those overlapping restored chunks of code pages are
+    dropped. Each run takes an input from the corpus and mutates it; the
+    guest reads the mutated bytes as its stdin, and with mutateImage some
+    bytes of the loaded program are patched as well. The block engine
+    counts the edges of the run (see COVERAGE_BITS), and runs reaching edges
+    or hit count buckets not seen before add their input to the corpus.
+    Findings are written to the output directory:
+        queue-<n>.in    input that reached new coverage
+        crash-<n>.in    input ending with ADR or INS
+        hang-<n>.in     input that used up the instruction budget
+    along with <name>.y86 holding the patched program when the program was
+    mutated. Crashes and hangs are only kept when their run took an edge or
+    hit count bucket no earlier crash or hang did.
+*/
+
+#define MAX_INPUT 4096
+#define MAX_PATCHES 16
+#define MAX_STACKED 8           /* mutations applied to one input at most */
+#define RESTORE_CHUNK 64
+#define REPORT_EVERY 4096       /* runs between looks at the clock */
+
+/*
+    A byte of the loaded program replaced for a run.
+*/
+typedef struct patch_s {
+    int32_t addr;
+    uint8_t byte;
+} patch_t;
+
+typedef struct entry_s {
+    uint8_t *input;
+    size_t inputLen;
+    patch_t patches[MAX_PATCHES];
+    int numPatches;
+} entry_t;
+
+typedef struct fuzzer_s {
+    machine_t *m;
+    const fuzzconfig_t *config;
+    cpu_t start;                /* the registers after loading */
+    uint8_t **saved;            /* page contents after loading; NULL if zero */
+    int32_t imageStart;         /* the loaded bytes that are not zero */
+    int32_t imageEnd;
+    uint8_t *trace;             /* edge counts of the current run */
+    uint8_t *virgin;            /* hit count buckets not seen yet, per edge */
+    uint8_t *virginCrash;       /* the same for runs that crashed */
+    uint8_t *virginHang;        /* the same for runs that hung */
+    entry_t *corpus;
+    size_t corpusLen;
+    size_t corpusCap;
+    entry_t work;               /* the input of the current run */
+    uint8_t input[MAX_INPUT + 1];
+    size_t inputPos;
+    uint64_t rng;
+    uint64_t runs;
+    uint64_t edges;
+    uint64_t crashes;
+    uint64_t hangs;
+} fuzzer_t;
+
+static const char *interesting[] = {
+    "0", "1", "-1", "7", "16", "32", "64", "100", "127", "128", "255", "256",
+    "1024", "4096", "32767", "65535", "65536", "2147483647", "-2147483648", "0x7fffffff"
+};
+
+static uint8_t buckets[256];
+static const uint8_t zeros[RESTORE_CHUNK];
+static machine_t *running;
+
+static void interruptRunning(void) {
+    if(running) {
+        interruptMachine(running);
+    }
+}
+
+static uint64_t nextRandom(fuzzer_t *f) {
+    f->rng ^= f->rng << 13;
+    f->rng ^= f->rng >> 7;
+    f->rng ^= f->rng << 17;
+    return f->rng;
+}
+
+static uint32_t randomBelow(fuzzer_t *f, uint32_t n) {
+    return n ? (uint32_t)(nextRandom(f) % n) : 0;
+}
+
+/*
+    Hit counts are compared by power of two buckets, so that a loop running
+    a few more times is not taken for new behaviour.
+*/
+static void initBuckets(void) {
+    int i;
+    for(i = 1; i < 256; i++) {
+        int bit = 0;
+        if(i >= 128) bit = 7;
+        else if(i >= 32) bit = 6;
+        else if(i >= 16) bit = 5;
+        else if(i >= 8) bit = 4;
+        else if(i >= 4) bit = 3;
+        else bit = i - 1;
+        buckets[i] = 1 << bit;
+    }
+}
+
+/*
+    Guest I/O of a run: stdin is the run's input, output is dropped. Input
+    is read the way the emulator reads stdin: readb takes the next byte and
+    readl the next integer in any base scanf's %i accepts.
+*/
+static int fuzzInput(void *user, int size, int32_t *value) {
+    fuzzer_t *f = user;
+    const char *start = (const char*)f->input + f->inputPos;
+    const char *end = (const char*)f->input + f->work.inputLen;
+    const char *c = start;
+    char *stop;
+    if(size == 1) {
+        if(start == end) {
+            return -1;
+        }
+        *value = (char)*start;
+        f->inputPos++;
+        return 1;
+    }
+    while(c < end && isspace((unsigned char)*c)) {
+        c++;
+    }
+    if(c == end) {
+        return -1;
+    }
+    long l = strtol(c, &stop, 0);
+    if(stop == c) {
+        f->inputPos = c - (const char*)f->input;
+        return 0;
+    }
+    *value = (int32_t)l;
+    f->inputPos = stop - (const char*)f->input;
+    return stop - start;
+}
+
+static int fuzzOutput(void *user, int size, int32_t value) {
+    return size == 1 ? 1 : snprintf(NULL, 0, "%d", value);
+}
+
+static void fuzzMessage(void *user, const char *text) {
+}
+
+/*
+    Copies the loaded pages so that runs can be undone.
+    Return:
+        1 if the copy was made; 0 if there was no memory for it
+*/
+static int takeSnapshot(fuzzer_t *f) {
+    memory_t *mem = f->m->mem;
+    uint32_t page;
+    f->saved = calloc(mem->numPages, sizeof(uint8_t*));
+    if(!f->saved) {
+        return 0;
+    }
+    f->imageStart = mem->size;
+    f->imageEnd = 0;
+    for(page = 0; page < mem->numPages; page++) {
+        mem->flags[page] &= ~PAGE_DIRTY;
+        if(!(mem->flags[page] & PAGE_PRESENT)) {
+            continue;
+        }
+        if(!(f->saved[page] = malloc(PAGE_SIZE))) {
+            return 0;
+        }
+        memcpy(f->saved[page], mem->pages[page], PAGE_SIZE);
+        int i;
+        for(i = 0; i < PAGE_SIZE; i++) {
+            int32_t addr = (page << PAGE_SHIFT) + i;
+            if(mem->pages[page][i] && addr < mem->size) {
+                f->imageStart = addr < f->imageStart ? addr : f->imageStart;
+                f->imageEnd = addr + 1;
+            }
+        }
+    }
+    if(f->imageEnd <= f->imageStart) {
+        f->imageStart = 0;
+        f->imageEnd = mem->size;
+    }
+    f->start = f->m->cpu;
+    return 1;
+}
+
+/*
+    Puts the machine back into the state it was loaded in. Only dirty pages
+    are looked at, and only the chunks that changed are copied back; blocks
+    translated from those chunks are dropped.
+*/
+static void restoreSnapshot(fuzzer_t *f) {
+    machine_t *m = f->m;
+    memory_t *mem = m->mem;
+    uint32_t page;
+    for(page = 0; page < mem->numPages; page++) {
+        if(!(mem->flags[page] & PAGE_DIRTY)) {
+            continue;
+        }
+        mem->flags[page] &= ~PAGE_DIRTY;
+        uint8_t *data = mem->pages[page];
+        int off;
+        for(off = 0; off < PAGE_SIZE; off += RESTORE_CHUNK) {
+            const uint8_t *from = f->saved[page] ? f->saved[page] + off : zeros;
+            if(memcmp(data + off, from, RESTORE_CHUNK) != 0) {
+                memcpy(data + off, from, RESTORE_CHUNK);
+                if(mem->flags[page] & PAGE_CODE) {
+                    invalidateCode(m->cache, (page << PAGE_SHIFT) + off, RESTORE_CHUNK);
+                }
+            }
+        }
+    }
+    releaseInvalidated(m->cache);
+    m->cpu = f->start;
+    m->status = AOK;
+    m->rasTop = 0;
+    m->resumeAddr = -1;
+}
+
+/*
+    Folds the edge counts of the run into a map of the buckets not seen yet.
+    Arguments:
+        uint8_t *virgin - the map; the buckets the run hit are cleared
+        uint64_t *edges - counts the edges seen for the first time; may be NULL
+    Return:
+        1 if the run reached an edge or a hit count bucket not seen before;
+        0 otherwise
+*/
+static int foldTrace(const fuzzer_t *f, uint8_t *virgin, uint64_t *edges) {
+    const uint64_t *words = (const uint64_t*)f->trace;
+    int found = 0;
+    size_t w;
+    for(w = 0; w < COVERAGE_SIZE / sizeof(uint64_t); w++) {
+        if(!words[w]) {
+            continue;
+        }
+        size_t i;
+        for(i = w * sizeof(uint64_t); i < (w + 1) * sizeof(uint64_t); i++) {
+            uint8_t bucket = buckets[f->trace[i]];
+            if(bucket & virgin[i]) {
+                if(edges && virgin[i] == 0xff) {
+                    (*edges)++;
+                }
+                virgin[i] &= ~bucket;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+static int copyEntry(entry_t *to, const entry_t *from) {
+    uint8_t *input = malloc(from->inputLen ? from->inputLen : 1);
+    if(!input) {
+        return 0;
+    }
+    memcpy(input, from->input, from->inputLen);
+    *to = *from;
+    to->input = input;
+    return 1;
+}
+
+static int addToCorpus(fuzzer_t *f, const entry_t *e) {
+    if(f->corpusLen == f->corpusCap) {
+        size_t cap = f->corpusCap ? f->corpusCap * 2 : 64;
+        entry_t *grown = realloc(f->corpus, cap * sizeof(entry_t));
+        if(!grown) {
+            return 0;
+        }
+        f->corpus = grown;
+        f->corpusCap = cap;
+    }
+    if(!copyEntry(&f->corpus[f->corpusLen], e)) {
+        return 0;
+    }
+    f->corpusLen++;
+    return 1;
+}
+
+/*
+    Writes the patched program as a .y86 file: the loaded bytes from the
+    entry point on as .text, the ones before it as .byte directives.
+*/
+static void writeImage(fuzzer_t *f, const entry_t *e, FILE *out) {
+    memory_t *mem = f->m->mem;
+    int32_t entry = f->start.ipointer;
+    int32_t end = f->imageEnd > entry ? f->imageEnd : entry + 1;
+    int32_t addr;
+    int i;
+    uint8_t *image = calloc(mem->size, 1);
+    if(!image) {
+        return;
+    }
+    for(addr = 0; addr < mem->size; addr++) {
+        uint8_t *page = f->saved[PAGE_OF(addr)];
+        image[addr] = page ? page[addr & PAGE_MASK] : 0;
+    }
+    for(i = 0; i < e->numPatches; i++) {
+        image[e->patches[i].addr] = e->patches[i].byte;
+    }
+    fprintf(out, ".size\t%x\n.text\t%x\t", mem->size, entry);
+    for(addr = entry; addr < end && addr < mem->size; addr++) {
+        fprintf(out, "%02x", image[addr]);
+    }
+    fprintf(out, "\n");
+    for(addr = 0; addr < entry; addr++) {
+        if(image[addr]) {
+            fprintf(out, ".byte\t%x\t%02x\n", addr, image[addr]);
+        }
+    }
+    free(image);
+}
+
+static void writeFinding(fuzzer_t *f, const entry_t *e, const char *kind, uint64_t n) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s-%llu.in", f->config->outDir, kind, (unsigned long long)n);
+    FILE *out = fopen(path, "wb");
+    if(!out) {
+        fprintf(stderr, "ERROR: Could not write %s\n", path);
+        return;
+    }
+    fwrite(e->input, 1, e->inputLen, out);
+    fclose(out);
+    if(!e->numPatches) {
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/%s-%llu.y86", f->config->outDir, kind, (unsigned long long)n);
+    if(!(out = fopen(path, "w"))) {
+        fprintf(stderr, "ERROR: Could not write %s\n", path);
+        return;
+    }
+    writeImage(f, e, out);
+    fclose(out);
+}
+
+/*
+    Runs the program on the work entry from the loaded state and records
+    what the run found.
+*/
+static void runWork(fuzzer_t *f) {
+    machine_t *m = f->m;
+    entry_t *e = &f->work;
+    int i;
+    memcpy(f->input, e->input, e->inputLen);
+    f->input[e->inputLen] = '\0';
+    f->inputPos = 0;
+    for(i = 0; i < e->numPatches; i++) {
+        putByte(m, (char)e->patches[i].byte, e->patches[i].addr);
+    }
+    setBudget(m, f->config->budget, 0);
+    run(m, 0);
+    status_t status = m->status;
+    restoreSnapshot(f);
+    if(stopRequested) {
+        memset(f->trace, 0, COVERAGE_SIZE);
+        return;
+    }
+    f->runs++;
+    if(foldTrace(f, f->virgin, &f->edges)) {
+        writeFinding(f, e, "queue", f->corpusLen);
+        addToCorpus(f, e);
+    }
+    /* Crashes and hangs only count when they took a path no earlier one did */
+    if(status == TMO && foldTrace(f, f->virginHang, NULL)) {
+        writeFinding(f, e, "hang", f->hangs++);
+    } else if((status == ADR || status == INS) && foldTrace(f, f->virginCrash, NULL)) {
+        writeFinding(f, e, "crash", f->crashes++);
+    }
+    memset(f->trace, 0, COVERAGE_SIZE);
+}
+
+/*
+    Mutations of the input: bit flips, random bytes, insertions and
+    deletions, numbers readl is likely to care about, copies within the
+    input and splices with another input of the corpus.
+*/
+static void mutateInput(fuzzer_t *f) {
+    entry_t *e = &f->work;
+    uint8_t *in = e->input;
+    size_t len = e->inputLen;
+    size_t pos = randomBelow(f, len);
+    switch(randomBelow(f, 7)) {
+        case 0:
+            if(len) {
+                in[pos] ^= 1 << randomBelow(f, 8);
+            }
+            break;
+        case 1:
+            if(len) {
+                in[pos] = (uint8_t)nextRandom(f);
+            }
+            break;
+        case 2:
+            if(len < MAX_INPUT) {
+                pos = randomBelow(f, len + 1);
+                memmove(in + pos + 1, in + pos, len - pos);
+                in[pos] = randomBelow(f, 2) ? (uint8_t)nextRandom(f) : " \n0123456789-"[randomBelow(f, 13)];
+                len++;
+            }
+            break;
+        case 3:
+            if(len) {
+                size_t n = 1 + randomBelow(f, len - pos < 8 ? len - pos : 8);
+                memmove(in + pos, in + pos + n, len - pos - n);
+                len -= n;
+            }
+            break;
+        case 4: {
+            char text[16];
+            int n = snprintf(text, sizeof(text), "%s%c",
+                             interesting[randomBelow(f, sizeof(interesting) / sizeof(interesting[0]))],
+                             randomBelow(f, 2) ? '\n' : ' ');
+            if(len + n <= MAX_INPUT) {
+                pos = randomBelow(f, len + 1);
+                memmove(in + pos + n, in + pos, len - pos);
+                memcpy(in + pos, text, n);
+                len += n;
+            }
+            break;
+        }
+        case 5:
+            if(len > 1) {
+                size_t from = randomBelow(f, len);
+                size_t n = 1 + randomBelow(f, len - (from > pos ? from : pos));
+                memmove(in + pos, in + from, n);
+            }
+            break;
+        default: {
+            const entry_t *other = &f->corpus[randomBelow(f, f->corpusLen)];
+            size_t cut = randomBelow(f, len + 1);
+            size_t otherCut = randomBelow(f, other->inputLen + 1);
+            size_t n = other->inputLen - otherCut;
+            if(cut + n > MAX_INPUT) {
+                n = MAX_INPUT - cut;
+            }
+            memcpy(in + cut, other->input + otherCut, n);
+            len = cut + n;
+            break;
+        }
+    }
+    e->inputLen = len;
+}
+
+/*
+    Patches a byte of the loaded program: a bit flip or a random byte.
+*/
+static void mutateImage(fuzzer_t *f) {
+    entry_t *e = &f->work;
+    int32_t addr = f->imageStart + randomBelow(f, f->imageEnd - f->imageStart);
+    uint8_t *page = f->saved[PAGE_OF(addr)];
+    uint8_t byte = page ? page[addr & PAGE_MASK] : 0;
+    byte = randomBelow(f, 2) ? byte ^ (1 << randomBelow(f, 8)) : (uint8_t)nextRandom(f);
+    int i = e->numPatches < MAX_PATCHES ? e->numPatches++ : (int)randomBelow(f, MAX_PATCHES);
+    e->patches[i].addr = addr;
+    e->patches[i].byte = byte;
+}
+
+static int loadSeed(entry_t *e, const char *fileName) {
+    FILE *in = fopen(fileName, "rb");
+    if(!in) {
+        fprintf(stderr, "ERROR: Failed to open file %s, perhaps it does not exist?\n", fileName);
+        return 0;
+    }
+    e->inputLen = fread(e->input, 1, MAX_INPUT, in);
+    e->numPatches = 0;
+    fclose(in);
+    return 1;
+}
+
+static void report(const fuzzer_t *f, double seconds) {
+    fprintf(stderr, "Fuzzer: %llu runs, %.0f/s, %zu inputs, %llu edges, %llu crashes, %llu hangs\n",
+            (unsigned long long)f->runs, seconds > 0 ? f->runs / seconds : 0.0, f->corpusLen,
+            (unsigned long long)f->edges, (unsigned long long)f->crashes, (unsigned long long)f->hangs);
+}
+
+static double elapsed(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void freeFuzzer(fuzzer_t *f) {
+    size_t i;
+    for(i = 0; f->saved && i < f->m->mem->numPages; i++) {
+        free(f->saved[i]);
+    }
+    for(i = 0; i < f->corpusLen; i++) {
+        free(f->corpus[i].input);
+    }
+    free(f->saved);
+    free(f->corpus);
+    free(f->work.input);
+    free(f->trace);
+    free(f->virgin);
+    free(f->virginCrash);
+    free(f->virginHang);
+    f->m->coverage = NULL;
+    free(f);
+}
+
+/*
+    Fuzzes the program loaded into the machine until the number of runs is
+    reached or the process is sent SIGINT or SIGTERM. Progress is reported
+    on stderr every second.
+    Arguments:
+        machine_t *m - the machine holding the loaded program
+        const fuzzconfig_t *config - the settings of the session
+    Return:
+        1 if the session ran; 0 if it could not start
+*/
+int fuzzGuest(machine_t *m, const fuzzconfig_t *config) {
+    struct timespec begin;
+    double lastReport = 0;
+    int i;
+    fuzzer_t *f = calloc(1, sizeof(fuzzer_t));
+    if(!f) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 0;
+    }
+    f->m = m;
+    f->config = config;
+    f->trace = calloc(COVERAGE_SIZE, 1);
+    f->virgin = malloc(COVERAGE_SIZE);
+    f->virginCrash = malloc(COVERAGE_SIZE);
+    f->virginHang = malloc(COVERAGE_SIZE);
+    f->work.input = malloc(MAX_INPUT);
+    if(!f->trace || !f->virgin || !f->virginCrash || !f->virginHang || !f->work.input || !takeSnapshot(f)) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        freeFuzzer(f);
+        return 0;
+    }
+    if(mkdir(config->outDir, 0777) < 0 && errno != EEXIST) {
+        fprintf(stderr, "ERROR: Could not create %s\n", config->outDir);
+        freeFuzzer(f);
+        return 0;
+    }
+    memset(f->virgin, 0xff, COVERAGE_SIZE);
+    memset(f->virginCrash, 0xff, COVERAGE_SIZE);
+    memset(f->virginHang, 0xff, COVERAGE_SIZE);
+    initBuckets();
+    f->rng = (uint64_t)time(NULL) << 20 ^ (uint64_t)getpid() ^ 0x9E3779B97F4A7C15ull;
+    m->coverage = f->trace;
+    m->reference = 0;
+    m->input = fuzzInput;
+    m->output = fuzzOutput;
+    m->message = fuzzMessage;
+    m->readBlock = NULL;
+    m->writeBlock = NULL;
+    m->user = f;
+    running = m;
+    catchStopSignals(interruptRunning);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    /* The seeds make up the first corpus whatever coverage they reach */
+    for(i = 0; i < config->numSeeds || (i == 0 && !config->numSeeds); i++) {
+        f->work.inputLen = 0;
+        f->work.numPatches = 0;
+        if(config->numSeeds && !loadSeed(&f->work, config->seeds[i])) {
+            freeFuzzer(f);
+            return 0;
+        }
+        size_t before = f->corpusLen;
+        runWork(f);
+        if(f->corpusLen == before) {
+            addToCorpus(f, &f->work);
+        }
+    }
+    while(!stopRequested && (!config->runs || f->runs < config->runs)) {
+        const entry_t *parent = &f->corpus[randomBelow(f, f->corpusLen)];
+        int stacked = 1 + randomBelow(f, MAX_STACKED);
+        memcpy(f->work.input, parent->input, parent->inputLen);
+        f->work.inputLen = parent->inputLen;
+        f->work.numPatches = parent->numPatches;
+        memcpy(f->work.patches, parent->patches, sizeof(parent->patches));
+        while(stacked--) {
+            if(config->mutateImage && !randomBelow(f, 4)) {
+                mutateImage(f);
+            } else {
+                mutateInput(f);
+            }
+        }
+        runWork(f);
+        if(!(f->runs % REPORT_EVERY)) {
+            double seconds = elapsed(&begin);
+            if(seconds - lastReport >= 1) {
+                report(f, seconds);
+                lastReport = seconds;
+            }
+        }
+    }
+    report(f, elapsed(&begin));
+    running = NULL;
+    freeFuzzer(f);
+    return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef fuzzer_h
+#define fuzzer_h
+
+#include "machine.h"
+
+/*
+    Settings of a fuzzing session.
+    outDir      - where inputs finding new edges, crashes and hangs are written
+    seeds       - files holding the first inputs; an empty input if there are none
+    runs        - the number of runs; 0 to run until interrupted
+    budget      - the most instructions of a run; exceeding it counts as a hang
+    mutateImage - also mutate the loaded program, not only its input
+*/
+typedef struct fuzzconfig_s {
+    const char *outDir;
+    char **seeds;
+    int numSeeds;
+    uint64_t runs;
+    uint64_t budget;
+    int mutateImage;
+} fuzzconfig_t;
+
+int fuzzGuest(machine_t*, const fuzzconfig_t*);
+
+#endif
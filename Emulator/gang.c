@@ -0,0 +1,748 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gang.h"
+#include "machine.h"
+
+/*
+    Runs one program against many inputs with several guests in lockstep.
+    As long as the guests of a gang are at the same instruction, their
+    registers and flags are kept structure-of-arrays, one vector per
+    register with a lane per guest, and moves, ALU operations and branches
+    are carried out for all of them at once with the vector extensions of
+    the compiler, which lower them to SSE or AVX instructions of the target.
+    Instructions that touch memory or do I/O are handed to step() of each
+    guest in turn. A guest whose control flow leaves the others is peeled
+    off and finished later on its own; guests never rejoin a gang.
+*/
+
+/*
+    A lane vector is split into chunks the width of the widest vector
+    registers the target was compiled for, so that every operation on a
+    chunk is a single instruction. Only the chunks holding lanes of the
+    gang are computed.
+*/
+#if defined(__AVX512F__)
+#define CHUNK_BYTES 64
+#elif defined(__AVX2__)
+#define CHUNK_BYTES 32
+#else
+#define CHUNK_BYTES 16
+#endif
+#define CHUNK_LANES (CHUNK_BYTES / (int)sizeof(int32_t))
+#define NUM_CHUNKS ((GANG_WIDTH + CHUNK_LANES - 1) / CHUNK_LANES)
+
+typedef int32_t chunk_t __attribute__((vector_size(CHUNK_BYTES)));
+typedef uint32_t uchunk_t __attribute__((vector_size(CHUNK_BYTES)));
+
+typedef union lanes_u {
+    chunk_t chunks[NUM_CHUNKS];
+    int32_t lane[NUM_CHUNKS * CHUNK_LANES];
+} lanes_t;
+
+/*
+    One guest of the sweep and the files standing in for its stdin and
+    stdout.
+*/
+typedef struct lane_s {
+    const char *input;
+    FILE *in;
+    FILE *out;
+    machine_t *m;
+} lane_t;
+
+/*
+    Instructions decoded once per gang, one slot per byte of a code page.
+    Invalid instructions are not cached; the guests report them themselves.
+*/
+typedef struct slot_s {
+    decoded_t in;
+    uint8_t decoded;
+} slot_t;
+
+/*
+    The guests running in lockstep. Lane i of every vector belongs to
+    lanes[i]; lanes whose bit in active is clear hold stale values. The
+    flag vectors are -1 where the flag is set and 0 where it is clear.
+    Every active guest has executed the same instructions: executed of
+    them, pending of which on the vector path, as counted in counts.
+    Those are added to the guest when it leaves the gang.
+*/
+typedef struct gang_s {
+    lanes_t regs[NUM_REGISTERS];
+    lanes_t OF;
+    lanes_t SF;
+    lanes_t ZF;
+    int32_t pc;
+    uint32_t active;
+    lane_t *lanes[GANG_WIDTH];
+    int numLanes;
+    int numChunks;          /* chunks holding the lanes */
+    uint64_t executed;
+    uint64_t pending;
+    uint64_t counts[NUM_CLASSES];
+    uint64_t budget;
+    slot_t **code;
+    uint32_t numPages;
+    int32_t size;
+    lane_t *peeled[GANG_WIDTH];
+    int numPeeled;
+} gang_t;
+
+/*
+    Totals over the whole sweep, reported at the end.
+*/
+typedef struct sweepstats_s {
+    uint64_t executed;      /* instructions retired by all guests */
+    uint64_t vectorized;    /* of those, the ones run on the vector path */
+    int peeled;
+} sweepstats_t;
+
+/*
+    The I/O of a guest, read from and written to its files the way the
+    emulator uses stdin and stdout.
+*/
+static int fileInput(void *user, int size, int32_t *value) {
+    FILE *in = ((lane_t*)user)->in;
+    int set;
+    int consumed = 0;
+    if(size == 1) {
+        char c = 0;
+        set = fscanf(in, "%c%n", &c, &consumed);
+        *value = c;
+    } else {
+        int32_t l = 0;
+        set = fscanf(in, "%i%n", &l, &consumed);
+        *value = l;
+    }
+    return set == EOF ? -1 : consumed;
+}
+
+static int fileOutput(void *user, int size, int32_t value) {
+    FILE *out = ((lane_t*)user)->out;
+    return size == 1 ? fprintf(out, "%c", (char)value) : fprintf(out, "%d", value);
+}
+
+static void fileMessage(void *user, const char *text) {
+    fputs(text, ((lane_t*)user)->out);
+}
+
+static int32_t fileRead(void *user, void *buf, int32_t len) {
+    return (int32_t)fread(buf, 1, len, ((lane_t*)user)->in);
+}
+
+static int32_t fileWrite(void *user, const void *buf, int32_t len) {
+    return (int32_t)fwrite(buf, 1, len, ((lane_t*)user)->out);
+}
+
+static int countLanes(uint32_t bits) {
+    return __builtin_popcount(bits);
+}
+
+/*
+    Return:
+        A bit for every lane of v that is not 0
+*/
+static uint32_t laneBits(const gang_t *g, const lanes_t *v) {
+    uint32_t bits = 0;
+    int i;
+    for(i = 0; i < g->numLanes; i++) {
+        bits |= (uint32_t)(v->lane[i] != 0) << i;
+    }
+    return bits;
+}
+
+/*
+    Copies the state of a guest into its lane.
+*/
+static void loadLane(gang_t *g, int i) {
+    const cpu_t *cpu = &g->lanes[i]->m->cpu;
+    int r;
+    for(r = 0; r < NUM_REGISTERS; r++) {
+        g->regs[r].lane[i] = cpu->registers[r];
+    }
+    g->OF.lane[i] = cpu->OF ? -1 : 0;
+    g->SF.lane[i] = cpu->SF ? -1 : 0;
+    g->ZF.lane[i] = cpu->ZF ? -1 : 0;
+}
+
+/*
+    Hands a lane back to its guest: its registers and flags, and the
+    instructions it ran on the vector path. The instruction pointer is left
+    to the caller.
+*/
+static void storeLane(gang_t *g, int i) {
+    machine_t *m = g->lanes[i]->m;
+    int r;
+    for(r = 0; r < NUM_REGISTERS; r++) {
+        m->cpu.registers[r] = g->regs[r].lane[i];
+    }
+    m->cpu.OF = g->OF.lane[i] != 0;
+    m->cpu.SF = g->SF.lane[i] != 0;
+    m->cpu.ZF = g->ZF.lane[i] != 0;
+    m->executed += g->pending;
+    for(r = 0; r < NUM_CLASSES; r++) {
+        if(g->counts[r]) {
+            COUNT(m->metrics.classes[r], g->counts[r]);
+        }
+    }
+    g->active &= ~(1u << i);
+}
+
+/*
+    Takes a lane out of the gang; its guest continues on its own once the
+    gang is done.
+*/
+static void peelLane(gang_t *g, int i) {
+    storeLane(g, i);
+    g->peeled[g->numPeeled++] = g->lanes[i];
+}
+
+/*
+    Takes a lane whose guest stopped out of the gang.
+*/
+static void finishLane(gang_t *g, int i) {
+    storeLane(g, i);
+    setMetricsStatus(&g->lanes[i]->m->metrics, g->lanes[i]->m->status);
+}
+
+/*
+    Fetches the instruction at pc for the whole gang. The first time an
+    address is decoded, its bytes are compared across the guests, since one
+    of them may have stored there before it became code.
+    Return:
+        The decoded instruction; NULL if it is invalid, lies outside of guest
+        memory or differs between the guests.
+*/
+static const decoded_t *fetch(gang_t *g, int32_t pc) {
+    if((uint32_t)pc >= (uint32_t)g->size) {
+        return NULL;
+    }
+    uint32_t page = PAGE_OF(pc);
+    if(!g->code[page] && !(g->code[page] = calloc(PAGE_SIZE, sizeof(slot_t)))) {
+        return NULL;
+    }
+    slot_t *slot = &g->code[page][pc & PAGE_MASK];
+    if(!slot->decoded) {
+        int first = __builtin_ctz(g->active);
+        const memory_t *mem = g->lanes[first]->m->mem;
+        if(!decode(g->lanes[first]->m, pc, &slot->in)) {
+            return NULL;
+        }
+        int i, j;
+        for(i = first + 1; i < g->numLanes; i++) {
+            const memory_t *other = g->lanes[i]->m->mem;
+            if(!(g->active & (1u << i))) {
+                continue;
+            }
+            for(j = 0; j < slot->in.length; j++) {
+                if(readByte(other, pc + j) != readByte(mem, pc + j)) {
+                    return NULL;
+                }
+            }
+        }
+        slot->decoded = 1;
+    }
+    return &slot->in;
+}
+
+/*
+    Return:
+        1 if a store of len bytes at addr overwrites an instruction the gang
+        has decoded; 0 otherwise
+*/
+static int touchesCode(const gang_t *g, int32_t addr, int32_t len) {
+    int32_t a = addr - 5 > 0 ? addr - 5 : 0;
+    int32_t end = len < g->size - addr ? addr + len : g->size;
+    while(a < end) {
+        const slot_t *slots = g->code[PAGE_OF(a)];
+        int32_t pageEnd = (a | PAGE_MASK) + 1;
+        if(!slots) {
+            a = pageEnd;
+            continue;
+        }
+        for(; a < end && a < pageEnd; a++) {
+            const slot_t *slot = &slots[a & PAGE_MASK];
+            if(slot->decoded && a + slot->in.length > addr) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+    Finds where the instruction stores for the guest in lane i.
+    Return:
+        The number of bytes stored at *addr; 0 if it does not store
+*/
+static int32_t storeOf(const gang_t *g, int i, const decoded_t *in, int32_t *addr) {
+    switch(opClasses[in->opcode]) {
+        case CLASS_MOV:
+            if(opFns[in->opcode] != RM) {
+                return 0;
+            }
+            *addr = g->regs[in->rB].lane[i] + in->val;
+            return 4;
+        case CLASS_PUSH:
+        case CLASS_CALL:
+            *addr = g->regs[ESP].lane[i] - 4;
+            return 4;
+        case CLASS_READ:
+            if(opFns[in->opcode] == N) {
+                *addr = g->regs[in->rB].lane[i] + in->val;
+                return g->regs[in->rA].lane[i];
+            }
+            *addr = g->regs[in->rA].lane[i] + in->val;
+            return opFns[in->opcode] == B ? 1 : 4;
+        case CLASS_SMP:
+            if(opFns[in->opcode] == SPAWN) {
+                return 0;
+            }
+            *addr = g->regs[in->rB].lane[i] + in->val;
+            return 4;
+    }
+    return 0;
+}
+
+/*
+    Splits the gang after the guests went different ways. Guests that
+    stopped leave it, the largest group of guests at the same instruction
+    stays, and the others are peeled off. With disband set, every guest is
+    peeled off.
+*/
+static void regroup(gang_t *g, int disband) {
+    int32_t pcs[GANG_WIDTH];
+    int votes[GANG_WIDTH] = { 0 };
+    int best = -1;
+    int i, j;
+    for(i = 0; i < g->numLanes; i++) {
+        if(!(g->active & (1u << i))) {
+            continue;
+        }
+        machine_t *m = g->lanes[i]->m;
+        if(m->status != AOK) {
+            finishLane(g, i);
+            continue;
+        }
+        pcs[i] = m->cpu.ipointer;
+        for(j = 0; j <= i; j++) {
+            if((g->active & (1u << j)) && pcs[j] == pcs[i]) {
+                votes[j]++;
+                break;
+            }
+        }
+    }
+    for(i = 0; i < g->numLanes; i++) {
+        if((g->active & (1u << i)) && (best < 0 || votes[i] > votes[best])) {
+            best = i;
+        }
+    }
+    if(best < 0) {
+        return;
+    }
+    g->pc = pcs[best];
+    for(i = 0; i < g->numLanes; i++) {
+        if((g->active & (1u << i)) && (disband || pcs[i] != g->pc)) {
+            peelLane(g, i);
+        }
+    }
+}
+
+/*
+    Carries out the instruction at pc with step() of each guest, passing
+    the registers it uses back and forth.
+*/
+static void scalarStep(gang_t *g, const decoded_t *in) {
+    int class = opClasses[in->opcode];
+    int used[3];
+    int numUsed = 0;
+    int storedCode = 0;
+    int i, r;
+    if(opRegisters[in->opcode] & USES_A) {
+        used[numUsed++] = in->rA;
+    }
+    if(opRegisters[in->opcode] & USES_B) {
+        used[numUsed++] = in->rB;
+    }
+    if(class == CLASS_PUSH || class == CLASS_POP || class == CLASS_CALL || class == CLASS_RET) {
+        used[numUsed++] = ESP;
+    } else if(class == CLASS_SMP) {
+        /* cas compares with %eax */
+        used[numUsed++] = EAX;
+    }
+    g->executed++;
+    for(i = 0; i < g->numLanes; i++) {
+        if(!(g->active & (1u << i))) {
+            continue;
+        }
+        machine_t *m = g->lanes[i]->m;
+        int32_t addr;
+        int32_t len;
+        m->cpu.ipointer = g->pc;
+        for(r = 0; r < numUsed; r++) {
+            m->cpu.registers[used[r]] = g->regs[used[r]].lane[i];
+        }
+        if((len = storeOf(g, i, in, &addr)) > 0 && (uint32_t)addr < (uint32_t)g->size &&
+           touchesCode(g, addr, len)) {
+            storedCode = 1;
+        }
+        step(m);
+        for(r = 0; r < numUsed; r++) {
+            g->regs[used[r]].lane[i] = m->cpu.registers[used[r]];
+        }
+        if(class == CLASS_READ || class == CLASS_SMP) {
+            g->ZF.lane[i] = m->cpu.ZF ? -1 : 0;
+        }
+    }
+    regroup(g, storedCode);
+}
+
+/*
+    Peels off every guest at the current instruction, for code the gang
+    cannot run together.
+*/
+static void disband(gang_t *g) {
+    int i;
+    for(i = 0; i < g->numLanes; i++) {
+        if(g->active & (1u << i)) {
+            g->lanes[i]->m->cpu.ipointer = g->pc;
+            peelLane(g, i);
+        }
+    }
+}
+
+/*
+    Stops every guest still in the gang with status TMO.
+*/
+static void expire(gang_t *g) {
+    int i;
+    for(i = 0; i < g->numLanes; i++) {
+        if(g->active & (1u << i)) {
+            g->lanes[i]->m->cpu.ipointer = g->pc;
+            g->lanes[i]->m->status = TMO;
+            finishLane(g, i);
+        }
+    }
+}
+
+/*
+    ALU operations on all lanes at once, with the flags of op() in
+    architecture.c. The arithmetic is unsigned so that it wraps.
+*/
+static void vectorOp(gang_t *g, int fn, const decoded_t *in) {
+    lanes_t *rA = &g->regs[in->rA];
+    lanes_t *rB = &g->regs[in->rB];
+    int c;
+    for(c = 0; c < g->numChunks; c++) {
+        chunk_t a = rA->chunks[c];
+        chunk_t b = rB->chunks[c];
+        chunk_t r;
+        chunk_t OF = { 0 };
+        switch(fn) {
+            case ADD:
+                r = (chunk_t)((uchunk_t)b + (uchunk_t)a);
+                OF = ((a > 0) & (b > 0) & (r < 0)) | ((a < 0) & (b < 0) & (r > 0));
+            break;
+            case SUB:
+            case CMP:
+                r = (chunk_t)((uchunk_t)b - (uchunk_t)a);
+                OF = ((b < 0) & (a > 0) & (r > 0)) | ((b > 0) & (a < 0) & (r < 0));
+            break;
+            case AND:
+                r = b & a;
+            break;
+            case XOR:
+                r = b ^ a;
+            break;
+            default:
+                r = (chunk_t)((uchunk_t)b * (uchunk_t)a);
+                OF = ((a > 0) & (b > 0) & (r < 0)) |
+                     ((a < 0) & (b < 0) & (r < 0)) |
+                     (((a < 0) ^ (b < 0)) & ((a > 0) ^ (b > 0)) & (r > 0));
+            break;
+        }
+        g->OF.chunks[c] = OF;
+        g->ZF.chunks[c] = r == 0;
+        g->SF.chunks[c] = r < 0;
+        if(fn != CMP) {
+            rB->chunks[c] = r;
+        }
+    }
+}
+
+/*
+    Evaluates the condition of a jXX on all lanes at once.
+*/
+static void vectorCondition(gang_t *g, int fn, lanes_t *cond) {
+    int c;
+    for(c = 0; c < g->numChunks; c++) {
+        chunk_t less = g->SF.chunks[c] ^ g->OF.chunks[c];
+        chunk_t ZF = g->ZF.chunks[c];
+        switch(fn) {
+            case JLE: cond->chunks[c] = less | ZF; break;
+            case JL:  cond->chunks[c] = less; break;
+            case JE:  cond->chunks[c] = ZF; break;
+            case JNE: cond->chunks[c] = ~ZF; break;
+            case JGE: cond->chunks[c] = ~less; break;
+            default:  cond->chunks[c] = ~less & ~ZF; break;
+        }
+    }
+}
+
+/*
+    Branches all lanes at once. When only some of the guests take the
+    branch, the larger group stays in the gang.
+*/
+static void vectorJump(gang_t *g, int fn, const decoded_t *in) {
+    lanes_t cond;
+    if(fn == JMP) {
+        g->pc = in->val;
+        return;
+    }
+    vectorCondition(g, fn, &cond);
+    uint32_t taken = laneBits(g, &cond) & g->active;
+    if(taken == g->active) {
+        g->pc = in->val;
+    } else if(!taken) {
+        g->pc += 5;
+    } else {
+        int stay = countLanes(taken) >= countLanes(g->active & ~taken);
+        int32_t next = g->pc + 5;
+        int i;
+        for(i = 0; i < g->numLanes; i++) {
+            if(!(g->active & (1u << i)) || (int)((taken >> i) & 1) == stay) {
+                continue;
+            }
+            g->lanes[i]->m->cpu.ipointer = stay ? next : in->val;
+            peelLane(g, i);
+        }
+        g->pc = stay ? in->val : next;
+    }
+}
+
+/*
+    Runs the gang until every guest has stopped or been peeled off.
+    Return:
+        The number of instructions each guest ran on the vector path while
+        it was in the gang, summed over the guests.
+*/
+static uint64_t runGang(gang_t *g) {
+    uint64_t vectorized = 0;
+    while(g->active) {
+        if(g->budget && g->executed >= g->budget) {
+            expire(g);
+            break;
+        }
+        const decoded_t *in = fetch(g, g->pc);
+        if(!in) {
+            disband(g);
+            break;
+        }
+        int class = opClasses[in->opcode];
+        int fn = opFns[in->opcode];
+        if(class == CLASS_OP) {
+            vectorOp(g, fn, in);
+        } else if(class == CLASS_MOV && fn == RR) {
+            g->regs[in->rB] = g->regs[in->rA];
+        } else if(class == CLASS_MOV && fn == IR) {
+            int c;
+            for(c = 0; c < g->numChunks; c++) {
+                g->regs[in->rB].chunks[c] = (chunk_t){ 0 } + in->val;
+            }
+        } else if(class == CLASS_JXX && (uint32_t)in->val < (uint32_t)g->size) {
+            /* Counted first; peeled guests take the count with them */
+            g->executed++;
+            g->pending++;
+            g->counts[CLASS_JXX]++;
+            vectorized += countLanes(g->active);
+            vectorJump(g, fn, in);
+            continue;
+        } else if(class != CLASS_NOP) {
+            scalarStep(g, in);
+            continue;
+        }
+        g->pc += in->length;
+        g->executed++;
+        g->pending++;
+        g->counts[class]++;
+        vectorized += countLanes(g->active);
+    }
+    return vectorized;
+}
+
+/*
+    Reads the list of inputs of a sweep: one file name per line. Blank lines
+    and lines starting with # are skipped.
+    Return:
+        The number of names stored in *names; -1 if the list could not be read
+*/
+static int readInputList(const char *listFile, char ***names) {
+    FILE *file = fopen(listFile, "r");
+    char line[1024];
+    int count = 0;
+    int size = 0;
+    *names = NULL;
+    if(!file) {
+        fprintf(stderr, "ERROR: Could not open input list %s\n", listFile);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if(!line[0] || line[0] == '#') {
+            continue;
+        }
+        if(count == size) {
+            size = size ? size * 2 : 64;
+            char **grown = realloc(*names, size * sizeof(char*));
+            if(!grown) {
+                break;
+            }
+            *names = grown;
+        }
+        if(!((*names)[count] = strdup(line))) {
+            break;
+        }
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/*
+    Prepares the guest of a lane: the program, and the input file and the
+    output file named after it.
+    Return:
+        1 if the guest is ready to run; 0 otherwise
+*/
+static int openLane(lane_t *lane, const char *fileName, uint64_t budget, int extensions) {
+    char outName[1100];
+    if(!(lane->m = y86Create())) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 0;
+    }
+    if(!y86LoadFile(lane->m, fileName)) {
+        return 0;
+    }
+    if(!(lane->in = fopen(lane->input, "r"))) {
+        fprintf(stderr, "ERROR: Could not open input %s\n", lane->input);
+        return 0;
+    }
+    snprintf(outName, sizeof(outName), "%s.out", lane->input);
+    if(!(lane->out = fopen(outName, "w"))) {
+        fprintf(stderr, "ERROR: Could not create %s\n", outName);
+        return 0;
+    }
+    y86SetIO(lane->m, fileInput, fileOutput, fileMessage, lane);
+    y86SetBlockIO(lane->m, fileRead, fileWrite);
+    y86EnableExtensions(lane->m, extensions);
+    y86SetBudget(lane->m, budget, 0);
+    return 1;
+}
+
+static void closeLane(lane_t *lane) {
+    if(lane->in) {
+        fclose(lane->in);
+    }
+    if(lane->out) {
+        fclose(lane->out);
+    }
+    y86Destroy(lane->m);
+}
+
+/*
+    Runs the guests of one gang to the end, first together and then the
+    ones that were peeled off one by one.
+*/
+static void sweepGang(lane_t **lanes, int count, uint64_t budget, sweepstats_t *stats) {
+    gang_t g;
+    int i;
+    memset(&g, 0, sizeof(g));
+    g.size = lanes[0]->m->mem->size;
+    g.numPages = lanes[0]->m->mem->numPages;
+    g.pc = lanes[0]->m->cpu.ipointer;
+    g.budget = budget;
+    for(i = 0; i < count; i++) {
+        g.lanes[i] = lanes[i];
+        g.active |= 1u << i;
+        loadLane(&g, i);
+    }
+    g.numLanes = count;
+    g.numChunks = (count + CHUNK_LANES - 1) / CHUNK_LANES;
+    if((g.code = calloc(g.numPages, sizeof(slot_t*)))) {
+        stats->vectorized += runGang(&g);
+    } else {
+        disband(&g);
+    }
+    for(i = 0; i < g.numPeeled; i++) {
+        run(g.peeled[i]->m, 0);
+    }
+    stats->peeled += g.numPeeled;
+    if(g.code) {
+        uint32_t page;
+        for(page = 0; page < g.numPages; page++) {
+            free(g.code[page]);
+        }
+        free(g.code);
+    }
+}
+
+/*
+    Runs the program once for every input in the list, with up to width
+    guests at a time in lockstep. The output of each guest is written next
+    to its input, with .out appended to the name, and a line with the end
+    status and the number of instructions executed is printed per input.
+    Arguments:
+        const char *fileName - the program
+        const char *listFile - the file listing the inputs
+        int width - guests per gang, at most GANG_WIDTH
+        uint64_t budget - the most instructions of each guest; 0 for no limit
+        int extensions - accept the extension instructions
+    Return:
+        1 if the program ran for every input; 0 otherwise
+*/
+int runInputSweep(const char *fileName, const char *listFile, int width, uint64_t budget, int extensions) {
+    sweepstats_t stats = { 0, 0, 0 };
+    char **names;
+    int numNames = readInputList(listFile, &names);
+    int ok = numNames >= 0;
+    int start, i;
+    if(width < 1 || width > GANG_WIDTH) {
+        width = GANG_WIDTH;
+    }
+    for(start = 0; start < numNames; start += width) {
+        lane_t lanes[GANG_WIDTH];
+        lane_t *ready[GANG_WIDTH];
+        int count = numNames - start < width ? numNames - start : width;
+        int numReady = 0;
+        memset(lanes, 0, sizeof(lanes));
+        for(i = 0; i < count; i++) {
+            lanes[i].input = names[start + i];
+            if(openLane(&lanes[i], fileName, budget, extensions)) {
+                ready[numReady++] = &lanes[i];
+            } else {
+                ok = 0;
+            }
+        }
+        if(numReady) {
+            sweepGang(ready, numReady, budget, &stats);
+        }
+        for(i = 0; i < numReady; i++) {
+            machine_t *m = ready[i]->m;
+            stats.executed += m->executed;
+            printf("%s: %s %llu\n", ready[i]->input, y86StatusName(m->status), (unsigned long long)m->executed);
+        }
+        for(i = 0; i < count; i++) {
+            closeLane(&lanes[i]);
+            free(names[start + i]);
+        }
+    }
+    free(names);
+    if(stats.executed) {
+        fprintf(stderr, "Sweep: %d inputs, %llu instructions, %.1f%% in lockstep, %d guests peeled off\n",
+                numNames, (unsigned long long)stats.executed,
+                100.0 * stats.vectorized / stats.executed, stats.peeled);
+    }
+    return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef gang_h
+#define gang_h
+
+#include <stdint.h>
+
+/*
+    The most guests run in lockstep; the register files of a gang are held
+    as vectors of this many lanes. Must be a power of two.
+*/
+#ifndef GANG_WIDTH
+#define GANG_WIDTH 16
+#endif
+
+int runInputSweep(const char*, const char*, int, uint64_t, int);
+
+#endif
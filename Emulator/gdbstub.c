@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "gdbstub.h"
+#include "sockets.h"
+
+/*
+    A stub for the GDB remote serial protocol. The guest presents itself as
+    an i386: the Y86 registers are numbered like the first eight i386
+    registers, followed by eip and eflags. Connect with
+        (gdb) set architecture i386
+        (gdb) target remote localhost:PORT
+    A thread reads the connection while the guest runs and passes an
+    interrupt from GDB on with y86Interrupt().
+*/
+
+#define UNIX_PREFIX "unix:"
+#define PACKET_MAX 4096
+#define INBUF_SIZE 8192
+
+#define NUM_GDB_REGISTERS 16
+#define GDB_EIP 8
+#define GDB_EFLAGS 9
+
+/* eflags bits */
+#define EFLAGS_ZF 0x040
+#define EFLAGS_SF 0x080
+#define EFLAGS_OF 0x800
+
+/* Signals reported in stop replies */
+#define SIGINT_D  2
+#define SIGILL_D  4
+#define SIGTRAP_D 5
+#define SIGSEGV_D 11
+#define SIGALRM_D 14
+
+typedef struct stub_s {
+    y86_t *guest;
+    int fd;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    char in[INBUF_SIZE];    /* bytes received but not consumed yet */
+    int inStart;
+    int inLen;
+    int closed;
+    int running;            /* the guest is running on behalf of GDB */
+} stub_t;
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static int hexValue(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+    Receives everything GDB sends. An interrupt (a lone 0x03) is not queued
+    but interrupts the guest if it is running; GDB only sends one while it
+    waits for the guest to stop.
+*/
+static void *readLoop(void *arg) {
+    stub_t *stub = arg;
+    char buf[512];
+    for(;;) {
+        ssize_t n = recv(stub->fd, buf, sizeof(buf), 0);
+        pthread_mutex_lock(&stub->lock);
+        if(n <= 0) {
+            stub->closed = 1;
+            pthread_cond_signal(&stub->ready);
+            pthread_mutex_unlock(&stub->lock);
+            return NULL;
+        }
+        ssize_t i;
+        for(i = 0; i < n; i++) {
+            if(buf[i] == 0x03) {
+                if(__atomic_load_n(&stub->running, __ATOMIC_RELAXED)) {
+                    y86Interrupt(stub->guest);
+                }
+            } else if(stub->inLen < INBUF_SIZE) {
+                stub->in[(stub->inStart + stub->inLen++) % INBUF_SIZE] = buf[i];
+            }
+        }
+        pthread_cond_signal(&stub->ready);
+        pthread_mutex_unlock(&stub->lock);
+    }
+}
+
+/*
+    Return:
+        The next byte from GDB; -1 once the connection is closed.
+*/
+static int nextByte(stub_t *stub) {
+    int c = -1;
+    pthread_mutex_lock(&stub->lock);
+    while(!stub->inLen && !stub->closed) {
+        pthread_cond_wait(&stub->ready, &stub->lock);
+    }
+    if(stub->inLen) {
+        c = (unsigned char)stub->in[stub->inStart];
+        stub->inStart = (stub->inStart + 1) % INBUF_SIZE;
+        stub->inLen--;
+    }
+    pthread_mutex_unlock(&stub->lock);
+    return c;
+}
+
+/*
+    Waits for the next packet and acknowledges it.
+    Return:
+        1 if a packet was stored in buf; 0 once the connection is closed
+*/
+static int getPacket(stub_t *stub, char *buf) {
+    for(;;) {
+        int c;
+        while((c = nextByte(stub)) != '$') {
+            if(c < 0) {
+                return 0;
+            }
+        }
+        int len = 0;
+        uint8_t sum = 0;
+        while((c = nextByte(stub)) != '#') {
+            if(c < 0) {
+                return 0;
+            }
+            if(len < PACKET_MAX - 1) {
+                buf[len++] = (char)c;
+            }
+            sum += (uint8_t)c;
+        }
+        buf[len] = '\0';
+        int high = hexValue((char)nextByte(stub));
+        int low = hexValue((char)nextByte(stub));
+        if(high >= 0 && low >= 0 && ((high << 4) | low) == sum) {
+            send(stub->fd, "+", 1, MSG_NOSIGNAL);
+            return 1;
+        }
+        send(stub->fd, "-", 1, MSG_NOSIGNAL);
+    }
+}
+
+static void putPacket(stub_t *stub, const char *data) {
+    size_t len = strlen(data);
+    char *packet = malloc(len + 4);
+    if(!packet) {
+        return;
+    }
+    uint8_t sum = 0;
+    size_t i;
+    packet[0] = '$';
+    for(i = 0; i < len; i++) {
+        packet[i + 1] = data[i];
+        sum += (uint8_t)data[i];
+    }
+    packet[len + 1] = '#';
+    packet[len + 2] = hexDigits[sum >> 4];
+    packet[len + 3] = hexDigits[sum & 0xF];
+    send(stub->fd, packet, len + 4, MSG_NOSIGNAL);
+    free(packet);
+}
+
+/*
+    Registers go over the wire as little-endian hex.
+*/
+static void putLittle(char *out, uint32_t value) {
+    int i;
+    for(i = 0; i < 4; i++) {
+        out[2 * i] = hexDigits[(value >> (8 * i + 4)) & 0xF];
+        out[2 * i + 1] = hexDigits[(value >> (8 * i)) & 0xF];
+    }
+    out[8] = '\0';
+}
+
+static uint32_t getLittle(const char *in) {
+    uint32_t value = 0;
+    int i;
+    for(i = 0; i < 4 && hexValue(in[2 * i]) >= 0 && hexValue(in[2 * i + 1]) >= 0; i++) {
+        value |= (uint32_t)((hexValue(in[2 * i]) << 4) | hexValue(in[2 * i + 1])) << (8 * i);
+    }
+    return value;
+}
+
+static uint32_t readRegister(const y86_t *guest, int reg) {
+    if(reg <= GDB_EIP) {
+        return (uint32_t)y86GetRegister(guest, reg);
+    } else if(reg == GDB_EFLAGS) {
+        int flags = y86GetFlags(guest);
+        return ((flags & Y86_ZF) ? EFLAGS_ZF : 0) | ((flags & Y86_SF) ? EFLAGS_SF : 0) |
+               ((flags & Y86_OF) ? EFLAGS_OF : 0);
+    }
+    return 0;
+}
+
+static void writeRegister(y86_t *guest, int reg, uint32_t value) {
+    if(reg <= GDB_EIP) {
+        y86SetRegister(guest, reg, (int32_t)value);
+    } else if(reg == GDB_EFLAGS) {
+        y86SetFlags(guest, ((value & EFLAGS_ZF) ? Y86_ZF : 0) | ((value & EFLAGS_SF) ? Y86_SF : 0) |
+                           ((value & EFLAGS_OF) ? Y86_OF : 0));
+    }
+}
+
+static void readMemory(stub_t *stub, const char *args) {
+    char reply[PACKET_MAX];
+    unsigned long addr = 0;
+    unsigned long len = 0;
+    if(sscanf(args, "%lx,%lx", &addr, &len) != 2 || len > (PACKET_MAX - 1) / 2) {
+        putPacket(stub, "E01");
+        return;
+    }
+    uint8_t bytes[PACKET_MAX / 2];
+    if(!y86ReadMemory(stub->guest, (int32_t)addr, bytes, (int32_t)len)) {
+        putPacket(stub, "E14");
+        return;
+    }
+    unsigned long i;
+    for(i = 0; i < len; i++) {
+        reply[2 * i] = hexDigits[bytes[i] >> 4];
+        reply[2 * i + 1] = hexDigits[bytes[i] & 0xF];
+    }
+    reply[2 * len] = '\0';
+    putPacket(stub, reply);
+}
+
+static void writeMemory(stub_t *stub, const char *args) {
+    unsigned long addr = 0;
+    unsigned long len = 0;
+    const char *data = strchr(args, ':');
+    if(sscanf(args, "%lx,%lx", &addr, &len) != 2 || !data || strlen(data + 1) < 2 * len) {
+        putPacket(stub, "E01");
+        return;
+    }
+    uint8_t bytes[PACKET_MAX / 2];
+    unsigned long i;
+    for(i = 0; i < len && i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)((hexValue(data[1 + 2 * i]) << 4) | hexValue(data[2 + 2 * i]));
+    }
+    putPacket(stub, y86WriteMemory(stub->guest, (int32_t)addr, bytes, (int32_t)i) ? "OK" : "E14");
+}
+
+/*
+    Handles Z (insert) and z (remove) packets for software and hardware
+    breakpoints and write watchpoints.
+*/
+static void setPoint(stub_t *stub, const char *args, int insert) {
+    int type = 0;
+    unsigned long addr = 0;
+    unsigned long kind = 0;
+    if(sscanf(args, "%d,%lx,%lx", &type, &addr, &kind) != 3) {
+        putPacket(stub, "E01");
+        return;
+    }
+    if(type == 0 || type == 1) {
+        if(insert) {
+            y86AddBreakpoint(stub->guest, (int32_t)addr);
+        } else {
+            y86RemoveBreakpoint(stub->guest, (int32_t)addr);
+        }
+        putPacket(stub, "OK");
+    } else if(type == 2) {
+        int ok = insert ? y86AddWatchpoint(stub->guest, (int32_t)addr, (int32_t)kind)
+                        : y86RemoveWatchpoint(stub->guest, (int32_t)addr);
+        putPacket(stub, ok ? "OK" : "E01");
+    } else {
+        putPacket(stub, "");
+    }
+}
+
+/*
+    Runs the guest until it stops, or for one instruction. An interrupt
+    from GDB stops it with Y86_INTERRUPTED.
+    Arguments:
+        stub_t *stub - the stub
+        int single - 1 to execute a single instruction
+    Return:
+        The reason the run stopped.
+*/
+static int resume(stub_t *stub, int single) {
+    if(single) {
+        return y86Step(stub->guest);
+    }
+    __atomic_store_n(&stub->running, 1, __ATOMIC_RELAXED);
+    int stop = y86Run(stub->guest, 0);
+    __atomic_store_n(&stub->running, 0, __ATOMIC_RELAXED);
+    return stop;
+}
+
+/*
+    Sends the stop reply for the way a run ended.
+    Return:
+        1 if the guest can keep running; 0 if it has exited
+*/
+static int reportStop(stub_t *stub, int stop) {
+    char reply[64];
+    int signal = SIGTRAP_D;
+    if(stop == Y86_INTERRUPTED) {
+        signal = SIGINT_D;
+    } else if(stop == Y86_WATCHPOINT) {
+        snprintf(reply, sizeof(reply), "T%02xwatch:%x;", SIGTRAP_D, (uint32_t)y86WatchAddress(stub->guest));
+        putPacket(stub, reply);
+        return 1;
+    } else if(stop == Y86_STOPPED) {
+        switch(y86Status(stub->guest)) {
+            case Y86_HLT:
+                putPacket(stub, "W00");
+                return 0;
+            case Y86_ADR:
+                signal = SIGSEGV_D;
+            break;
+            case Y86_INS:
+                signal = SIGILL_D;
+            break;
+            case Y86_TMO:
+                signal = SIGALRM_D;
+            break;
+        }
+    }
+    snprintf(reply, sizeof(reply), "S%02x", signal);
+    putPacket(stub, reply);
+    return 1;
+}
+
+/*
+    Answers packets until GDB kills or detaches from the guest, or the
+    guest halts.
+    Return:
+        1 if GDB detached and the guest should keep running; 0 otherwise
+*/
+static int session(stub_t *stub) {
+    char packet[PACKET_MAX];
+    char reply[PACKET_MAX];
+    y86_t *guest = stub->guest;
+    while(getPacket(stub, packet)) {
+        char *args = packet + 1;
+        switch(packet[0]) {
+            case '?':
+                reportStop(stub, Y86_BREAKPOINT);
+            break;
+            case 'g': {
+                int reg;
+                for(reg = 0; reg < NUM_GDB_REGISTERS; reg++) {
+                    putLittle(reply + 8 * reg, readRegister(guest, reg));
+                }
+                putPacket(stub, reply);
+            }
+            break;
+            case 'G': {
+                int reg;
+                for(reg = 0; reg < NUM_GDB_REGISTERS && strlen(args) >= 8 * (reg + 1); reg++) {
+                    writeRegister(guest, reg, getLittle(args + 8 * reg));
+                }
+                putPacket(stub, "OK");
+            }
+            break;
+            case 'p': {
+                int reg = (int)strtol(args, NULL, 16);
+                putLittle(reply, readRegister(guest, reg));
+                putPacket(stub, reply);
+            }
+            break;
+            case 'P': {
+                char *value = strchr(args, '=');
+                if(value) {
+                    writeRegister(guest, (int)strtol(args, NULL, 16), getLittle(value + 1));
+                }
+                putPacket(stub, value ? "OK" : "E01");
+            }
+            break;
+            case 'm':
+                readMemory(stub, args);
+            break;
+            case 'M':
+                writeMemory(stub, args);
+            break;
+            case 'c':
+            case 's':
+                if(*args) {
+                    y86SetRegister(guest, Y86_PC, (int32_t)strtoul(args, NULL, 16));
+                }
+                if(!reportStop(stub, resume(stub, packet[0] == 's'))) {
+                    return 0;
+                }
+            break;
+            case 'Z':
+            case 'z':
+                setPoint(stub, args, packet[0] == 'Z');
+            break;
+            case 'H':
+                putPacket(stub, "OK");
+            break;
+            case 'D':
+                putPacket(stub, "OK");
+                return 1;
+            case 'k':
+                return 0;
+            case 'q':
+                if(strncmp(packet, "qSupported", 10) == 0) {
+                    snprintf(reply, sizeof(reply), "PacketSize=%x", PACKET_MAX);
+                    putPacket(stub, reply);
+                } else if(strcmp(packet, "qAttached") == 0) {
+                    putPacket(stub, "1");
+                } else if(strcmp(packet, "qC") == 0) {
+                    putPacket(stub, "QC1");
+                } else if(strcmp(packet, "qfThreadInfo") == 0) {
+                    putPacket(stub, "m1");
+                } else if(strcmp(packet, "qsThreadInfo") == 0) {
+                    putPacket(stub, "l");
+                } else {
+                    putPacket(stub, "");
+                }
+            break;
+            default:
+                putPacket(stub, "");
+            break;
+        }
+    }
+    return 0;
+}
+
+static int bindLocalhost(int port) {
+    struct sockaddr_in addr;
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+    Opens the listening socket.
+    Arguments:
+        const char *where - a TCP port on localhost, or "unix:" followed by
+                            the path of a Unix socket
+    Return:
+        The socket; -1 if it could not be opened
+*/
+static int listenOn(const char *where) {
+    if(strncmp(where, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        return listenUnix(where + strlen(UNIX_PREFIX), 1);
+    }
+    int fd = bindLocalhost(atoi(where));
+    if(fd >= 0 && listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+    Waits for GDB to connect and lets it control the guest. If GDB detaches,
+    the guest is left to run on its own.
+    Arguments:
+        y86_t *guest - a loaded guest
+        const char *where - a TCP port on localhost, or unix:<path>
+    Return:
+        1 if a session took place; 0 if the socket could not be opened
+*/
+int gdbServe(y86_t *guest, const char *where) {
+    int server = listenOn(where);
+    if(server < 0) {
+        fprintf(stderr, "ERROR: Could not listen on %s\n", where);
+        return 0;
+    }
+    fprintf(stderr, "Waiting for GDB on %s\n", where);
+    stub_t stub;
+    memset(&stub, 0, sizeof(stub));
+    stub.guest = guest;
+    stub.fd = accept(server, NULL, NULL);
+    close(server);
+    if(stub.fd < 0) {
+        fprintf(stderr, "ERROR: Could not accept a connection\n");
+        return 0;
+    }
+    int on = 1;
+    setsockopt(stub.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    pthread_mutex_init(&stub.lock, NULL);
+    pthread_cond_init(&stub.ready, NULL);
+    if(pthread_create(&stub.reader, NULL, readLoop, &stub) != 0) {
+        close(stub.fd);
+        return 0;
+    }
+    int detached = session(&stub);
+    shutdown(stub.fd, SHUT_RDWR);
+    pthread_join(stub.reader, NULL);
+    close(stub.fd);
+    pthread_mutex_destroy(&stub.lock);
+    pthread_cond_destroy(&stub.ready);
+    if(detached) {
+        while(y86Run(guest, 0) != Y86_STOPPED) {
+            ;
+        }
+    }
+    return 1;
+}
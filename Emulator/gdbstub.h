@@ -0,0 +1,8 @@
+#ifndef gdbstub_h
+#define gdbstub_h
+
+#include "y86.h"
+
+int gdbServe(y86_t*, const char*);
+
+#endif
@@ -9,11 +9,12 @@
 #include "tokenizer.h"
 #include "util.h"
 
-static char **tokenizeProgram(char*);
-static char *getFileContents(char*);
-static int initializeArchitecture(char**);
-static int setInstructions(char**);
-static int runDirectives(char**);
+static char **tokenizeProgram(const char*);
+static char *getFileContents(const char*);
+static int initializeArchitecture(machine_t*, char**);
+static int setInstructions(machine_t*, char**);
+static int runDirectives(machine_t*, char**);
+static void freeTokens(char**);
 
 /*
     Calls the appropriate functions to perform the following steps:
@@ -23,51 +24,64 @@ static int runDirectives(char**);
            architecture with the appropriate size
         4. Inserts the program data into memory
     Arguments:
-        char *fileName - The name of the file containing the program.
+        machine_t *m - The machine to load the program into
+        const char *fileName - The name of the file containing the program.
     Return:
         1 if the file was successfully opened and its contents loaded into memory;
         0 if there were any issues.
 */
-int loadFileIntoMemory(char *fileName) {
+int loadFileIntoMemory(machine_t *m, const char *fileName) {
     char *programString = getFileContents(fileName);
     if(!programString) {
         fprintf(stderr, "ERROR: Failed to open file %s, perhaps it does not exist?\n", fileName);
         return 0;
     }
+    int loaded = loadProgram(m, programString);
+    free(programString);
+    return loaded;
+}
+
+/*
+    Loads a program from the text of a .y86 file, as described for
+    loadFileIntoMemory.
+    Return:
+        1 if the program was loaded into memory; 0 if there were any issues.
+*/
+int loadProgram(machine_t *m, const char *programString) {
     char **programTokens = tokenizeProgram(programString);
-    int initialized = initializeArchitecture(programTokens);
-    if(initialized) {
-        int instructionsSet = setInstructions(programTokens);
-        int directivesRun = runDirectives(programTokens);
-        free(programTokens);
-        free(programString);
-        return instructionsSet && directivesRun;
+    if(!programTokens) {
+        return 0;
     }
-    free(programTokens);
-    free(programString);
-    return 0;
+    int loaded = 0;
+    if(initializeArchitecture(m, programTokens)) {
+        int instructionsSet = setInstructions(m, programTokens);
+        int directivesRun = runDirectives(m, programTokens);
+        loaded = instructionsSet && directivesRun;
+    }
+    freeTokens(programTokens);
+    return loaded;
 }
 
-static int runDirectives(char **program) {
+static int runDirectives(machine_t *m, char **program) {
     int i = 0;
     int ok = 1;
     while(program[i]) {
         if(strcmp(program[i], BYTE_D) == 0) {
             int32_t addr = hexToDec(program[i + 1]);
             char byte = (char)hexToDec(program[i + 2]);
-            ok *= putByte(byte, addr);
+            ok *= putByte(m, byte, addr);
         } else if(strcmp(program[i], LONG_D) == 0) {
             int32_t addr = hexToDec(program[i + 1]);
             int32_t num = atoi(program[i + 2]);
-            ok *= putLong(num, addr);
+            ok *= putLong(m, num, addr);
         } else if(strcmp(program[i], STRING_D) == 0) {
             int32_t addr = hexToDec(program[i + 1]);
             char * str = program[i + 2];
-            ok *= putString(str, addr);
+            ok *= putString(m, str, addr);
         } else if(strcmp(program[i], BSS_D) == 0) {
             int32_t addr = hexToDec(program[i + 1]);
             int32_t size = atoi(program[i + 2]);
-            ok *= bss(size, addr);
+            ok *= bss(m, size, addr);
         }
         i++;
     }
@@ -78,14 +92,14 @@ static int runDirectives(char **program) {
     Executes the .text directive in the file, storing the machine instructions
     in memory.
 */
-static int setInstructions(char **program) {
+static int setInstructions(machine_t *m, char **program) {
     int textPos = searchStringArray(program, TEXT_D);
     if(textPos == -1) {
         return 0;
     }
     int32_t positionInMemory = hexToDec(program[textPos + 1]);
     char *instructions = program[textPos + 2];
-    insertInstructions(instructions, positionInMemory);
+    insertInstructions(m, instructions, positionInMemory);
     return 1;
 }
 
@@ -93,13 +107,13 @@ static int setInstructions(char **program) {
     Finds the position of the size directive within the program tokens and
     initializes the architecture with the given size.
 */
-static int initializeArchitecture(char **program) {
+static int initializeArchitecture(machine_t *m, char **program) {
     int sizePos = searchStringArray(program, SIZE_D);
     if(sizePos == -1) {
         return 0;
     }
     int32_t programSize = hexToDec(program[sizePos + 1]);
-    int success = initialize(programSize);
+    int success = initialize(m, programSize);
     return success;
 }
 
@@ -108,47 +122,70 @@ static int initializeArchitecture(char **program) {
     in an array of c strings. Freeing the memory of the result is left to the
     caller.
     Arguments:
-        char *program - The text making up the contents of the program
+        const char *program - The text making up the contents of the program
     Return:
         An array of c strings containing the tokenized program if no issues
-        are encountered; NULL otherwise.
+        are encountered; NULL otherwise, after reporting a failed allocation.
 */
-static char **tokenizeProgram(char *program) {
+static char **tokenizeProgram(const char *program) {
     if(!program) {
         return NULL;    
     }
-    char **program_tokens = NULL;
+    TokenizerT *tk = TKCreate((char*)program);
+    if(!tk) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return NULL;
+    }
+    char **program_tokens = malloc(sizeof(char*));
     size_t numTokens = 0;
-    TokenizerT *tk = TKCreate(program);
-    numTokens = 0;
+    if(program_tokens) {
+        program_tokens[0] = NULL;
+    }
 
     char *token = NULL;
-    while( (token = TKGetNextToken(tk)) ) {
-        program_tokens = realloc(program_tokens, sizeof(char*) * ++numTokens);
-
-        if(!program_tokens) {
-            fprintf(stderr, "\nMemory allocation failed\n");
-            return NULL;
+    while(program_tokens && (token = TKGetNextToken(tk)) ) {
+        char **grown = realloc(program_tokens, sizeof(char*) * (numTokens + 2));
+        if(!grown) {
+            free(token);
+            freeTokens(program_tokens);
+            program_tokens = NULL;
+            break;
         }
-
-        program_tokens[numTokens - 1] = token;
+        program_tokens = grown;
+        program_tokens[numTokens++] = token;
+        program_tokens[numTokens] = NULL;
+    }
+    if(program_tokens && tk->failed) {
+        freeTokens(program_tokens);
+        program_tokens = NULL;
     }
-
-    program_tokens = realloc(program_tokens, sizeof(char*) * (numTokens + 1));
-    program_tokens[numTokens] =  NULL;
     TKDestroy(tk);
+    if(!program_tokens) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+    }
     return program_tokens;
 }
 
+/*
+    Frees the tokens of a program along with the array holding them.
+*/
+static void freeTokens(char **tokens) {
+    int i;
+    for(i = 0; tokens[i]; i++) {
+        free(tokens[i]);
+    }
+    free(tokens);
+}
+
 /*
     Attempts to open a text file and create a string containing its contents.
     Arguments:
-        char *fileName - The name of the file
+        const char *fileName - The name of the file
     Return:
         A c string containing the contents of the file if there were no issues;
         NULL otherwise.
 */
-static char * getFileContents(char *fileName) {
+static char * getFileContents(const char *fileName) {
     char *buffer = NULL;
     long length;
     FILE *f = fopen (fileName, "rb");
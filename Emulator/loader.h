@@ -1,6 +1,8 @@
 #ifndef loader_h
 #define loader_h
 
+#include "architecture.h"
+
 #define SIZE_D ".size"
 #define STRING_D ".string"
 #define LONG_D ".long"
@@ -8,6 +10,7 @@
 #define BYTE_D ".byte"
 #define TEXT_D ".text"
 
-int loadFileIntoMemory(char *);
+int loadFileIntoMemory(machine_t*, const char*);
+int loadProgram(machine_t*, const char*);
 
 #endif
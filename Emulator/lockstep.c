@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "lockstep.h"
+
+/*
+    Differential execution of the block engine against the reference
+    interpreter. The two machines are loaded with the same program. The
+    fast one runs one translated block, the reference runs as many
+    instructions one at a time, and then everything either could have
+    changed is compared: registers, flags, instruction pointer, status,
+    instruction count, the output produced and every page either of them
+    wrote since the last comparison (PAGE_DIRTY, cleared once compared).
+    The fast machine reads stdin and the reference replays what it got, so
+    both see the same input; only the reference's output reaches stdout.
+    The first difference stops both machines and is reported with the
+    disassembly of the block.
+*/
+
+#define MAX_LISTED 16
+#define MAX_INSTRUCTION 6
+
+typedef struct inputrec_s {
+    int size;
+    int32_t value;
+    int result;
+} inputrec_t;
+
+typedef struct lockstep_s lockstep_t;
+
+/*
+    One of the two machines as seen by its I/O callbacks.
+*/
+typedef struct side_s {
+    lockstep_t *ls;
+    char *out;              /* output since the last comparison */
+    size_t outLen;
+    size_t outCap;
+} side_t;
+
+struct lockstep_s {
+    side_t ref;
+    side_t fast;
+    inputrec_t *inputs;     /* what the fast machine read, in order */
+    size_t numInputs;
+    size_t capInputs;
+    size_t replayed;        /* inputs the reference has taken */
+    int inputMismatch;      /* the reference asked for different input */
+};
+
+static void appendOutput(side_t *side, const char *text, size_t len) {
+    if(side->outLen + len > side->outCap) {
+        size_t cap = side->outCap ? side->outCap : 256;
+        while(cap < side->outLen + len) {
+            cap *= 2;
+        }
+        char *grown = realloc(side->out, cap);
+        if(!grown) {
+            return;
+        }
+        side->out = grown;
+        side->outCap = cap;
+    }
+    memcpy(side->out + side->outLen, text, len);
+    side->outLen += len;
+}
+
+static int bufferOutput(void *user, int size, int32_t value) {
+    char text[16];
+    int len = 1;
+    if(size == 1) {
+        text[0] = (char)value;
+    } else {
+        len = sprintf(text, "%d", value);
+    }
+    appendOutput(user, text, len);
+    return len;
+}
+
+static void bufferMessage(void *user, const char *text) {
+    appendOutput(user, text, strlen(text));
+}
+
+/*
+    Reads stdin for the fast machine, like the emulator does without
+    callbacks, and records what was read.
+*/
+static int recordInput(void *user, int size, int32_t *value) {
+    lockstep_t *ls = ((side_t*)user)->ls;
+    int set;
+    int consumed = 0;
+    if(size == 1) {
+        char c = 0;
+        set = scanf("%c%n", &c, &consumed);
+        *value = c;
+    } else {
+        int32_t l = 0;
+        set = scanf("%i%n", &l, &consumed);
+        *value = l;
+    }
+    consumed = set == EOF ? -1 : consumed;
+    if(ls->numInputs == ls->capInputs) {
+        size_t cap = ls->capInputs ? ls->capInputs * 2 : 64;
+        inputrec_t *grown = realloc(ls->inputs, cap * sizeof(inputrec_t));
+        if(!grown) {
+            return consumed;
+        }
+        ls->inputs = grown;
+        ls->capInputs = cap;
+    }
+    ls->inputs[ls->numInputs].size = size;
+    ls->inputs[ls->numInputs].value = *value;
+    ls->inputs[ls->numInputs].result = consumed;
+    ls->numInputs++;
+    return consumed;
+}
+
+/*
+    Gives the reference the input the fast machine read at the same point.
+*/
+static int replayInput(void *user, int size, int32_t *value) {
+    lockstep_t *ls = ((side_t*)user)->ls;
+    if(ls->replayed == ls->numInputs || ls->inputs[ls->replayed].size != size) {
+        ls->inputMismatch = 1;
+        *value = 0;
+        return -1;
+    }
+    *value = ls->inputs[ls->replayed].value;
+    return ls->inputs[ls->replayed++].result;
+}
+
+/*
+    Compares the pages either machine wrote and clears their dirty flags.
+    Arguments:
+        int list - print the differing bytes to stderr
+    Return:
+        1 if the pages hold the same bytes; 0 otherwise
+*/
+static int compareMemory(memory_t *ref, memory_t *fast, int list) {
+    uint32_t page;
+    int same = 1;
+    int listed = 0;
+    for(page = 0; page < ref->numPages; page++) {
+        if(!((ref->flags[page] | fast->flags[page]) & PAGE_DIRTY)) {
+            continue;
+        }
+        if(memcmp(ref->pages[page], fast->pages[page], PAGE_SIZE) != 0) {
+            int i;
+            same = 0;
+            for(i = 0; list && i < PAGE_SIZE && listed < MAX_LISTED; i++) {
+                if(ref->pages[page][i] != fast->pages[page][i]) {
+                    fprintf(stderr, "  memory 0x%08x  0x%02x        0x%02x\n", (page << PAGE_SHIFT) + i,
+                            ref->pages[page][i], fast->pages[page][i]);
+                    listed++;
+                }
+            }
+        }
+        if(!list) {
+            ref->flags[page] &= ~PAGE_DIRTY;
+            fast->flags[page] &= ~PAGE_DIRTY;
+        }
+    }
+    return same;
+}
+
+static int sameState(const lockstep_t *ls, const machine_t *ref, const machine_t *fast) {
+    return memcmp(ref->cpu.registers, fast->cpu.registers, sizeof(ref->cpu.registers)) == 0 &&
+           ref->cpu.ipointer == fast->cpu.ipointer && ref->cpu.OF == fast->cpu.OF &&
+           ref->cpu.SF == fast->cpu.SF && ref->cpu.ZF == fast->cpu.ZF &&
+           ref->status == fast->status && ref->executed == fast->executed &&
+           ls->ref.outLen == ls->fast.outLen &&
+           memcmp(ls->ref.out, ls->fast.out, ls->ref.outLen) == 0 && !ls->inputMismatch;
+}
+
+/*
+    Prints count instructions starting at addr, decoded from the memory of
+    the reference.
+*/
+static void disassembleBlock(const machine_t *m, int32_t addr, uint64_t count) {
+    sink_t sink;
+    uint64_t i;
+    if(!sinkInit(&sink, stderr)) {
+        return;
+    }
+    for(i = 0; i < count; i++) {
+        uint8_t bytes[MAX_INSTRUCTION];
+        size_t avail = 0;
+        insn_t insn;
+        while(avail < MAX_INSTRUCTION && addr + (int32_t)avail < m->mem->size) {
+            bytes[avail] = readByte(m->mem, addr + avail);
+            avail++;
+        }
+        sinkWrite(&sink, "    ", 4);
+        if(!avail || decodeInstruction(bytes, avail, addr, &insn) <= 0) {
+            sinkFlush(&sink);
+            fprintf(stderr, "0x%-5X| (not an instruction)\n", addr);
+            break;
+        }
+        formatInstruction(&insn, &sink);
+        addr += insn.length;
+    }
+    sinkFree(&sink);
+}
+
+static void printDifference(const char *name, int32_t ref, int32_t fast) {
+    fprintf(stderr, "  %-15s 0x%08x  0x%08x%s\n", name, ref, fast, ref != fast ? "  <" : "");
+}
+
+static void printOutput(const char *name, const side_t *side) {
+    size_t i;
+    fprintf(stderr, "  %s output: \"", name);
+    for(i = 0; i < side->outLen; i++) {
+        unsigned char c = side->out[i];
+        fprintf(stderr, c >= ' ' && c < 0x7f && c != '"' && c != '\\' ? "%c" : "\\x%02x", c);
+    }
+    fprintf(stderr, "\"\n");
+}
+
+static void reportDivergence(lockstep_t *ls, machine_t *ref, machine_t *fast, int32_t start, uint64_t count) {
+    int i;
+    fprintf(stderr, "Lockstep divergence in the block at 0x%x after %llu instructions\n",
+            start, (unsigned long long)ref->executed);
+    fprintf(stderr, "Block (%llu instructions run by the block engine):\n", (unsigned long long)count);
+    disassembleBlock(ref, start, count ? count : 1);
+    fprintf(stderr, "                  reference   blocks\n");
+    for(i = 0; i < NUM_REGISTERS; i++) {
+        printDifference(registerNames[i], ref->cpu.registers[i], fast->cpu.registers[i]);
+    }
+    printDifference("pc", ref->cpu.ipointer, fast->cpu.ipointer);
+    printDifference("OF", ref->cpu.OF, fast->cpu.OF);
+    printDifference("SF", ref->cpu.SF, fast->cpu.SF);
+    printDifference("ZF", ref->cpu.ZF, fast->cpu.ZF);
+    printDifference("executed", (int32_t)ref->executed, (int32_t)fast->executed);
+    fprintf(stderr, "  %-15s %-10s  %-10s%s\n", "status", y86StatusName(ref->status), y86StatusName(fast->status),
+            ref->status != fast->status ? "  <" : "");
+    compareMemory(ref->mem, fast->mem, 1);
+    if(ls->ref.outLen != ls->fast.outLen || memcmp(ls->ref.out, ls->fast.out, ls->ref.outLen) != 0) {
+        printOutput("reference", &ls->ref);
+        printOutput("blocks", &ls->fast);
+    }
+    if(ls->inputMismatch) {
+        fprintf(stderr, "  the reference read input the block engine did not\n");
+    }
+}
+
+/*
+    Runs two machines loaded with the same program side by side, one on the
+    reference interpreter and one on the block engine, until they stop or
+    disagree. The machines get their I/O callbacks replaced. A time budget
+    should be set on the fast machine only.
+    Arguments:
+        machine_t *ref - the machine run on the reference interpreter
+        machine_t *fast - the machine run on the block engine
+    Return:
+        1 if the machines agreed until they stopped; 0 if they diverged
+*/
+int runLockstep(machine_t *ref, machine_t *fast) {
+    lockstep_t ls;
+    int agreed = 1;
+    memset(&ls, 0, sizeof(ls));
+    ls.ref.ls = &ls;
+    ls.fast.ls = &ls;
+    ref->input = replayInput;
+    ref->output = bufferOutput;
+    ref->message = bufferMessage;
+    ref->user = &ls.ref;
+    fast->input = recordInput;
+    fast->output = bufferOutput;
+    fast->message = bufferMessage;
+    fast->user = &ls.fast;
+    /* readn and writen go through the byte callbacks above */
+    ref->readBlock = fast->readBlock = NULL;
+    ref->writeBlock = fast->writeBlock = NULL;
+    enableExtensions(fast->extensions);
+    ref->reference = 1;
+    fast->reference = 0;
+    if(!compareMemory(ref->mem, fast->mem, 0)) {
+        fprintf(stderr, "Lockstep: the machines were not loaded with the same program\n");
+        return 0;
+    }
+    while(ref->status == AOK && fast->status == AOK) {
+        int32_t start = fast->cpu.ipointer;
+        uint64_t count = stepBlock(fast);
+        if(count) {
+            run(ref, count);
+        }
+        if(fast->status == TMO && ref->status == AOK) {
+            /* Only the fast machine keeps time; the reference follows it */
+            ref->status = TMO;
+        }
+        if(!count || !sameState(&ls, ref, fast) || !compareMemory(ref->mem, fast->mem, 0)) {
+            if(!count && fast->status == AOK && sameState(&ls, ref, fast)) {
+                fprintf(stderr, "Lockstep: the block engine stopped making progress at 0x%x\n", start);
+            } else {
+                reportDivergence(&ls, ref, fast, start, count);
+            }
+            agreed = 0;
+            break;
+        }
+        fwrite(ls.ref.out, 1, ls.ref.outLen, stdout);
+        ls.ref.outLen = 0;
+        ls.fast.outLen = 0;
+    }
+    fflush(stdout);
+    free(ls.ref.out);
+    free(ls.fast.out);
+    free(ls.inputs);
+    return agreed;
+}
@@ -0,0 +1,8 @@
+#ifndef lockstep_h
+#define lockstep_h
+
+#include "machine.h"
+
+int runLockstep(machine_t*, machine_t*);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef machine_h
+#define machine_h
+
+#include <stdint.h>
+#include <time.h>
+
+#include "architecture.h"
+#include "cache.h"
+#include "memory.h"
+#include "metrics.h"
+#include "y86.h"
+
+/*
+    Shadow return address stack. Every call executed by the block engine
+    pushes its return address together with the block translated there, so
+    a matching ret can continue without searching the cache. Older entries
+    are overwritten when calls nest deeper than the stack.
+*/
+#define RAS_SIZE 64
+
+typedef struct rasentry_s {
+    int32_t addr;
+    uint32_t epoch;
+    tblock_t *block;
+} rasentry_t;
+
+/*
+    Edge coverage for the fuzzer. When a machine has a coverage map, the
+    block engine counts every transfer out of a block, so every jXX, call
+    and ret executed, in the byte the edge hashes to. The counts wrap.
+*/
+#define COVERAGE_BITS 14
+#define COVERAGE_SIZE (1 << COVERAGE_BITS)
+#define EDGE_INDEX(from, to) \
+    ((((uint32_t)(from) * 0x9E3779B1u) ^ ((uint32_t)(to) * 0x85EBCA6Bu)) >> (32 - COVERAGE_BITS))
+
+/*
+    A watched range of guest memory. Stores into it stop the run.
+*/
+typedef struct watch_s {
+    int32_t addr;
+    int32_t len;
+} watch_t;
+
+/*
+    Evaluates to true if stores to the page holding addr need more than a
+    plain write: the page holds translated or verified code or is being
+    watched.
+*/
+#define IS_SLOW_PAGE(mem, addr) ((mem)->flags[PAGE_OF(addr)] & (PAGE_CODE | PAGE_WATCH | PAGE_VERIFIED))
+
+/*
+    Everything that makes up one guest. Machines share nothing, so any
+    number of them can run side by side, one thread each. The CPUs of an
+    SMP guest are machines that share their memory; see smp.h.
+*/
+struct machine_s {
+    cpu_t cpu;
+    status_t status;
+    memory_t *mem;          /* the guest memory; normally the one below */
+    memory_t memory;
+    cache_t *cache;
+    int reference;          /* run on the reference interpreter */
+    int extensions;         /* decode the extension instructions */
+    struct smp_s *smp;      /* the CPUs this one belongs to; NULL if it is alone */
+    uint32_t codeEpoch;     /* mem->codeEpoch when the cache last caught up */
+    struct verified_s *verified; /* proof for the turbo interpreter; NULL if none */
+    metrics_t metrics;
+    uint8_t *coverage;      /* COVERAGE_SIZE edge counts; NULL if not traced */
+
+    /* Watchdog budgets; 0 means no limit */
+    uint64_t executed;      /* instructions executed since the budget was set */
+    uint64_t instructionBudget;
+    int32_t timeBudget;
+    uint32_t untilClock;
+    struct timespec deadline;
+    int interrupt;          /* set by interruptMachine(), cleared when seen */
+
+    rasentry_t ras[RAS_SIZE];
+    uint32_t rasTop;
+
+    int32_t *breakpoints;
+    int numBreakpoints;
+    int32_t resumeAddr;     /* breakpoint the last run stopped at; -1 if none */
+
+    watch_t *watchpoints;
+    int numWatchpoints;
+    int watchStale;         /* the PAGE_WATCH flags need to be set again */
+    int32_t watchAddr;      /* the store that hit a watchpoint */
+
+    y86_input_t input;
+    y86_output_t output;
+    y86_message_t message;
+    y86_read_t readBlock;   /* NULL to read through input a byte at a time */
+    y86_write_t writeBlock; /* NULL to write through output a byte at a time */
+    void *user;
+};
+
+#endif
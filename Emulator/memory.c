@@ -0,0 +1,148 @@
+#include <stdlib.h>
+
+#include "memory.h"
+
+/*
+    Guest memory is split into pages that get their own storage the first
+    time they are written. Until then a page maps to one shared page of
+    zeros, so large address spaces only cost what the guest actually uses.
+    The zero page is never written, so it is shared by every guest.
+*/
+static uint8_t zeroPage[PAGE_SIZE];
+
+/*
+    Sets up the page table for a guest memory of the given size. No page
+    storage is allocated yet.
+    Arguments:
+        memory_t *mem - the memory to set up
+        int32_t size - the size of guest memory in bytes
+    Return:
+        1 if the page table could be allocated; 0 otherwise
+*/
+int initMemory(memory_t *mem, int32_t size) {
+    uint32_t i;
+    mem->size = size;
+    mem->shared = 0;
+    mem->codeBits = NULL;
+    mem->codeEpoch = 0;
+    mem->numPages = ((uint32_t)size + PAGE_MASK) >> PAGE_SHIFT;
+    if(!mem->numPages) {
+        mem->numPages = 1;
+    }
+    mem->pages = malloc(mem->numPages * sizeof(uint8_t*));
+    mem->flags = calloc(mem->numPages, 1);
+    if(!mem->pages || !mem->flags) {
+        freeMemory(mem);
+        return 0;
+    }
+    for(i = 0; i < mem->numPages; i++) {
+        mem->pages[i] = zeroPage;
+    }
+    return 1;
+}
+
+/*
+    Releases every page along with the page table.
+*/
+void freeMemory(memory_t *mem) {
+    uint32_t i;
+    for(i = 0; mem->pages && i < mem->numPages; i++) {
+        if(mem->flags[i] & PAGE_PRESENT) {
+            free(mem->pages[i]);
+        }
+    }
+    free(mem->pages);
+    free(mem->flags);
+    mem->pages = NULL;
+    mem->flags = NULL;
+    mem->numPages = 0;
+    mem->size = 0;
+    unshareMemory(mem);
+}
+
+/*
+    Prepares the memory for several machines running on it at once. Each
+    keeps its own translation cache, so they share which bytes any of them
+    translated: a store into such a byte bumps codeEpoch, telling the others
+    to drop what they translated.
+    Return:
+        1 if the bitmap of translated bytes could be allocated; 0 otherwise
+*/
+int shareMemory(memory_t *mem) {
+    mem->codeBits = calloc((uint32_t)mem->size / 8 + 1, 1);
+    if(!mem->codeBits) {
+        return 0;
+    }
+    mem->shared = 1;
+    return 1;
+}
+
+void unshareMemory(memory_t *mem) {
+    free(mem->codeBits);
+    mem->codeBits = NULL;
+    mem->shared = 0;
+}
+
+/*
+    Records that the len bytes at addr were translated. The bits are never
+    cleared while the memory is shared.
+*/
+void markCode(memory_t *mem, int32_t addr, int32_t len) {
+    int32_t a;
+    for(a = addr; a < addr + len; a++) {
+        uint8_t bit = 1 << (a & 7);
+        if(!(mem->codeBits[a >> 3] & bit)) {
+            __atomic_or_fetch(&mem->codeBits[a >> 3], bit, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+    Return:
+        1 if any of the len bytes at addr was translated since the memory
+        became shared; 0 otherwise
+*/
+int isCode(const memory_t *mem, int32_t addr, int32_t len) {
+    int32_t a;
+    for(a = addr; a < addr + len; a++) {
+        if(__atomic_load_n(&mem->codeBits[a >> 3], __ATOMIC_RELAXED) & (1 << (a & 7))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Returns the storage of a page.
+    Return:
+        The page's bytes if it is present; NULL if it was never written.
+*/
+uint8_t *presentPage(const memory_t *mem, uint32_t page) {
+    return (mem->flags[page] & PAGE_PRESENT) ? mem->pages[page] : NULL;
+}
+
+/*
+    Gives a page its own zero filled storage. Called on the first write.
+    Machines sharing the memory may race to do so; the first one to swap
+    its storage in wins and the others use it.
+    Return:
+        The storage of the page; NULL if it could not be allocated, leaving
+        the page reading as zero.
+*/
+uint8_t *touchPage(memory_t *mem, uint32_t page) {
+    if(mem->flags[page] & PAGE_PRESENT) {
+        return mem->pages[page];
+    }
+    uint8_t *data = calloc(PAGE_SIZE, 1);
+    if(!data) {
+        return NULL;
+    }
+    uint8_t *expected = zeroPage;
+    if(!__atomic_compare_exchange_n(&mem->pages[page], &expected, data, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(data);
+        return expected;
+    }
+    __atomic_or_fetch(&mem->flags[page], PAGE_PRESENT, __ATOMIC_RELEASE);
+    return data;
+}
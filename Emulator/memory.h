@@ -0,0 +1,117 @@
+#ifndef memory_h
+#define memory_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bytes.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+/*
+    Page flags
+    PAGE_PRESENT - the page has its own storage; pages without it read as zero
+    PAGE_DIRTY   - the page has been written since the flag was last cleared
+    PAGE_CODE    - translated blocks were decoded from the page
+    PAGE_WATCH   - a watchpoint covers part of the page
+    PAGE_VERIFIED - code verified for the turbo interpreter lies in the page
+*/
+#define PAGE_PRESENT 0x01
+#define PAGE_DIRTY   0x02
+#define PAGE_CODE    0x04
+#define PAGE_WATCH   0x08
+#define PAGE_VERIFIED 0x10
+
+#define PAGE_OF(addr) ((uint32_t)(addr) >> PAGE_SHIFT)
+
+/*
+    Guest memory. Machines refer to it through a pointer so that it can
+    outlive them or be shared between them. Page flags are only changed
+    with atomic operations and pages get their storage with a
+    compare-and-swap, so machines on different threads may run on the same
+    memory at once; they set shared while they do.
+*/
+typedef struct memory_s {
+    uint8_t **pages;
+    uint8_t *flags;         /* page flags, one byte per page */
+    uint32_t numPages;
+    int32_t size;           /* size of guest memory in bytes */
+    int shared;             /* several machines are running on the memory */
+    uint8_t *codeBits;      /* while shared: a bit for every byte translated */
+    uint32_t codeEpoch;     /* bumped by stores into translated bytes while shared */
+} memory_t;
+
+int initMemory(memory_t*, int32_t);
+void freeMemory(memory_t*);
+int shareMemory(memory_t*);
+void unshareMemory(memory_t*);
+void markCode(memory_t*, int32_t, int32_t);
+int isCode(const memory_t*, int32_t, int32_t);
+uint8_t *presentPage(const memory_t*, uint32_t);
+uint8_t *touchPage(memory_t*, uint32_t);
+
+/*
+    Guest memory accessors. Addresses must already be bounds checked against
+    the size of guest memory. Reads of pages that were never written see
+    zeros and do not allocate anything. Writes return 0 if a page could not
+    be given storage; the bytes on other pages may have been written.
+*/
+static inline uint8_t readByte(const memory_t *mem, int32_t addr) {
+    return mem->pages[PAGE_OF(addr)][addr & PAGE_MASK];
+}
+
+static inline void markDirty(memory_t *mem, uint32_t page) {
+    if(!(mem->flags[page] & PAGE_DIRTY)) {
+        __atomic_or_fetch(&mem->flags[page], PAGE_DIRTY, __ATOMIC_RELAXED);
+    }
+}
+
+static inline int writeByte(memory_t *mem, int32_t addr, uint8_t byte) {
+    uint32_t page = PAGE_OF(addr);
+    uint8_t *data = (mem->flags[page] & PAGE_PRESENT) ? mem->pages[page] : touchPage(mem, page);
+    if(!data) {
+        return 0;
+    }
+    markDirty(mem, page);
+    data[addr & PAGE_MASK] = byte;
+    return 1;
+}
+
+static inline int32_t readLong(const memory_t *mem, int32_t addr) {
+    if((addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+        return (int32_t)loadLE32(&mem->pages[PAGE_OF(addr)][addr & PAGE_MASK]);
+    } else {
+        uint8_t bytes[4];
+        int i;
+        for(i = 0; i < 4; i++) {
+            bytes[i] = readByte(mem, addr + i);
+        }
+        return (int32_t)loadLE32(bytes);
+    }
+}
+
+static inline int writeLong(memory_t *mem, int32_t addr, int32_t val) {
+    if((addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+        uint32_t page = PAGE_OF(addr);
+        uint8_t *data = (mem->flags[page] & PAGE_PRESENT) ? mem->pages[page] : touchPage(mem, page);
+        if(!data) {
+            return 0;
+        }
+        markDirty(mem, page);
+        storeLE32(&data[addr & PAGE_MASK], (uint32_t)val);
+    } else {
+        uint8_t bytes[4];
+        int i;
+        storeLE32(bytes, (uint32_t)val);
+        for(i = 0; i < 4; i++) {
+            if(!writeByte(mem, addr + i, bytes[i])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+#include "sockets.h"
+#include "y86.h"
+
+#define UNIX_PREFIX "unix:"
+
+static const char *classNames[NUM_CLASSES] = {
+    "nop", "halt", "mov", "op", "jxx", "call",
+    "ret", "push", "pop", "read", "write", "smp"
+};
+
+static pthread_t dumper;
+static const metrics_t *dumpMetrics;
+static const char *dumpTarget;
+static int dumpInterval;
+static int dumping;
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dumpWake = PTHREAD_COND_INITIALIZER;
+
+#define LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/*
+    Clears every counter. Called once the program is loaded so that the
+    loader's stores are not counted as guest activity.
+*/
+void resetMetrics(metrics_t *metrics) {
+    memset(metrics, 0, sizeof(metrics_t));
+}
+
+/*
+    Adds the counters of another guest to these, like those of the
+    secondary CPUs of an SMP run once they stopped.
+*/
+void addMetrics(metrics_t *metrics, const metrics_t *other) {
+    int i;
+    for(i = 0; i < NUM_CLASSES; i++) {
+        COUNT(metrics->classes[i], other->classes[i]);
+    }
+    COUNT(metrics->memReads, other->memReads);
+    COUNT(metrics->memWrites, other->memWrites);
+    COUNT(metrics->ioRead, other->ioRead);
+    COUNT(metrics->ioWritten, other->ioWritten);
+}
+
+void setMetricsStatus(metrics_t *metrics, status_t status) {
+    __atomic_store_n(&metrics->status, status, __ATOMIC_RELAXED);
+}
+
+/*
+    Writes the counters in the Prometheus text exposition format. Each
+    instruction is counted once under its class, so the retired total is the
+    sum of the classes.
+*/
+void writeMetrics(FILE *out, const metrics_t *metrics) {
+    uint64_t retired = 0;
+    int i;
+    for(i = 0; i < NUM_CLASSES; i++) {
+        retired += LOAD(metrics->classes[i]);
+    }
+    fprintf(out, "# HELP y86_instructions_retired_total Instructions executed by the guest.\n");
+    fprintf(out, "# TYPE y86_instructions_retired_total counter\n");
+    fprintf(out, "y86_instructions_retired_total %llu\n", (unsigned long long)retired);
+    fprintf(out, "# HELP y86_instructions_total Instructions executed per opcode class.\n");
+    fprintf(out, "# TYPE y86_instructions_total counter\n");
+    for(i = 0; i < NUM_CLASSES; i++) {
+        fprintf(out, "y86_instructions_total{class=\"%s\"} %llu\n", classNames[i],
+                (unsigned long long)LOAD(metrics->classes[i]));
+    }
+    fprintf(out, "# HELP y86_memory_reads_total Data reads from guest memory.\n");
+    fprintf(out, "# TYPE y86_memory_reads_total counter\n");
+    fprintf(out, "y86_memory_reads_total %llu\n", (unsigned long long)LOAD(metrics->memReads));
+    fprintf(out, "# HELP y86_memory_writes_total Data writes to guest memory.\n");
+    fprintf(out, "# TYPE y86_memory_writes_total counter\n");
+    fprintf(out, "y86_memory_writes_total %llu\n", (unsigned long long)LOAD(metrics->memWrites));
+    fprintf(out, "# HELP y86_io_read_bytes_total Bytes consumed from standard input.\n");
+    fprintf(out, "# TYPE y86_io_read_bytes_total counter\n");
+    fprintf(out, "y86_io_read_bytes_total %llu\n", (unsigned long long)LOAD(metrics->ioRead));
+    fprintf(out, "# HELP y86_io_written_bytes_total Bytes written to standard output.\n");
+    fprintf(out, "# TYPE y86_io_written_bytes_total counter\n");
+    fprintf(out, "y86_io_written_bytes_total %llu\n", (unsigned long long)LOAD(metrics->ioWritten));
+    fprintf(out, "# HELP y86_status Current status of the machine.\n");
+    fprintf(out, "# TYPE y86_status gauge\n");
+    status_t status = LOAD(metrics->status);
+    for(i = AOK; i < DBG; i++) {
+        /* DBG never outlives run(), so it is left out */
+        fprintf(out, "y86_status{status=\"%s\"} %d\n", y86StatusName(i), status == i);
+    }
+}
+
+/*
+    Sends one dump to a listening Unix socket. A new connection is made for
+    every dump so the reader can come and go.
+*/
+static void dumpToSocket(const char *path) {
+    int fd = connectUnix(path);
+    if(fd < 0) {
+        return;
+    }
+    FILE *out = fdopen(fd, "w");
+    if(!out) {
+        close(fd);
+        return;
+    }
+    writeMetrics(out, dumpMetrics);
+    fclose(out);
+}
+
+/*
+    Replaces the dump file. The counters go to a temporary file first and are
+    renamed over the target, so readers never see a partial dump.
+*/
+static void dumpToFile(const char *path) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    if(!tmp) {
+        return;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    FILE *out = fopen(tmp, "w");
+    if(out) {
+        writeMetrics(out, dumpMetrics);
+        fclose(out);
+        rename(tmp, path);
+    }
+    free(tmp);
+}
+
+static void dump() {
+    if(strncmp(dumpTarget, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        dumpToSocket(dumpTarget + strlen(UNIX_PREFIX));
+    } else {
+        dumpToFile(dumpTarget);
+    }
+}
+
+static void *dumpLoop(void *arg) {
+    pthread_mutex_lock(&dumpLock);
+    while(dumping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += dumpInterval / 1000;
+        until.tv_nsec += (long)(dumpInterval % 1000) * 1000000;
+        if(until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&dumpWake, &dumpLock, &until);
+        if(dumping) {
+            dump();
+        }
+    }
+    pthread_mutex_unlock(&dumpLock);
+    return NULL;
+}
+
+/*
+    Starts a thread that dumps the counters periodically while the guest runs.
+    Arguments:
+        const metrics_t *metrics - the counters to dump
+        const char *target - a file path, or "unix:" followed by the path of
+                             a listening Unix socket
+        int interval - milliseconds between dumps
+    Return:
+        1 if the thread was started; 0 otherwise
+*/
+int startMetricsDump(const metrics_t *metrics, const char *target, int interval) {
+    dumpMetrics = metrics;
+    dumpTarget = target;
+    dumpInterval = interval > 0 ? interval : 1;
+    dumping = 1;
+    if(pthread_create(&dumper, NULL, dumpLoop, NULL) != 0) {
+        dumping = 0;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+    Stops the dump thread and writes a final dump with the end status.
+*/
+void stopMetricsDump() {
+    if(!dumpTarget) {
+        return;
+    }
+    pthread_mutex_lock(&dumpLock);
+    int running = dumping;
+    dumping = 0;
+    pthread_cond_signal(&dumpWake);
+    pthread_mutex_unlock(&dumpLock);
+    if(running) {
+        pthread_join(dumper, NULL);
+    }
+    dump();
+}
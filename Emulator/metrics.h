@@ -0,0 +1,46 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "architecture.h"
+
+/*
+    Instruction classes, matching the class column of the instruction
+    specification.
+*/
+typedef enum iclass_e {
+    CLASS_NOP, CLASS_HALT, CLASS_MOV, CLASS_OP, CLASS_JXX, CLASS_CALL,
+    CLASS_RET, CLASS_PUSH, CLASS_POP, CLASS_READ, CLASS_WRITE, CLASS_SMP, NUM_CLASSES
+} iclass_t;
+
+/*
+    Running statistics of a guest. The emulator is the only writer; other
+    threads may read the counters at any time while it runs.
+*/
+typedef struct metrics_s {
+    uint64_t classes[NUM_CLASSES];
+    uint64_t memReads;
+    uint64_t memWrites;
+    uint64_t ioRead;
+    uint64_t ioWritten;
+    status_t status;
+} metrics_t;
+
+/*
+    Adds to a counter with relaxed atomic accesses. There is a single writer,
+    so a plain load and store is enough and avoids a locked instruction on
+    the hot path while still being safe to read from another thread.
+*/
+#define COUNT(counter, n) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+void resetMetrics(metrics_t*);
+void addMetrics(metrics_t*, const metrics_t*);
+void setMetricsStatus(metrics_t*, status_t);
+void writeMetrics(FILE*, const metrics_t*);
+int startMetricsDump(const metrics_t*, const char*, int);
+void stopMetricsDump(void);
+
+#endif
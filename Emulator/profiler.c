@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "bytes.h"
+#include "profiler.h"
+
+/*
+    A sampling profiler for guests. The guest runs in chunks of a fixed
+    number of instructions, or until a SIGPROF timer interrupts it, and each
+    stop records the guest call stack. The stack is found by following the
+    frame pointer chain that functions build with
+        pushl %ebp
+        rrmovl %esp, %ebp
+    so [%ebp] holds the caller's %ebp and [%ebp + 4] the return address.
+    Functions that do not set up a frame, or are still in their prologue,
+    are attributed to their caller.
+
+    Frames are named from a symbol file when one is given: one symbol per
+    line, a hexadecimal address followed by a name. Without symbols each
+    frame is named by the entry address of its function, taken from the
+    call instruction before the return address; the outermost frame is
+    named by the address execution started at.
+
+    The result is written in the folded format read by flame graph tools:
+    one line per distinct stack, outermost frame first, frames separated
+    by semicolons and followed by the number of samples.
+*/
+
+#define MAX_FRAMES 128
+#define MAX_NAME 64
+#define MAX_INSTRUCTION 6
+#define INITIAL_SAMPLES 1024
+#define INITIAL_POOL 4096
+
+/*
+    Length of each call instruction generated from the instruction
+    specification; 0 for every other opcode.
+*/
+#define CALLS_NEXT   0
+#define CALLS_JUMP   0
+#define CALLS_BRANCH 0
+#define CALLS_CALL   1
+#define CALLS_RET    0
+#define CALLS_HALT   0
+
+static const uint8_t callLengths[256] = {
+#define INSTRUCTION(code, mnemonic, length, layout, flow, class, fn) [code] = CALLS_##flow ? length : 0,
+#include "instructions.def"
+#undef INSTRUCTION
+};
+
+typedef struct symbol_s {
+    int32_t addr;
+    char name[MAX_NAME];
+} symbol_t;
+
+/*
+    A distinct stack and the number of times it was sampled. The frames are
+    kept in the profiler's frame pool, outermost first.
+*/
+typedef struct sample_s {
+    uint64_t count;         /* 0 marks an empty slot of the table */
+    uint32_t hash;
+    int depth;
+    size_t frames;          /* index of the first frame in the pool */
+} sample_t;
+
+struct profiler_s {
+    uint64_t every;         /* instructions between samples; 0 for none */
+    int timerMs;            /* CPU milliseconds between samples; 0 for none */
+    int started;
+    int32_t entry;          /* where execution started */
+
+    symbol_t *symbols;      /* sorted by address */
+    int numSymbols;
+
+    sample_t *samples;      /* open addressing hash table */
+    uint32_t tableSize;
+    uint32_t numSamples;
+    int32_t *pool;
+    size_t poolUsed;
+    size_t poolSize;
+};
+
+static int compareSymbols(const void *a, const void *b) {
+    int32_t x = ((const symbol_t*)a)->addr;
+    int32_t y = ((const symbol_t*)b)->addr;
+    return (uint32_t)x < (uint32_t)y ? -1 : (uint32_t)x > (uint32_t)y;
+}
+
+/*
+    Reads a symbol file. Blank lines and lines starting with # are skipped.
+    Return:
+        1 if the file was read; 0 otherwise
+*/
+static int loadSymbols(profiler_t *p, const char *fileName) {
+    FILE *file = fopen(fileName, "r");
+    char line[256];
+    int size = 0;
+    if(!file) {
+        fprintf(stderr, "ERROR: Could not open symbol file %s\n", fileName);
+        return 0;
+    }
+    while(fgets(line, sizeof(line), file)) {
+        unsigned int addr;
+        char name[MAX_NAME];
+        char *c;
+        if(line[0] == '#' || sscanf(line, "%x %63s", &addr, name) != 2) {
+            continue;
+        }
+        if(p->numSymbols == size) {
+            size = size ? size * 2 : 64;
+            symbol_t *grown = realloc(p->symbols, size * sizeof(symbol_t));
+            if(!grown) {
+                fclose(file);
+                return 0;
+            }
+            p->symbols = grown;
+        }
+        /* Semicolons separate frames in the output */
+        for(c = name; *c; c++) {
+            if(*c == ';') {
+                *c = '_';
+            }
+        }
+        p->symbols[p->numSymbols].addr = (int32_t)addr;
+        strcpy(p->symbols[p->numSymbols].name, name);
+        p->numSymbols++;
+    }
+    fclose(file);
+    qsort(p->symbols, p->numSymbols, sizeof(symbol_t), compareSymbols);
+    return 1;
+}
+
+/*
+    Return:
+        The symbol with the highest address not above addr; NULL if there is
+        none.
+*/
+static const symbol_t *findSymbol(const profiler_t *p, int32_t addr) {
+    int low = 0;
+    int high = p->numSymbols - 1;
+    const symbol_t *found = NULL;
+    while(low <= high) {
+        int mid = (low + high) / 2;
+        if((uint32_t)p->symbols[mid].addr <= (uint32_t)addr) {
+            found = &p->symbols[mid];
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+/*
+    Creates a profiler.
+    Arguments:
+        uint64_t every - guest instructions between samples; 0 for none
+        int timerMs - CPU time in milliseconds between samples; 0 for none
+        const char *symbolFile - the symbol file; NULL for none
+    Return:
+        The profiler; NULL if it could not be allocated or the symbol file
+        could not be read.
+*/
+profiler_t *createProfiler(uint64_t every, int timerMs, const char *symbolFile) {
+    profiler_t *p = calloc(1, sizeof(profiler_t));
+    if(!p) {
+        return NULL;
+    }
+    p->every = every;
+    p->timerMs = timerMs;
+    p->tableSize = INITIAL_SAMPLES;
+    p->samples = calloc(p->tableSize, sizeof(sample_t));
+    p->poolSize = INITIAL_POOL;
+    p->pool = malloc(p->poolSize * sizeof(int32_t));
+    if(!p->samples || !p->pool || (symbolFile && !loadSymbols(p, symbolFile))) {
+        destroyProfiler(p);
+        return NULL;
+    }
+    return p;
+}
+
+void destroyProfiler(profiler_t *p) {
+    if(!p) {
+        return;
+    }
+    free(p->symbols);
+    free(p->samples);
+    free(p->pool);
+    free(p);
+}
+
+static int readGuestLong(y86_t *guest, int32_t addr, int32_t *value) {
+    uint8_t bytes[4];
+    if(!y86ReadMemory(guest, addr, bytes, 4)) {
+        return 0;
+    }
+    *value = (int32_t)loadLE32(bytes);
+    return 1;
+}
+
+/*
+    Looks for the call instruction that pushed a return address.
+    Arguments:
+        int32_t ret - the return address
+        int32_t *target - receives the address the instruction calls
+    Return:
+        1 if a call instruction ends right before ret; 0 otherwise
+*/
+static int findCall(y86_t *guest, int32_t ret, int32_t *target) {
+    int len;
+    for(len = 1; len <= MAX_INSTRUCTION; len++) {
+        uint8_t code;
+        if(y86ReadMemory(guest, ret - len, &code, 1) && callLengths[code] == len) {
+            return readGuestLong(guest, ret - len + 1, target);
+        }
+    }
+    return 0;
+}
+
+/*
+    Finds the functions on the guest call stack.
+    Arguments:
+        int32_t *frames - receives an address identifying each function,
+                          innermost first
+    Return:
+        The number of frames.
+*/
+static int walkStack(const profiler_t *p, y86_t *guest, int32_t *frames) {
+    int32_t pcs[MAX_FRAMES];
+    int32_t callees[MAX_FRAMES];
+    int32_t ebp = y86GetRegister(guest, Y86_EBP);
+    int depth = 1;
+    int i;
+    pcs[0] = y86GetRegister(guest, Y86_PC);
+    while(depth < MAX_FRAMES) {
+        int32_t saved, ret;
+        /* Frames of callers are further up the stack */
+        if(!readGuestLong(guest, ebp, &saved) || (uint32_t)saved <= (uint32_t)ebp ||
+           !readGuestLong(guest, ebp + 4, &ret) || !findCall(guest, ret, &callees[depth - 1])) {
+            break;
+        }
+        pcs[depth++] = ret - 1;
+        ebp = saved;
+    }
+    for(i = 0; i < depth; i++) {
+        if(p->numSymbols) {
+            const symbol_t *symbol = findSymbol(p, pcs[i]);
+            frames[i] = symbol ? symbol->addr : pcs[i];
+        } else {
+            frames[i] = i + 1 < depth ? callees[i] : p->entry;
+        }
+    }
+    return depth;
+}
+
+static uint32_t hashFrames(const int32_t *frames, int depth) {
+    uint32_t hash = 2166136261u;
+    int i;
+    for(i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t)frames[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static sample_t *findSample(sample_t *samples, uint32_t tableSize, const int32_t *pool,
+                            const int32_t *frames, int depth, uint32_t hash) {
+    uint32_t i = hash & (tableSize - 1);
+    while(samples[i].count) {
+        if(samples[i].hash == hash && samples[i].depth == depth &&
+           memcmp(&pool[samples[i].frames], frames, depth * sizeof(int32_t)) == 0) {
+            break;
+        }
+        i = (i + 1) & (tableSize - 1);
+    }
+    return &samples[i];
+}
+
+/*
+    Doubles the stack table once it is half full.
+    Return:
+        1 if there is room for another stack; 0 if memory ran out
+*/
+static int growSamples(profiler_t *p) {
+    uint32_t i;
+    if(p->numSamples * 2 < p->tableSize) {
+        return 1;
+    }
+    sample_t *grown = calloc(p->tableSize * 2, sizeof(sample_t));
+    if(!grown) {
+        return 0;
+    }
+    for(i = 0; i < p->tableSize; i++) {
+        if(p->samples[i].count) {
+            const sample_t *old = &p->samples[i];
+            *findSample(grown, p->tableSize * 2, p->pool, &p->pool[old->frames], old->depth, old->hash) = *old;
+        }
+    }
+    free(p->samples);
+    p->samples = grown;
+    p->tableSize *= 2;
+    return 1;
+}
+
+/*
+    Records the current call stack of the guest. New stacks are dropped
+    once memory runs out.
+*/
+void sampleGuest(profiler_t *p, y86_t *guest) {
+    int32_t innermost[MAX_FRAMES];
+    int32_t frames[MAX_FRAMES];
+    int depth = walkStack(p, guest, innermost);
+    int room = growSamples(p);
+    int i;
+    for(i = 0; i < depth; i++) {
+        frames[i] = innermost[depth - 1 - i];
+    }
+    uint32_t hash = hashFrames(frames, depth);
+    sample_t *sample = findSample(p->samples, p->tableSize, p->pool, frames, depth, hash);
+    if(sample->count) {
+        sample->count++;
+        return;
+    }
+    if(room && p->poolUsed + depth > p->poolSize) {
+        int32_t *grown = realloc(p->pool, p->poolSize * 2 * sizeof(int32_t));
+        if(grown) {
+            p->pool = grown;
+            p->poolSize *= 2;
+        } else {
+            room = 0;
+        }
+    }
+    if(!room) {
+        return;
+    }
+    memcpy(&p->pool[p->poolUsed], frames, depth * sizeof(int32_t));
+    sample->count = 1;
+    sample->hash = hash;
+    sample->depth = depth;
+    sample->frames = p->poolUsed;
+    p->poolUsed += depth;
+    p->numSamples++;
+}
+
+static y86_t *profiledGuest;
+
+static void onProfileTimer(int sig) {
+    y86_t *guest = profiledGuest;
+    if(guest) {
+        y86Interrupt(guest);
+    }
+}
+
+/*
+    Runs the guest like y86Run(guest, 0), taking samples along the way. Only
+    one guest at a time can be profiled with the timer, since SIGPROF is
+    delivered to the whole process.
+    Return:
+        The reason the run returned, other than the limits used for sampling.
+*/
+int profileRun(profiler_t *p, y86_t *guest) {
+    struct sigaction action, previous;
+    struct itimerval timer;
+    int stop;
+    if(!p->started) {
+        p->entry = y86GetRegister(guest, Y86_PC);
+        p->started = 1;
+    }
+    if(p->timerMs) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onProfileTimer;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        profiledGuest = guest;
+        sigaction(SIGPROF, &action, &previous);
+        timer.it_interval.tv_sec = p->timerMs / 1000;
+        timer.it_interval.tv_usec = (p->timerMs % 1000) * 1000;
+        timer.it_value = timer.it_interval;
+        setitimer(ITIMER_PROF, &timer, NULL);
+    }
+    do {
+        stop = y86Run(guest, p->every);
+        if(stop == Y86_LIMIT || stop == Y86_INTERRUPTED) {
+            sampleGuest(p, guest);
+        }
+    } while(stop == Y86_LIMIT || stop == Y86_INTERRUPTED);
+    if(p->timerMs) {
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+        sigaction(SIGPROF, &previous, NULL);
+        profiledGuest = NULL;
+    }
+    return stop;
+}
+
+typedef struct folded_s {
+    char *stack;
+    uint64_t count;
+} folded_t;
+
+static int compareFolded(const void *a, const void *b) {
+    return strcmp(((const folded_t*)a)->stack, ((const folded_t*)b)->stack);
+}
+
+static void frameName(const profiler_t *p, int32_t addr, char *name) {
+    const symbol_t *symbol = findSymbol(p, addr);
+    if(symbol && symbol->addr == addr) {
+        strcpy(name, symbol->name);
+    } else {
+        sprintf(name, "0x%x", addr);
+    }
+}
+
+/*
+    Writes the samples as folded stacks. Different stacks can get the same
+    names, so the lines are sorted and merged first.
+*/
+void writeFoldedStacks(const profiler_t *p, FILE *out) {
+    folded_t *lines = malloc((p->numSamples + 1) * sizeof(folded_t));
+    uint32_t numLines = 0;
+    uint32_t i;
+    int j;
+    if(!lines) {
+        fprintf(stderr, "ERROR: Profiler ran out of memory\n");
+        return;
+    }
+    for(i = 0; i < p->tableSize; i++) {
+        const sample_t *sample = &p->samples[i];
+        if(!sample->count) {
+            continue;
+        }
+        char *stack = malloc(sample->depth * (MAX_NAME + 1) + 1);
+        if(!stack) {
+            continue;
+        }
+        char *end = stack;
+        for(j = 0; j < sample->depth; j++) {
+            if(j) {
+                *end++ = ';';
+            }
+            frameName(p, p->pool[sample->frames + j], end);
+            end += strlen(end);
+        }
+        lines[numLines].stack = stack;
+        lines[numLines].count = sample->count;
+        numLines++;
+    }
+    qsort(lines, numLines, sizeof(folded_t), compareFolded);
+    for(i = 0; i < numLines; i++) {
+        uint64_t count = lines[i].count;
+        while(i + 1 < numLines && strcmp(lines[i].stack, lines[i + 1].stack) == 0) {
+            free(lines[i].stack);
+            count += lines[++i].count;
+        }
+        fprintf(out, "%s %llu\n", lines[i].stack, (unsigned long long)count);
+        free(lines[i].stack);
+    }
+    free(lines);
+}
@@ -0,0 +1,17 @@
+#ifndef profiler_h
+#define profiler_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "y86.h"
+
+typedef struct profiler_s profiler_t;
+
+profiler_t *createProfiler(uint64_t, int, const char*);
+void destroyProfiler(profiler_t*);
+void sampleGuest(profiler_t*, y86_t*);
+int profileRun(profiler_t*, y86_t*);
+void writeFoldedStacks(const profiler_t*, FILE*);
+
+#endif
@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "serve.h"
+#include "sockets.h"
+#include "y86.h"
+
+/*
+    Job server. Clients connect to a Unix socket and submit jobs; a fixed
+    pool of worker threads, each keeping one guest for its whole life, runs
+    them. Each request is a line followed by its payload:
+        job <id> <budget> <inputLen> path <path>\n<input>
+        job <id> <budget> <inputLen> image <imageLen>\n<image><input>
+    id       - any word; it tags the replies of the job
+    budget   - the most instructions the job may run; 0 for the server's limit
+    input    - inputLen bytes the program reads as its stdin
+    path     - a .y86 file on the server's file system
+    image    - imageLen bytes holding the text of a .y86 file
+    Replies arrive as the jobs run, tagged with the id:
+        out <id> <len>\n<bytes>       the next part of the program's stdout
+        metrics <id> <len>\n<text>    the counters in the Prometheus format
+        status <id> <status> <executed>\n
+                                      the end status; the last reply of a job
+        error <id> <message>\n        the job could not run; also a last reply
+    A client may submit any number of jobs without waiting; replies of
+    different jobs may interleave.
+
+    Jobs wait in one queue per client and the workers serve the clients
+    round robin, so a client with many jobs does not hold up the others.
+    Once a client has CLIENT_QUEUE jobs waiting, or the server has its
+    limit of waiting jobs, the server stops reading the client's requests
+    until one is taken, which makes the client's writes block.
+*/
+
+#define LINE_MAX_S 1024
+#define OUT_CHUNK 4096
+#define CLIENT_QUEUE 16
+#define MAX_PAYLOAD (64 << 20)
+
+typedef struct client_s client_t;
+
+typedef struct job_s {
+    client_t *client;
+    char id[64];
+    char *path;             /* the program file; NULL if image is given */
+    char *image;            /* the text of the program */
+    char *input;            /* NUL terminated stdin of the program */
+    size_t inputLen;
+    uint64_t budget;
+    struct job_s *next;
+} job_t;
+
+/*
+    A connection. The reader and every job not yet finished hold a
+    reference; the last one to let go closes it.
+*/
+struct client_s {
+    int fd;
+    int refs;
+    int pending;            /* jobs waiting in the queue below */
+    job_t *head;
+    job_t *tail;
+    int ready;              /* the client is in the ready list */
+    client_t *nextReady;
+    int broken;             /* a reply could not be sent */
+    pthread_mutex_t writeLock;
+};
+
+typedef struct server_s {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* a job was queued or the server is stopping */
+    pthread_cond_t space;   /* a job left the queue */
+    client_t *readyHead;    /* clients with waiting jobs, in serving order */
+    client_t *readyTail;
+    int queued;
+    int maxQueued;
+    uint64_t budget;        /* instruction limit of every job; 0 for none */
+    int32_t timeout;        /* time limit of every job; 0 for none */
+    int extensions;         /* jobs may use the extension instructions */
+    int stopping;
+} server_t;
+
+typedef struct reader_s {
+    server_t *server;
+    client_t *client;
+} reader_t;
+
+/*
+    A job running on a worker, as seen by the guest's I/O callbacks.
+*/
+typedef struct run_s {
+    y86_t *guest;
+    job_t *job;
+    size_t inputPos;
+    size_t outLen;
+    char out[OUT_CHUNK];
+} run_t;
+
+/*
+    Drops a reference to a client. Called with the server lock held.
+*/
+static void releaseClient(client_t *c) {
+    if(--c->refs) {
+        return;
+    }
+    close(c->fd);
+    pthread_mutex_destroy(&c->writeLock);
+    free(c);
+}
+
+static void freeJob(job_t *job) {
+    free(job->path);
+    free(job->image);
+    free(job->input);
+    free(job);
+}
+
+static int sendAll(int fd, const char *buf, size_t len) {
+    while(len) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+/*
+    Sends a reply line and its payload without letting replies of other
+    jobs of the client come in between. Once a send fails nothing more is
+    sent to the client.
+*/
+static void sendReply(client_t *c, const char *line, const char *payload, size_t len) {
+    pthread_mutex_lock(&c->writeLock);
+    if(!c->broken && (!sendAll(c->fd, line, strlen(line)) || !sendAll(c->fd, payload, len))) {
+        __atomic_store_n(&c->broken, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&c->writeLock);
+}
+
+static int isBroken(client_t *c) {
+    return __atomic_load_n(&c->broken, __ATOMIC_RELAXED);
+}
+
+static void flushOutput(run_t *run) {
+    char line[128];
+    if(!run->outLen) {
+        return;
+    }
+    snprintf(line, sizeof(line), "out %s %zu\n", run->job->id, run->outLen);
+    sendReply(run->job->client, line, run->out, run->outLen);
+    run->outLen = 0;
+    /* Nobody is listening; stop the guest */
+    if(isBroken(run->job->client)) {
+        y86Interrupt(run->guest);
+    }
+}
+
+static void appendOutput(run_t *run, const char *text, size_t len) {
+    if(run->outLen + len > OUT_CHUNK) {
+        flushOutput(run);
+    }
+    if(len > OUT_CHUNK) {
+        char line[128];
+        snprintf(line, sizeof(line), "out %s %zu\n", run->job->id, len);
+        sendReply(run->job->client, line, text, len);
+        return;
+    }
+    memcpy(run->out + run->outLen, text, len);
+    run->outLen += len;
+}
+
+/*
+    Reads the job's input the way the emulator reads stdin: readb takes the
+    next byte and readl the next integer in any base scanf's %i accepts.
+*/
+static int bufferInput(void *user, int size, int32_t *value) {
+    run_t *run = user;
+    const job_t *job = run->job;
+    const char *start = job->input + run->inputPos;
+    const char *end = job->input + job->inputLen;
+    const char *c = start;
+    char *stop;
+    if(size == 1) {
+        if(start == end) {
+            return -1;
+        }
+        *value = (char)*start;
+        run->inputPos++;
+        return 1;
+    }
+    while(c < end && isspace((unsigned char)*c)) {
+        c++;
+    }
+    if(c == end) {
+        return -1;
+    }
+    long l = strtol(c, &stop, 0);
+    if(stop == c) {
+        /* Like scanf, the whitespace is gone but nothing was converted */
+        run->inputPos = c - job->input;
+        return 0;
+    }
+    *value = (int32_t)l;
+    run->inputPos = stop - job->input;
+    return stop - start;
+}
+
+static int bufferOutput(void *user, int size, int32_t value) {
+    run_t *run = user;
+    char text[16];
+    int len = 1;
+    if(size == 1) {
+        text[0] = (char)value;
+    } else {
+        len = sprintf(text, "%d", value);
+    }
+    appendOutput(run, text, len);
+    return len;
+}
+
+static void bufferMessage(void *user, const char *text) {
+    appendOutput(user, text, strlen(text));
+}
+
+/*
+    Runs a job on a worker's guest and sends all of its replies.
+*/
+static void runJob(server_t *s, run_t *run, job_t *job) {
+    char line[256];
+    client_t *c = job->client;
+    y86_t *guest = run->guest;
+    int loaded = job->path ? y86LoadFile(guest, job->path) : y86LoadProgram(guest, job->image);
+    if(!loaded) {
+        snprintf(line, sizeof(line), "error %s could not load the program\n", job->id);
+        sendReply(c, line, NULL, 0);
+        return;
+    }
+    run->job = job;
+    run->inputPos = 0;
+    run->outLen = 0;
+    y86SetIO(guest, bufferInput, bufferOutput, bufferMessage, run);
+    uint64_t budget = job->budget;
+    if(s->budget && (!budget || budget > s->budget)) {
+        budget = s->budget;
+    }
+    y86SetBudget(guest, budget, s->timeout);
+    while(y86Run(guest, 0) != Y86_STOPPED && !isBroken(c)) {
+        ;
+    }
+    flushOutput(run);
+    char *metrics = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&metrics, &len);
+    if(out) {
+        y86WriteMetrics(guest, out);
+        fclose(out);
+        snprintf(line, sizeof(line), "metrics %s %zu\n", job->id, len);
+        sendReply(c, line, metrics, len);
+        free(metrics);
+    }
+    snprintf(line, sizeof(line), "status %s %s %llu\n", job->id, y86StatusName(y86Status(guest)),
+             (unsigned long long)y86Executed(guest));
+    sendReply(c, line, NULL, 0);
+}
+
+/*
+    Waits for a job and takes it from the client whose turn it is.
+    Return:
+        The job; NULL once the server is stopping.
+*/
+static job_t *takeJob(server_t *s) {
+    pthread_mutex_lock(&s->lock);
+    while(!s->readyHead && !s->stopping) {
+        pthread_cond_wait(&s->work, &s->lock);
+    }
+    if(s->stopping) {
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+    }
+    client_t *c = s->readyHead;
+    s->readyHead = c->nextReady;
+    job_t *job = c->head;
+    c->head = job->next;
+    c->pending--;
+    s->queued--;
+    if(c->head) {
+        /* Back of the line */
+        c->nextReady = NULL;
+        if(s->readyHead) {
+            s->readyTail->nextReady = c;
+        } else {
+            s->readyHead = c;
+        }
+        s->readyTail = c;
+    } else {
+        c->tail = NULL;
+        c->ready = 0;
+    }
+    pthread_cond_broadcast(&s->space);
+    pthread_mutex_unlock(&s->lock);
+    return job;
+}
+
+/*
+    Queues a job, waiting while the client or the server has too many.
+    Return:
+        1 if the job was queued; 0 if the server is stopping
+*/
+static int queueJob(server_t *s, client_t *c, job_t *job) {
+    pthread_mutex_lock(&s->lock);
+    while(!s->stopping && (c->pending >= CLIENT_QUEUE || s->queued >= s->maxQueued)) {
+        pthread_cond_wait(&s->space, &s->lock);
+    }
+    if(s->stopping) {
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+    job->next = NULL;
+    if(c->tail) {
+        c->tail->next = job;
+    } else {
+        c->head = job;
+    }
+    c->tail = job;
+    c->pending++;
+    c->refs++;
+    s->queued++;
+    if(!c->ready) {
+        c->ready = 1;
+        c->nextReady = NULL;
+        if(s->readyHead) {
+            s->readyTail->nextReady = c;
+        } else {
+            s->readyHead = c;
+        }
+        s->readyTail = c;
+    }
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    return 1;
+}
+
+static void *workerLoop(void *arg) {
+    server_t *s = arg;
+    run_t *run = malloc(sizeof(run_t));
+    if(!run || !(run->guest = y86Create())) {
+        fprintf(stderr, "ERROR: Could not create a worker\n");
+        free(run);
+        return NULL;
+    }
+    y86EnableExtensions(run->guest, s->extensions);
+    job_t *job;
+    while((job = takeJob(s))) {
+        runJob(s, run, job);
+        client_t *c = job->client;
+        freeJob(job);
+        pthread_mutex_lock(&s->lock);
+        releaseClient(c);
+        pthread_mutex_unlock(&s->lock);
+    }
+    y86Destroy(run->guest);
+    free(run);
+    return NULL;
+}
+
+/*
+    Reads exactly len bytes into a new NUL terminated buffer.
+    Return:
+        The buffer; NULL if the bytes could not be read
+*/
+static char *readPayload(FILE *in, size_t len) {
+    if(len > MAX_PAYLOAD) {
+        return NULL;
+    }
+    char *buf = malloc(len + 1);
+    if(buf && fread(buf, 1, len, in) != len) {
+        free(buf);
+        return NULL;
+    }
+    if(buf) {
+        buf[len] = '\0';
+    }
+    return buf;
+}
+
+/*
+    Parses a request line and reads its payload.
+    Return:
+        The job; NULL if the request is malformed
+*/
+static job_t *readJob(FILE *in, const char *line) {
+    char kind[16];
+    unsigned long long budget;
+    size_t inputLen, imageLen;
+    int rest = 0;
+    job_t *job = calloc(1, sizeof(job_t));
+    if(!job) {
+        return NULL;
+    }
+    if(sscanf(line, "job %63s %llu %zu %15s %n", job->id, &budget, &inputLen, kind, &rest) < 4 || !rest) {
+        free(job);
+        return NULL;
+    }
+    job->budget = budget;
+    if(strcmp(kind, "path") == 0) {
+        job->path = strdup(line + rest);
+        if(job->path) {
+            job->path[strcspn(job->path, "\n")] = '\0';
+        }
+    } else if(strcmp(kind, "image") == 0 && sscanf(line + rest, "%zu", &imageLen) == 1) {
+        job->image = readPayload(in, imageLen);
+    }
+    if((!job->path && !job->image) || !(job->input = readPayload(in, inputLen))) {
+        freeJob(job);
+        return NULL;
+    }
+    job->inputLen = inputLen;
+    return job;
+}
+
+static void *readLoop(void *arg) {
+    reader_t *reader = arg;
+    server_t *s = reader->server;
+    client_t *c = reader->client;
+    char line[LINE_MAX_S];
+    free(reader);
+    int fd = dup(c->fd);
+    FILE *in = fd >= 0 ? fdopen(fd, "r") : NULL;
+    while(in && fgets(line, sizeof(line), in)) {
+        job_t *job = readJob(in, line);
+        if(!job) {
+            sendReply(c, "error - malformed request\n", NULL, 0);
+            break;
+        }
+        job->client = c;
+        if(!queueJob(s, c, job)) {
+            freeJob(job);
+            break;
+        }
+    }
+    if(in) {
+        fclose(in);
+    } else if(fd >= 0) {
+        close(fd);
+    }
+    pthread_mutex_lock(&s->lock);
+    releaseClient(c);
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static void acceptClient(server_t *s, int conn) {
+    pthread_t thread;
+    client_t *c = calloc(1, sizeof(client_t));
+    reader_t *reader = malloc(sizeof(reader_t));
+    if(!c || !reader) {
+        free(c);
+        free(reader);
+        close(conn);
+        return;
+    }
+    c->fd = conn;
+    c->refs = 1;
+    pthread_mutex_init(&c->writeLock, NULL);
+    reader->server = s;
+    reader->client = c;
+    if(pthread_create(&thread, NULL, readLoop, reader) != 0) {
+        pthread_mutex_destroy(&c->writeLock);
+        free(c);
+        free(reader);
+        close(conn);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+/*
+    Serves jobs until the server is sent SIGINT or SIGTERM. Jobs that are
+    running then are finished; jobs still waiting are dropped.
+    Arguments:
+        const char *path - the path of the Unix socket
+        int workers - the number of jobs run at once
+        int maxQueued - the most jobs waiting over all clients
+        uint64_t budget - the instruction limit of every job; 0 for none
+        int32_t timeout - the time limit of every job in ms; 0 for none
+        int extensions - let jobs use the extension instructions
+    Return:
+        1 if the server ran; 0 if it could not be started
+*/
+int serveJobs(const char *path, int workers, int maxQueued, uint64_t budget, int32_t timeout, int extensions) {
+    /* Readers may still be around when this returns */
+    static server_t s;
+    int i;
+    int server = listenUnix(path, SOMAXCONN);
+    if(server < 0) {
+        fprintf(stderr, "ERROR: Could not listen on %s\n", path);
+        return 0;
+    }
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    if(!threads) {
+        close(server);
+        return 0;
+    }
+    memset(&s, 0, sizeof(s));
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.work, NULL);
+    pthread_cond_init(&s.space, NULL);
+    s.maxQueued = maxQueued;
+    s.budget = budget;
+    s.timeout = timeout;
+    s.extensions = extensions;
+    for(i = 0; i < workers; i++) {
+        if(pthread_create(&threads[i], NULL, workerLoop, &s) != 0) {
+            break;
+        }
+    }
+    workers = i;
+    catchStopSignals(NULL);
+    fprintf(stderr, "Serving jobs on %s with %d workers\n", path, workers);
+    while(!stopRequested && workers) {
+        int conn = accept(server, NULL, NULL);
+        if(conn >= 0) {
+            acceptClient(&s, conn);
+        } else if(errno != EINTR) {
+            perror("accept");
+        }
+    }
+    close(server);
+    unlink(path);
+    pthread_mutex_lock(&s.lock);
+    s.stopping = 1;
+    pthread_cond_broadcast(&s.work);
+    pthread_cond_broadcast(&s.space);
+    pthread_mutex_unlock(&s.lock);
+    for(i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return workers > 0;
+}
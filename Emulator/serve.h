@@ -0,0 +1,8 @@
+#ifndef serve_h
+#define serve_h
+
+#include <stdint.h>
+
+int serveJobs(const char*, int, int, uint64_t, int32_t, int);
+
+#endif
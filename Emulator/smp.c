@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "smp.h"
+#include "machine.h"
+
+/*
+    The CPUs of an SMP guest. CPUs are started in order, each at most once,
+    so every CPU below started has a thread to join, except CPU 0, which
+    runs on the thread that called runSmp().
+*/
+typedef struct smp_s {
+    machine_t *cpus[SMP_MAX_CPUS];
+    pthread_t threads[SMP_MAX_CPUS];
+    int numCpus;
+    int started;            /* CPUs started so far, CPU 0 included */
+    int stopping;           /* no more CPUs may be started */
+    machine_t *faulted;     /* the first CPU that stopped with something but HLT */
+    pthread_mutex_t lock;
+} smp_t;
+
+/*
+    Records the CPU that faulted, unless another one did first, and makes
+    all the others return from run() soon.
+*/
+static void stopAll(smp_t *smp, machine_t *faulted) {
+    int i;
+    pthread_mutex_lock(&smp->lock);
+    if(!smp->faulted) {
+        smp->faulted = faulted;
+    }
+    smp->stopping = 1;
+    for(i = 0; i < smp->started; i++) {
+        if(smp->cpus[i] != faulted) {
+            interruptMachine(smp->cpus[i]);
+        }
+    }
+    pthread_mutex_unlock(&smp->lock);
+}
+
+/*
+    Runs a CPU until it stops or another CPU stops it.
+*/
+static void runCpu(machine_t *m) {
+    run(m, 0);
+    if(m->status != AOK && m->status != HLT) {
+        stopAll(m->smp, m);
+    }
+}
+
+static void *cpuThread(void *arg) {
+    runCpu(arg);
+    return NULL;
+}
+
+/*
+    Starts the next idle CPU. Creating its thread orders every store of the
+    CPU calling this before the first instruction of the new one.
+    Arguments:
+        struct smp_s *smp - the CPUs of the guest
+        int32_t pc - where the new CPU starts
+        int32_t sp - the stack pointer of the new CPU
+    Return:
+        The number of the CPU; -1 if every CPU was started already or the
+        guest is stopping.
+*/
+int32_t startCpu(smp_t *smp, int32_t pc, int32_t sp) {
+    int32_t cpu = -1;
+    pthread_mutex_lock(&smp->lock);
+    if(!smp->stopping && smp->started < smp->numCpus) {
+        machine_t *m = smp->cpus[smp->started];
+        m->cpu.ipointer = pc;
+        m->cpu.registers[ESP] = sp;
+        m->cpu.registers[EAX] = smp->started;
+        m->codeEpoch = __atomic_load_n(&m->mem->codeEpoch, __ATOMIC_ACQUIRE);
+        if(pthread_create(&smp->threads[smp->started], NULL, cpuThread, m) == 0) {
+            cpu = smp->started++;
+        }
+    }
+    pthread_mutex_unlock(&smp->lock);
+    return cpu;
+}
+
+/*
+    Creates a secondary CPU on the memory of CPU 0, with the same I/O,
+    budgets and engine.
+    Return:
+        The CPU; NULL if it could not be allocated.
+*/
+static machine_t *createCpu(smp_t *smp, const machine_t *boot) {
+    machine_t *m = createMachine();
+    if(!m) {
+        return NULL;
+    }
+    m->mem = boot->mem;
+    if(!(m->cache = createCache(m->mem))) {
+        destroyMachine(m);
+        return NULL;
+    }
+    m->reference = boot->reference;
+    m->extensions = boot->extensions;
+    m->smp = smp;
+    m->input = boot->input;
+    m->output = boot->output;
+    m->message = boot->message;
+    m->readBlock = boot->readBlock;
+    m->writeBlock = boot->writeBlock;
+    m->user = boot->user;
+    setBudget(m, boot->instructionBudget, boot->timeBudget);
+    m->deadline = boot->deadline;
+    return m;
+}
+
+/*
+    Runs a loaded program as an SMP guest: the machine is CPU 0 and the
+    guest may start the others with spawn. Returns once every CPU that was
+    started has stopped. The machine ends up with the status of the guest,
+    the status of the first CPU that stopped with something but HLT or else
+    its own, and with the statistics of every CPU.
+    Arguments:
+        machine_t *boot - the machine holding the program
+        int numCpus - the number of CPUs, at most SMP_MAX_CPUS
+    Return:
+        1 if the guest ran; 0 if the CPUs could not be set up
+*/
+int runSmp(machine_t *boot, int numCpus) {
+    smp_t *smp = calloc(1, sizeof(smp_t));
+    int i;
+    if(!smp || !shareMemory(boot->mem)) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        free(smp);
+        return 0;
+    }
+    pthread_mutex_init(&smp->lock, NULL);
+    smp->cpus[0] = boot;
+    smp->numCpus = 1;
+    smp->started = 1;
+    for(i = 1; i < numCpus; i++) {
+        if(!(smp->cpus[i] = createCpu(smp, boot))) {
+            fprintf(stderr, "ERROR: Memory allocation failed\n");
+            break;
+        }
+        smp->numCpus++;
+    }
+    if(smp->numCpus == numCpus) {
+        /* Blocks translated before the memory was shared are not marked */
+        flushCache(boot->cache);
+        boot->codeEpoch = boot->mem->codeEpoch;
+        boot->smp = smp;
+        runCpu(boot);
+        for(i = 1; ; i++) {
+            pthread_mutex_lock(&smp->lock);
+            int started = smp->started;
+            if(i >= started) {
+                /* Every CPU that could start another has stopped */
+                smp->stopping = 1;
+            }
+            pthread_mutex_unlock(&smp->lock);
+            if(i >= started) {
+                break;
+            }
+            pthread_join(smp->threads[i], NULL);
+        }
+        if(smp->faulted) {
+            boot->status = smp->faulted->status;
+        }
+    }
+    for(i = 1; i < smp->numCpus; i++) {
+        addMetrics(&boot->metrics, &smp->cpus[i]->metrics);
+        destroyMachine(smp->cpus[i]);
+    }
+    setMetricsStatus(&boot->metrics, boot->status);
+    int ran = smp->numCpus == numCpus;
+    boot->smp = NULL;
+    unshareMemory(boot->mem);
+    pthread_mutex_destroy(&smp->lock);
+    free(smp);
+    return ran;
+}
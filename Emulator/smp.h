@@ -0,0 +1,35 @@
+#ifndef smp_h
+#define smp_h
+
+#include <stdint.h>
+
+#include "architecture.h"
+
+/*
+    SMP guests. The machine the program was loaded into is CPU 0; the other
+    CPUs are machines on the same memory, each running on its own thread
+    with its own registers and translation cache. They are started by the
+    guest with spawn and the run ends once every started CPU has stopped.
+    A CPU stopping with anything but HLT stops all the others and gives the
+    whole guest its status.
+
+    Memory model. cas and xadd are atomic and sequentially consistent: all
+    CPUs see them in one order, and each keeps the plain loads and stores
+    of its CPU on the side of it they were executed on. Plain loads and stores are not ordered
+    between CPUs in any other way, so a guest that lets two CPUs touch the
+    same bytes with plain accesses, at least one of them a store, without
+    ordering them through cas or xadd may see values out of order or torn.
+    Guests free of such races behave as if the CPUs took turns executing
+    instructions. Stores into code follow the same rule: another CPU is
+    only sure to run the new code once it has synchronized with the store
+    through cas or xadd, and picks it up by its next jump, call or ret.
+    Output from different CPUs is interleaved by instruction.
+*/
+#define SMP_MAX_CPUS 64
+
+struct smp_s;
+
+int runSmp(machine_t*, int);
+int32_t startCpu(struct smp_s*, int32_t, int32_t);
+
+#endif
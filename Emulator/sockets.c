@@ -0,0 +1,83 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sockets.h"
+
+volatile sig_atomic_t stopRequested;
+
+static void (*stopHook)(void);
+
+/*
+    Opens a Unix socket for connections, replacing a stale socket file left
+    at the path.
+    Arguments:
+        const char *path - the path of the socket
+        int backlog - the most connections waiting to be accepted
+    Return:
+        The listening socket; -1 if it could not be opened
+*/
+int listenUnix(const char *path, int backlog) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(addr.sun_path);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+    Connects to a Unix socket.
+    Arguments:
+        const char *path - the path of the socket
+    Return:
+        The connected socket; -1 if no one listens at the path
+*/
+int connectUnix(const char *path) {
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void onStop(int sig) {
+    stopRequested = 1;
+    if(stopHook) {
+        stopHook();
+    }
+}
+
+/*
+    Turns SIGINT and SIGTERM into a request to stop: they set stopRequested
+    and call the hook, which must be async-signal-safe. Blocking calls like
+    accept() return with EINTR, so their loops get to check the flag.
+    Arguments:
+        void (*hook)(void) - called from the handler; NULL for none
+*/
+void catchStopSignals(void (*hook)(void)) {
+    struct sigaction action;
+    stopHook = hook;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+}
@@ -0,0 +1,19 @@
+#ifndef sockets_h
+#define sockets_h
+
+#include <signal.h>
+
+/*
+    Helpers shared by the long running modes: the GDB stub, the fork
+    server, the job server and the fuzzer, and by the clients of the fork
+    server and the metrics socket.
+*/
+
+/* Set once SIGINT or SIGTERM arrives after catchStopSignals() */
+extern volatile sig_atomic_t stopRequested;
+
+int listenUnix(const char*, int);
+int connectUnix(const char*);
+void catchStopSignals(void (*)(void));
+
+#endif
@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# Runs the test programs on an emulator binary.
+#
+# The SMP tests run with the reference interpreter (-r) and with the
+# translation cache, and what each run prints is compared with the
+# expected output in <test>.out.
+#     counter.y86     - four CPUs each add 1 to a counter with xadd and to a
+#                       sum guarded by a cas spinlock, 100000 times; CPU 0
+#                       waits for the others and prints both, 400000
+#     xmc.y86         - cross-modifying code: CPU 1 calls a function that
+#                       returns 1, CPU 0 patches its immediate to 2 and
+#                       tells CPU 1 through xadd, CPU 1 calls it again and
+#                       must see the new code, printing 12
+#     atomicfault.y86 - CPU 1 runs a misaligned xadd while CPU 0 spins; the
+#                       fault stops both with ADR
+#     spin.y86        - CPU 0 spins and CPU 1 loops on xadd; the budget of
+#                       -n stops both with TMO
+#
+# The turbo tests run with -r and with --turbo, reading <test>.in if there
+# is one, without a budget and with budgets of 1, 7 and 1000 instructions.
+# The output and -s statistics of both must be the same. Most of them fail
+# verification or leave the verified code, and must still behave as with -r.
+#     unverified.y86  - enters its code through a pushl and ret the verifier
+#                       cannot follow, then calls a function that branches
+#                       on signed overflow
+#     badregister.y86 - an rrmovl naming register 15 after valid code; INS
+#     stackend.y86    - popl with %esp at the end of memory; ADR
+#     outside.y86     - readb to an address outside of memory; ADR
+#     misaligned.y86  - xadd on an address that is not 4 byte aligned; ADR
+#     stackincode.y86 - %esp points into the code, so the return address of
+#                       a call overwrites the instructions after it; ADR
+#     readover.y86    - echoes numbers and bytes read with readl and readb
+#                       into address 0, over its own first instruction
+#     smc.y86         - a 200000 iteration loop storing its counter into
+#                       the immediate of the irmovl it jumps back to
+#     smcread.y86     - readn reads 6 bytes over the jmp it runs next;
+#                       smcread.in holds an irmovl that runs instead
+# The fib benchmark kernel runs as well, also with a 16 byte --stack that
+# its calls soon leave.
+#
+# serve.py tests the job server of --serve with a client; it needs python3.
+#
+# Usage: run.sh [emulator]
+
+EMUL=${1:-./y86emul}
+DIR=$(dirname "$0")
+failed=0
+
+# expect <test> [options]
+expect() {
+    test=$1
+    shift
+    for engine in -r ""; do
+        if "$EMUL" $engine "$@" "$DIR/$test.y86" < /dev/null 2> /dev/null | cmp -s - "$DIR/$test.out"; then
+            echo "PASS $test ${engine:-blocks}"
+        else
+            echo "FAIL $test ${engine:-blocks}"
+            failed=1
+        fi
+    done
+}
+
+# same <test> [options]
+same() {
+    test=$1
+    shift
+    input=/dev/null
+    [ -f "$DIR/$test.in" ] && input=$DIR/$test.in
+    for budget in "" "-n 1" "-n 7" "-n 1000"; do
+        ref=$("$EMUL" -r -s $budget "$@" "$DIR/$test.y86" < "$input" 2> /dev/null)
+        out=$("$EMUL" --turbo -s $budget "$@" "$DIR/$test.y86" < "$input" 2> /dev/null)
+        if [ "$ref" = "$out" ]; then
+            echo "PASS $test --turbo $budget"
+        else
+            echo "FAIL $test --turbo $budget"
+            failed=1
+        fi
+    done
+}
+
+expect counter --cpus 4
+expect xmc --cpus 2
+expect atomicfault --cpus 2
+expect spin --cpus 2 -n 100000
+
+same unverified
+same unverified --stack f00:1000
+same badregister
+same stackend
+same outside
+same misaligned -x
+same stackincode
+same readover
+same smc
+same smcread -x
+same ../bench/fib
+same ../bench/fib --stack 7ff0:8000
+
+if command -v python3 > /dev/null; then
+    python3 "$DIR/serve.py" "$EMUL" || failed=1
+fi
+
+exit $failed
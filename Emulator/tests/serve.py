@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+#
+# Tests the job server of y86emul --serve as a client would use it. Starts a
+# server with two workers on a socket in a temporary directory and checks
+#     - path and image jobs print what direct runs of the programs print
+#     - a budget ends a job with TMO and a bad image with an error reply
+#     - a client submitting 3 jobs behind another client's 40 is served
+#       round robin, so its jobs finish before the other's first half
+# The protocol is described at the top of serve.c.
+#
+# Usage: serve.py [emulator]
+
+import os
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+EMUL = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else './y86emul')
+DIR = os.path.dirname(os.path.abspath(__file__))
+failed = False
+
+# A loop of 12M instructions
+HEAVY = b'.size 100\n.text 0 30f100093d0030f201000000630060106121740e00000010\n'
+# jmp 0
+FOREVER = b'.size 100\n.text 0 7000000000\n'
+
+
+def check(name, ok):
+    global failed
+    print('%s serve %s' % ('PASS' if ok else 'FAIL', name))
+    failed |= not ok
+
+
+def submit(sock, jid, budget, data, path=None, image=None):
+    if path:
+        head = b'job %s %d %d path %s\n' % (jid.encode(), budget, len(data), path.encode())
+    else:
+        head = b'job %s %d %d image %d\n' % (jid.encode(), budget, len(data), len(image)) + image
+    sock.sendall(head + data)
+
+
+def collect(sock, count):
+    """Reads the replies of count jobs; returns them by id, each with the time it ended."""
+    reader = sock.makefile('rb')
+    jobs = {}
+    ended = 0
+    while ended < count:
+        line = reader.readline()
+        if not line:
+            break
+        words = line.split()
+        job = jobs.setdefault(words[1].decode(), {'out': b'', 'metrics': b''})
+        if words[0] in (b'out', b'metrics'):
+            job[words[0].decode()] += reader.read(int(words[2]))
+        elif words[0] == b'status':
+            job['status'] = words[2].decode()
+            job['executed'] = int(words[3])
+            job['ended'] = time.time()
+            ended += 1
+        else:
+            job['error'] = line.decode()
+            job['ended'] = time.time()
+            ended += 1
+    return jobs
+
+
+def direct(program, data):
+    return subprocess.run([EMUL, program], input=data, stdout=subprocess.PIPE,
+                          stderr=subprocess.DEVNULL).stdout
+
+
+def same(job, program, data):
+    return 'status' in job and direct(program, data) == \
+        job['out'] + b'\nEnd Status: ' + job['status'].encode() + b'\n'
+
+
+def connect(path):
+    sock = socket.socket(socket.AF_UNIX)
+    sock.connect(path)
+    return sock
+
+
+tmp = tempfile.mkdtemp()
+path = os.path.join(tmp, 'serve.sock')
+server = subprocess.Popen([EMUL, '--serve', path, '--workers', '2'], stderr=subprocess.DEVNULL)
+for i in range(50):
+    if os.path.exists(path):
+        break
+    time.sleep(0.1)
+
+try:
+    prog2 = os.path.join(DIR, '..', 'prog2.y86')
+    readover = os.path.join(DIR, 'readover.y86')
+    readoverIn = open(os.path.join(DIR, 'readover.in'), 'rb').read()
+    sock = connect(path)
+    submit(sock, 'path', 0, b'5\n', path=prog2)
+    submit(sock, 'image', 0, readoverIn, image=open(readover, 'rb').read())
+    submit(sock, 'budget', 1000, b'', image=FOREVER)
+    submit(sock, 'bad', 0, b'', image=b'garbage')
+    jobs = collect(sock, 4)
+    sock.close()
+    check('path job', same(jobs['path'], prog2, b'5\n'))
+    check('path job metrics', b'y86_instructions_retired_total' in jobs['path']['metrics'])
+    check('image job', same(jobs['image'], readover, readoverIn))
+    check('budget', jobs['budget'].get('status') == 'TMO' and jobs['budget'].get('executed') == 1000)
+    check('bad image', 'error' in jobs['bad'])
+
+    # The big client's writes block once the server stops reading them, so
+    # its jobs are submitted and collected on threads of their own.
+    big = connect(path)
+    small = connect(path)
+    bigJobs = {}
+
+    def flood():
+        for i in range(40):
+            submit(big, 'big%d' % i, 0, b'', image=HEAVY)
+
+    writer = threading.Thread(target=flood)
+    reader = threading.Thread(target=lambda: bigJobs.update(collect(big, 40)))
+    writer.start()
+    reader.start()
+    time.sleep(0.2)
+    for i in range(3):
+        submit(small, 'small%d' % i, 0, b'', image=HEAVY)
+    smallDone = max(job['ended'] for job in collect(small, 3).values())
+    writer.join()
+    reader.join()
+    before = sum(1 for job in bigJobs.values() if job['ended'] < smallDone)
+    check('fairness, %d of 40 first' % before, len(bigJobs) == 40 and before < 20)
+    big.close()
+    small.close()
+finally:
+    server.send_signal(signal.SIGTERM)
+    server.wait()
+    check('socket removed', not os.path.exists(path))
+    os.rmdir(tmp)
+
+sys.exit(1 if failed else 0)
@@ -4,6 +4,7 @@
 
 struct TokenizerT_ {
     char *current;
+    int failed;     /* set once a token could not be allocated */
 };
 typedef struct TokenizerT_ TokenizerT;
 
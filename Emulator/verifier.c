@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "verifier.h"
+
+/*
+    What the traversal knows about each byte of memory.
+*/
+#define MAP_START 1     /* an instruction reached starts here */
+#define MAP_BODY  2     /* inside an instruction reached */
+
+typedef struct worklist_s {
+    int32_t *items;
+    size_t len;
+    size_t cap;
+} worklist_t;
+
+static int queue(worklist_t *work, int32_t addr) {
+    if(work->len == work->cap) {
+        size_t cap = work->cap ? work->cap * 2 : 64;
+        int32_t *items = realloc(work->items, cap * sizeof(int32_t));
+        if(!items) {
+            fprintf(stderr, "ERROR: Memory allocation failed\n");
+            return 0;
+        }
+        work->items = items;
+        work->cap = cap;
+    }
+    work->items[work->len++] = addr;
+    return 1;
+}
+
+/*
+    Reports why the program cannot run on the turbo interpreter.
+    Return:
+        0
+*/
+static int reject(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "WARNING: Verification failed, running with checks: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    return 0;
+}
+
+/*
+    Decodes every instruction reachable from the queued addresses and marks
+    its bytes in the map.
+    Return:
+        The number of instructions; 0 if one of them could not be verified
+*/
+static int32_t traverse(const machine_t *m, uint8_t *map, worklist_t *work) {
+    int32_t size = m->mem->size;
+    int32_t count = 0;
+    decoded_t in;
+    int32_t i;
+    while(work->len) {
+        int32_t addr = work->items[--work->len];
+        if((uint32_t)addr >= (uint32_t)size) {
+            return reject("control reaches 0x%X, outside of memory", addr);
+        }
+        if(map[addr] & MAP_START) {
+            continue;
+        }
+        if(map[addr] & MAP_BODY) {
+            return reject("control reaches 0x%X, inside another instruction", addr);
+        }
+        if(!decode(m, addr, &in)) {
+            return reject("the instruction at 0x%X does not decode", addr);
+        }
+        for(i = 1; i < in.length; i++) {
+            if(map[addr + i]) {
+                return reject("the instruction at 0x%X overlaps another one", addr);
+            }
+        }
+        map[addr] = MAP_START;
+        memset(map + addr + 1, MAP_BODY, in.length - 1);
+        count++;
+        int ok = 1;
+        switch(opFlows[in.opcode]) {
+            case FLOW_NEXT:
+                ok = queue(work, addr + in.length);
+            break;
+            case FLOW_JUMP:
+                ok = queue(work, in.val);
+            break;
+            case FLOW_BRANCH:
+            case FLOW_CALL:
+                ok = queue(work, in.val) && queue(work, addr + in.length);
+            break;
+        }
+        if(!ok) {
+            return 0;
+        }
+    }
+    return count;
+}
+
+/*
+    Checks the declared stack against the verified code.
+    Return:
+        1 if the stack fits; 0 otherwise
+*/
+static int checkStack(const machine_t *m, const verified_t *v) {
+    int32_t i;
+    if(v->stackLow < 0 || v->stackHigh > m->mem->size || v->stackHigh - v->stackLow < 4) {
+        return reject("the stack 0x%X-0x%X does not fit in memory", v->stackLow, v->stackHigh);
+    }
+    for(i = v->codeLow; i < v->codeHigh; i++) {
+        if(i >= v->stackLow && i < v->stackHigh && v->index[i - v->codeLow] != VERIFIED_NONE) {
+            return reject("the stack 0x%X-0x%X overlaps code at 0x%X", v->stackLow, v->stackHigh, i);
+        }
+    }
+    for(i = 0; i < v->count; i++) {
+        const tinsn_t *t = &v->insns[i];
+        if(opClasses[t->in.opcode] == CLASS_MOV && opFns[t->in.opcode] == IR && t->in.rB == ESP &&
+           (t->in.val < v->stackLow || t->in.val > v->stackHigh)) {
+            return reject("the instruction at 0x%X points %%esp at 0x%X, outside of the stack 0x%X-0x%X",
+                          t->addr, t->in.val, v->stackLow, v->stackHigh);
+        }
+    }
+    return 1;
+}
+
+static int32_t indexOf(const verified_t *v, int32_t addr) {
+    const tinsn_t *t = findVerified(v, addr);
+    return t ? (int32_t)(t - v->insns) : -1;
+}
+
+/*
+    Builds the proof from the map of the instructions reached.
+    Return:
+        The proof; NULL if it could not be allocated
+*/
+static verified_t *collect(const machine_t *m, const uint8_t *map, int32_t count) {
+    int32_t size = m->mem->size;
+    int32_t low = 0;
+    int32_t high = size;
+    int32_t addr;
+    int32_t n = 0;
+    while(!map[low]) {
+        low++;
+    }
+    while(!map[high - 1]) {
+        high--;
+    }
+    verified_t *v = calloc(1, sizeof(verified_t));
+    if(!v || !(v->index = malloc((high - low) * sizeof(int32_t))) ||
+       !(v->insns = malloc(count * sizeof(tinsn_t)))) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        freeVerified(v);
+        return NULL;
+    }
+    v->codeLow = low;
+    v->codeHigh = high;
+    v->count = count;
+    v->extensions = m->extensions;
+    v->valid = 1;
+    for(addr = low; addr < high; addr++) {
+        if(map[addr] & MAP_START) {
+            v->index[addr - low] = n;
+            decode(m, addr, &v->insns[n].in);
+            v->insns[n].addr = addr;
+            n++;
+        } else {
+            v->index[addr - low] = map[addr] ? VERIFIED_BODY : VERIFIED_NONE;
+        }
+    }
+    for(n = 0; n < count; n++) {
+        tinsn_t *t = &v->insns[n];
+        uint8_t flow = opFlows[t->in.opcode];
+        t->next = indexOf(v, t->addr + t->in.length);
+        t->target = flow == FLOW_JUMP || flow == FLOW_BRANCH || flow == FLOW_CALL ? indexOf(v, t->in.val) : -1;
+    }
+    for(n = count - 1; n >= 0; n--) {
+        tinsn_t *t = &v->insns[n];
+        t->run = opFlows[t->in.opcode] == FLOW_NEXT && t->next >= 0 ? v->insns[t->next].run + 1 : 1;
+    }
+    return v;
+}
+
+/*
+    Verifies the program loaded into a machine for the turbo interpreter,
+    as described in verifier.h, and flags the pages holding the verified
+    code so that stores into them reach forgetVerified().
+    Arguments:
+        const machine_t *m - the machine, with the program loaded and the
+                             extensions it runs with enabled
+        int32_t stackLow - the lowest address of the stack
+        int32_t stackHigh - the address above the stack; 0 for a stack
+                            from the end of the code to the end of memory
+    Return:
+        The proof; NULL if the program failed verification, after saying
+        why on stderr
+*/
+verified_t *verifyProgram(const machine_t *m, int32_t stackLow, int32_t stackHigh) {
+    int32_t size = m->mem->size;
+    uint8_t *map = calloc(size ? size : 1, 1);
+    worklist_t work = { NULL, 0, 0 };
+    verified_t *v = NULL;
+    uint32_t page;
+    if(!map) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return NULL;
+    }
+    int32_t count = queue(&work, m->cpu.ipointer) ? traverse(m, map, &work) : 0;
+    if(count) {
+        v = collect(m, map, count);
+    }
+    free(map);
+    free(work.items);
+    if(!v) {
+        return NULL;
+    }
+    v->stackLow = stackHigh ? stackLow : v->codeHigh;
+    v->stackHigh = stackHigh ? stackHigh : size;
+    if(!checkStack(m, v)) {
+        freeVerified(v);
+        return NULL;
+    }
+    for(page = PAGE_OF(v->codeLow); page <= PAGE_OF(v->codeHigh - 1); page++) {
+        __atomic_or_fetch(&m->mem->flags[page], PAGE_VERIFIED, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+
+void freeVerified(verified_t *v) {
+    if(!v) {
+        return;
+    }
+    free(v->index);
+    free(v->insns);
+    free(v);
+}
+
+/*
+    Drops the proof of the machine if the len bytes at addr overlap
+    verified code; the program goes on with checks from then on.
+*/
+void forgetVerified(machine_t *m, int32_t addr, int32_t len) {
+    verified_t *v = m->verified;
+    int32_t i;
+    uint32_t page;
+    if(!v || !v->valid) {
+        return;
+    }
+    for(i = addr; i < addr + len; i++) {
+        if(i >= v->codeLow && i < v->codeHigh && v->index[i - v->codeLow] != VERIFIED_NONE) {
+            v->valid = 0;
+            break;
+        }
+    }
+    if(!v->valid) {
+        for(page = PAGE_OF(v->codeLow); page <= PAGE_OF(v->codeHigh - 1); page++) {
+            __atomic_and_fetch(&m->mem->flags[page], (uint8_t)~PAGE_VERIFIED, __ATOMIC_RELAXED);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef verifier_h
+#define verifier_h
+
+#include <stdint.h>
+
+#include "machine.h"
+
+/*
+    Load time verification for the turbo interpreter. The verifier follows
+    the control flow of the loaded program from the instruction pointer,
+    through fall-through, jXX and call edges and to the return address of
+    every call, and proves that
+        - every instruction reached decodes, naming only existing registers,
+        - every direct jXX and call destination lies inside memory and on
+          the first byte of an instruction reached, so no two instructions
+          overlap,
+        - every irmovl to %esp points into the stack, a range declared by
+          the caller that lies inside memory and holds no code.
+    A program that passes runs on the turbo interpreter: instructions are
+    decoded once, here, and the interpreter goes from one to the next
+    without fetching, decoding or bounds checking jump destinations. pushl,
+    popl, call and ret only compare %esp against the stack instead of
+    checking the access against memory. What the proof cannot cover is
+    checked where it happens and leaves the turbo interpreter for the
+    checked one, with the same outcome: a ret to an address that was not
+    verified, a stack access outside of the stack, or a store into
+    verified code, which drops the proof for good.
+*/
+
+/*
+    A verified instruction and the ones it continues at.
+*/
+typedef struct tinsn_s {
+    decoded_t in;
+    int32_t addr;
+    int32_t next;       /* index of the following instruction; -1 if it is not verified */
+    int32_t target;     /* index of the destination of jXX and call; -1 otherwise */
+    int32_t run;        /* instructions from this one through the next one that does
+                           not fall through, which the turbo interpreter runs between
+                           checking its limits */
+} tinsn_t;
+
+/*
+    The proof for a loaded program.
+*/
+typedef struct verified_s {
+    int32_t codeLow;        /* the verified instructions lie in [codeLow, codeHigh) */
+    int32_t codeHigh;
+    int32_t *index;         /* per byte of that range: the instruction starting there,
+                               VERIFIED_BODY inside one, VERIFIED_NONE outside */
+    tinsn_t *insns;         /* in address order */
+    int32_t count;
+    int32_t stackLow;       /* the stack is [stackLow, stackHigh) */
+    int32_t stackHigh;
+    int extensions;         /* the proof assumed the extension instructions */
+    int valid;              /* cleared once verified code is overwritten */
+} verified_t;
+
+#define VERIFIED_NONE -1
+#define VERIFIED_BODY -2
+
+verified_t *verifyProgram(const machine_t*, int32_t, int32_t);
+void freeVerified(verified_t*);
+void forgetVerified(machine_t*, int32_t, int32_t);
+
+/*
+    Return:
+        The verified instruction starting at addr; NULL if there is none.
+*/
+static inline const tinsn_t *findVerified(const verified_t *v, int32_t addr) {
+    uint32_t offset = (uint32_t)addr - (uint32_t)v->codeLow;
+    if(offset >= (uint32_t)(v->codeHigh - v->codeLow) || v->index[offset] < 0) {
+        return NULL;
+    }
+    return &v->insns[v->index[offset]];
+}
+
+/*
+    Return:
+        1 if the 4 bytes at addr lie inside the stack; 0 otherwise
+*/
+static inline int inStack(const verified_t *v, int32_t addr) {
+    return (uint32_t)addr - (uint32_t)v->stackLow <= (uint32_t)(v->stackHigh - v->stackLow - 4);
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "loader.h"
+#include "machine.h"
+#include "verifier.h"
+
+/*
+    The embedding interface is a thin layer over the machine. Its statuses
+    and stop reasons are in the same order as status_t and the STOP_ reasons.
+*/
+
+y86_t *y86Create() {
+    return createMachine();
+}
+
+void y86Destroy(y86_t *m) {
+    destroyMachine(m);
+}
+
+/*
+    Loads a program from the text of a .y86 file held in memory.
+    Return:
+        1 if the program was loaded; 0 otherwise
+*/
+int y86LoadProgram(y86_t *m, const char *program) {
+    int loaded = loadProgram(m, program);
+    resetMetrics(&m->metrics);
+    return loaded;
+}
+
+int y86LoadFile(y86_t *m, const char *fileName) {
+    int loaded = loadFileIntoMemory(m, fileName);
+    resetMetrics(&m->metrics);
+    return loaded;
+}
+
+/*
+    Gives the machine an empty memory of the given size, for callers that
+    place raw code with y86WriteMemory and set Y86_PC themselves.
+*/
+int y86Reset(y86_t *m, int32_t memorySize) {
+    return initialize(m, memorySize);
+}
+
+/*
+    Replaces stdin, stdout and the diagnostics printed on stdout with the
+    given callbacks. A NULL callback keeps the current one. Replacing the
+    input or the output drops the block callback of the same direction, so
+    that readn and writen go through the new one.
+*/
+void y86SetIO(y86_t *m, y86_input_t input, y86_output_t output, y86_message_t message, void *user) {
+    if(input) {
+        m->input = input;
+        m->readBlock = NULL;
+    }
+    if(output) {
+        m->output = output;
+        m->writeBlock = NULL;
+    }
+    if(message) {
+        m->message = message;
+    }
+    m->user = user;
+}
+
+/*
+    Sets the block I/O callbacks of readn and writen; they get the user
+    pointer of y86SetIO. NULL makes them use the byte callbacks.
+*/
+void y86SetBlockIO(y86_t *m, y86_read_t readBlock, y86_write_t writeBlock) {
+    m->readBlock = readBlock;
+    m->writeBlock = writeBlock;
+}
+
+void y86EnableExtensions(y86_t *m, int enabled) {
+    m->extensions = enabled;
+}
+
+/*
+    Verifies the loaded program for the turbo interpreter, with the
+    extensions as currently enabled, and replaces the previous proof.
+    Runs use the turbo interpreter while the proof holds. A stackHigh of
+    0 declares the stack to run from the end of the code to the end of
+    memory.
+    Return:
+        1 if the program passed; 0 if it runs with checks
+*/
+int y86Verify(y86_t *m, int32_t stackLow, int32_t stackHigh) {
+    freeVerified(m->verified);
+    m->verified = verifyProgram(m, stackLow, stackHigh);
+    return m->verified != NULL;
+}
+
+void y86UseReference(y86_t *m, int reference) {
+    m->reference = reference;
+}
+
+void y86SetBudget(y86_t *m, uint64_t instructions, int32_t milliseconds) {
+    setBudget(m, instructions, milliseconds);
+}
+
+int y86Run(y86_t *m, uint64_t count) {
+    return run(m, count);
+}
+
+int y86Step(y86_t *m) {
+    return run(m, 1);
+}
+
+void y86Interrupt(y86_t *m) {
+    interruptMachine(m);
+}
+
+int y86Status(const y86_t *m) {
+    return m->status;
+}
+
+const char *y86StatusName(int status) {
+    static const char *names[] = {
+        [AOK] = "AOK", [HLT] = "HLT", [ADR] = "ADR", [INS] = "INS", [TMO] = "TMO", [DBG] = "DBG"
+    };
+    if(status < 0 || status >= (int)(sizeof(names) / sizeof(names[0]))) {
+        return "???";
+    }
+    return names[status];
+}
+
+uint64_t y86Executed(const y86_t *m) {
+    return m->executed;
+}
+
+int32_t y86GetRegister(const y86_t *m, int reg) {
+    if(reg == Y86_PC) {
+        return m->cpu.ipointer;
+    }
+    return (reg >= 0 && reg < NUM_REGISTERS) ? m->cpu.registers[reg] : 0;
+}
+
+void y86SetRegister(y86_t *m, int reg, int32_t value) {
+    if(reg == Y86_PC) {
+        m->cpu.ipointer = value;
+    } else if(reg >= 0 && reg < NUM_REGISTERS) {
+        m->cpu.registers[reg] = value;
+    }
+}
+
+int y86GetFlags(const y86_t *m) {
+    return (m->cpu.ZF ? Y86_ZF : 0) | (m->cpu.SF ? Y86_SF : 0) | (m->cpu.OF ? Y86_OF : 0);
+}
+
+void y86SetFlags(y86_t *m, int flags) {
+    m->cpu.ZF = (flags & Y86_ZF) != 0;
+    m->cpu.SF = (flags & Y86_SF) != 0;
+    m->cpu.OF = (flags & Y86_OF) != 0;
+}
+
+int32_t y86MemorySize(const y86_t *m) {
+    return m->mem->size;
+}
+
+static int inMemory(const y86_t *m, int32_t addr, int32_t len) {
+    int32_t size = m->mem->size;
+    return len >= 0 && (uint32_t)addr <= (uint32_t)size && (uint32_t)(size - addr) >= (uint32_t)len;
+}
+
+int y86ReadMemory(y86_t *m, int32_t addr, void *buf, int32_t len) {
+    int32_t i;
+    if(!inMemory(m, addr, len)) {
+        return 0;
+    }
+    for(i = 0; i < len; i++) {
+        ((uint8_t*)buf)[i] = readByte(m->mem, addr + i);
+    }
+    return 1;
+}
+
+/*
+    Writes guest memory. Translated code overlapping the bytes is dropped,
+    just like for stores made by the guest.
+*/
+int y86WriteMemory(y86_t *m, int32_t addr, const void *buf, int32_t len) {
+    int32_t i;
+    if(!inMemory(m, addr, len)) {
+        return 0;
+    }
+    for(i = 0; i < len; i++) {
+        if(!writeByte(m->mem, addr + i, ((const uint8_t*)buf)[i])) {
+            break;
+        }
+    }
+    if(len && m->cache) {
+        invalidateCode(m->cache, addr, len);
+        releaseInvalidated(m->cache);
+    }
+    forgetVerified(m, addr, len);
+    return i == len;
+}
+
+int y86AddBreakpoint(y86_t *m, int32_t addr) {
+    return addBreakpoint(m, addr);
+}
+
+int y86RemoveBreakpoint(y86_t *m, int32_t addr) {
+    return removeBreakpoint(m, addr);
+}
+
+int y86AddWatchpoint(y86_t *m, int32_t addr, int32_t len) {
+    return addWatchpoint(m, addr, len);
+}
+
+int y86RemoveWatchpoint(y86_t *m, int32_t addr) {
+    return removeWatchpoint(m, addr);
+}
+
+/*
+    Return:
+        The address of the store that made the last run stop with
+        Y86_WATCHPOINT.
+*/
+int32_t y86WatchAddress(const y86_t *m) {
+    return m->watchAddr;
+}
+
+void y86WriteMetrics(const y86_t *m, FILE *out) {
+    writeMetrics(out, &m->metrics);
+}
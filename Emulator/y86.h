@@ -0,0 +1,112 @@
+#ifndef y86_h
+#define y86_h
+
+/*
+    Embedding interface of the emulator. Each y86_t is an independent guest
+    with its own registers, memory and translation cache; a guest must only
+    be used by one thread at a time, but different guests may run in
+    parallel. Link with liby86emul.a and -lpthread.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct machine_s y86_t;
+
+/* Machine status, as returned by y86Status */
+enum { Y86_AOK, Y86_HLT, Y86_ADR, Y86_INS, Y86_TMO };
+
+/* Reasons for y86Run to return */
+enum { Y86_STOPPED, Y86_BREAKPOINT, Y86_LIMIT, Y86_WATCHPOINT, Y86_INTERRUPTED };
+
+/* Register numbers for y86GetRegister and y86SetRegister */
+enum { Y86_EAX, Y86_ECX, Y86_EDX, Y86_EBX, Y86_ESP, Y86_EBP, Y86_ESI, Y86_EDI, Y86_PC };
+
+/* Condition flags for y86GetFlags and y86SetFlags */
+#define Y86_ZF 0x1
+#define Y86_SF 0x2
+#define Y86_OF 0x4
+
+/*
+    I/O callbacks replacing stdin and stdout. size is 1 for readb/writeb
+    and 4 for readl/writel.
+    y86_input_t   - stores the value read and returns the number of input
+                    bytes it consumed, or a negative number at end of input
+    y86_output_t  - returns the number of output bytes produced
+    y86_message_t - receives diagnostics such as out of bound accesses
+*/
+typedef int (*y86_input_t)(void *user, int size, int32_t *value);
+typedef int (*y86_output_t)(void *user, int size, int32_t value);
+typedef void (*y86_message_t)(void *user, const char *text);
+
+/*
+    Block I/O callbacks for the extension instructions readn and writen.
+    Without them, readn and writen go through the callbacks above one byte
+    at a time.
+    y86_read_t  - reads up to len bytes into buf and returns the number
+                  read, fewer than len only at end of input
+    y86_write_t - writes the len bytes in buf and returns the number of
+                  output bytes produced
+*/
+typedef int32_t (*y86_read_t)(void *user, void *buf, int32_t len);
+typedef int32_t (*y86_write_t)(void *user, const void *buf, int32_t len);
+
+y86_t *y86Create(void);
+void y86Destroy(y86_t*);
+
+/* Loading replaces memory and resets the machine; 1 on success */
+int y86LoadProgram(y86_t*, const char *program);
+int y86LoadFile(y86_t*, const char *fileName);
+int y86Reset(y86_t*, int32_t memorySize);
+
+void y86SetIO(y86_t*, y86_input_t, y86_output_t, y86_message_t, void *user);
+void y86SetBlockIO(y86_t*, y86_read_t, y86_write_t);
+/* Accepts the extension instructions (readn, writen, cas, xadd, spawn);
+   off by default. Guests run this way have one CPU, so spawn fails. */
+void y86EnableExtensions(y86_t*, int);
+/* Proves the loaded program safe to run without runtime checks, with the
+   stack in [stackLow, stackHigh); 1 if it passed. Loading drops the proof. */
+int y86Verify(y86_t*, int32_t stackLow, int32_t stackHigh);
+void y86UseReference(y86_t*, int);
+void y86SetBudget(y86_t*, uint64_t instructions, int32_t milliseconds);
+
+/* Runs up to count instructions (0 for no limit); returns a Y86_ reason */
+int y86Run(y86_t*, uint64_t count);
+int y86Step(y86_t*);
+/* Makes the run return Y86_INTERRUPTED soon; safe in signal handlers */
+void y86Interrupt(y86_t*);
+int y86Status(const y86_t*);
+/* The name of a status, like "HLT"; "???" for a number that is none */
+const char *y86StatusName(int);
+uint64_t y86Executed(const y86_t*);
+
+int32_t y86GetRegister(const y86_t*, int reg);
+void y86SetRegister(y86_t*, int reg, int32_t value);
+int y86GetFlags(const y86_t*);
+void y86SetFlags(y86_t*, int flags);
+
+/* Memory access; 1 on success, 0 if the range is out of bounds or a
+   written page could not be allocated */
+int32_t y86MemorySize(const y86_t*);
+int y86ReadMemory(y86_t*, int32_t addr, void *buf, int32_t len);
+int y86WriteMemory(y86_t*, int32_t addr, const void *buf, int32_t len);
+
+int y86AddBreakpoint(y86_t*, int32_t addr);
+int y86RemoveBreakpoint(y86_t*, int32_t addr);
+
+/* Stops runs after instructions that store into [addr, addr + len) */
+int y86AddWatchpoint(y86_t*, int32_t addr, int32_t len);
+int y86RemoveWatchpoint(y86_t*, int32_t addr);
+int32_t y86WatchAddress(const y86_t*);
+
+void y86WriteMetrics(const y86_t*, FILE*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,30 +1,385 @@
-#include "loader.h"
-#include "architecture.h"
+#include "y86.h"
+#include "machine.h"
+#include "debugger.h"
+#include "gdbstub.h"
+#include "profiler.h"
+#include "forkserver.h"
+#include "serve.h"
+#include "lockstep.h"
+#include "fuzzer.h"
+#include "gang.h"
+#include "smp.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+/*
+    What the fork server needs to start each job over.
+*/
+typedef struct job_s {
+    uint64_t budget;
+    int32_t timeout;
+    int stats;
+} job_t;
+
+/*
+    Runs the guest until it stops or is interrupted, reporting breakpoints
+    and watchpoints on the way.
+*/
+static void runGuest(y86_t *guest, profiler_t *profiler) {
+    int stop;
+    while((stop = profiler ? profileRun(profiler, guest) : y86Run(guest, 0)) != Y86_STOPPED &&
+          stop != Y86_INTERRUPTED) {
+        reportStop(guest, stop);
+        printRegisters(guest);
+    }
+}
+
+static void printEndStatus(const y86_t *guest, int stats) {
+    printf("\nEnd Status: %s\n", y86StatusName(y86Status(guest)));
+    if(stats) {
+        y86WriteMetrics(guest, stdout);
+    }
+}
+
+/*
+    Runs a job in a child of the fork server. The budget counts from the
+    start of the job rather than from when the image was loaded.
+*/
+static void runJob(y86_t *guest, void *arg) {
+    const job_t *job = arg;
+    y86SetBudget(guest, job->budget, job->timeout);
+    runGuest(guest, NULL);
+    printEndStatus(guest, job->stats);
+}
+
+static void usage() {
+    printf("Usage: y86emul [options] <inputfile>\n");
+    printf("Options:\n");
+    printf("    -r              run on the reference interpreter instead of translated blocks\n");
+    printf("    -x              accept the extension instructions readn, writen, cas,\n");
+    printf("                    xadd and spawn\n");
+    printf("    -s              print execution statistics after the end status\n");
+    printf("    -m <target>     dump statistics periodically to a file, or to a Unix\n");
+    printf("                    socket given as unix:<path>\n");
+    printf("    -mi <ms>        milliseconds between dumps (default 1000)\n");
+    printf("    -n <count>      stop with status TMO after this many instructions\n");
+    printf("    -t <ms>         stop with status TMO after this much wall clock time\n");
+    printf("    -b <hexaddr>    report the registers each time execution reaches the address\n");
+    printf("    -w <hexaddr>    report stores into the 4 bytes at the address\n");
+    printf("    -d              run under the interactive debugger\n");
+    printf("    --gdb <port>    wait for GDB on a localhost port, or on unix:<path>\n");
+    printf("    -p <file>       write sampled guest call stacks to the file as folded stacks\n");
+    printf("    -pi <count>     instructions between samples (default 10000)\n");
+    printf("    -pt <ms>        sample every ms milliseconds of CPU time instead\n");
+    printf("    -y <file>       name profiled functions from a symbol file of\n");
+    printf("                    <hexaddr> <name> lines\n");
+    printf("    --fork-server <path>\n");
+    printf("                    load the program once, then run it for every job\n");
+    printf("                    submitted on the Unix socket, each in a forked child\n");
+    printf("    --job <path>    run a job on a fork server with this process's\n");
+    printf("                    stdin and stdout; takes no other options, as the\n");
+    printf("                    program, -n, -t and -s come from the server's\n");
+    printf("                    command line\n");
+    printf("    --serve <path>  run jobs sent to the Unix socket on a pool of workers;\n");
+    printf("                    -n and -t limit every job; no input file is needed\n");
+    printf("    --workers <n>   number of workers (default: one per processor)\n");
+    printf("    --queue <n>     most jobs waiting before clients are held back (default 64)\n");
+    printf("    --lockstep      run the program on translated blocks and on the reference\n");
+    printf("                    interpreter side by side, stopping at the first block\n");
+    printf("                    where they disagree\n");
+    printf("    --fuzz <dir>    fuzz the program in-process, mutating its input and writing\n");
+    printf("                    inputs that reach new edges, crash or hang to the directory;\n");
+    printf("                    -n limits each run (default 100000 instructions)\n");
+    printf("    --fuzz-seed <file>\n");
+    printf("                    start from the input in the file; may be repeated\n");
+    printf("    --fuzz-runs <n> stop after n runs instead of at SIGINT\n");
+    printf("    --fuzz-image    mutate the loaded program as well\n");
+    printf("    --gang <file>   run the program once for every input file listed in the\n");
+    printf("                    file, several guests at a time in lockstep; the output\n");
+    printf("                    of each goes to the input file name with .out appended;\n");
+    printf("                    -n limits each guest (default 100000 instructions)\n");
+    printf("    --gang-width <n>\n");
+    printf("                    most guests in lockstep (default and at most %d)\n", GANG_WIDTH);
+    printf("    --cpus <n>      run the program on n CPUs sharing its memory (at most %d);\n", SMP_MAX_CPUS);
+    printf("                    the guest starts them with spawn; implies -x, and -n\n");
+    printf("                    and -t limit each CPU\n");
+    printf("    --turbo         verify the program when it is loaded and, if it passes,\n");
+    printf("                    run it on the turbo interpreter, which leaves out the\n");
+    printf("                    checks the verifier proved unnecessary\n");
+    printf("    --stack <hexlo>:<hexhi>\n");
+    printf("                    the stack the program keeps %%esp in for --turbo\n");
+    printf("                    (default: from the end of the code to the end of\n");
+    printf("                    memory); implies --turbo\n");
+}
 
 int main(int argc, char **argv) {
     if(argc < 2) {
         fprintf(stderr, "ERROR: Must have at least one argument\n");
         return 1;
     }
-    if(strcmp("-h", argv[1]) == 0) {
-        printf("Usage: y86emul <inputfile>\n");
-        return 0;
+    int reference = 0;
+    int extensions = 0;
+    int stats = 0;
+    char *metricsTarget = NULL;
+    int metricsInterval = 1000;
+    uint64_t budget = 0;
+    int32_t timeout = 0;
+    int debug = 0;
+    char *gdbTarget = NULL;
+    char *profileFile = NULL;
+    uint64_t profileEvery = 0;
+    int profileTimer = 0;
+    char *symbolFile = NULL;
+    profiler_t *profiler = NULL;
+    char *forkTarget = NULL;
+    char *jobTarget = NULL;
+    char *serveTarget = NULL;
+    int lockstep = 0;
+    char *gangList = NULL;
+    int gangWidth = GANG_WIDTH;
+    int cpus = 0;
+    int turbo = 0;
+    int32_t stackLow = 0;
+    int32_t stackHigh = 0;
+    fuzzconfig_t fuzz = { NULL, NULL, 0, 0, 0, 0 };
+    char *seeds[argc];
+    int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int queueLimit = 64;
+    int32_t breakpoints[argc];
+    int32_t watchpoints[argc];
+    int numBreakpoints = 0;
+    int numWatchpoints = 0;
+    char *fileName = NULL;
+    int i;
+    for(i = 1; i < argc; i++) {
+        if(strcmp("-h", argv[i]) == 0) {
+            usage();
+            return 0;
+        } else if(strcmp("-r", argv[i]) == 0) {
+            reference = 1;
+        } else if(strcmp("-x", argv[i]) == 0) {
+            extensions = 1;
+        } else if(strcmp("-s", argv[i]) == 0) {
+            stats = 1;
+        } else if(strcmp("-m", argv[i]) == 0 && i + 1 < argc) {
+            metricsTarget = argv[++i];
+        } else if(strcmp("-mi", argv[i]) == 0 && i + 1 < argc) {
+            metricsInterval = atoi(argv[++i]);
+        } else if(strcmp("-n", argv[i]) == 0 && i + 1 < argc) {
+            budget = strtoull(argv[++i], NULL, 0);
+        } else if(strcmp("-t", argv[i]) == 0 && i + 1 < argc) {
+            timeout = atoi(argv[++i]);
+        } else if(strcmp("-b", argv[i]) == 0 && i + 1 < argc) {
+            breakpoints[numBreakpoints++] = (int32_t)strtol(argv[++i], NULL, 16);
+        } else if(strcmp("-w", argv[i]) == 0 && i + 1 < argc) {
+            watchpoints[numWatchpoints++] = (int32_t)strtol(argv[++i], NULL, 16);
+        } else if(strcmp("-d", argv[i]) == 0) {
+            debug = 1;
+        } else if(strcmp("--gdb", argv[i]) == 0 && i + 1 < argc) {
+            gdbTarget = argv[++i];
+        } else if(strcmp("--fork-server", argv[i]) == 0 && i + 1 < argc) {
+            forkTarget = argv[++i];
+        } else if(strcmp("--job", argv[i]) == 0 && i + 1 < argc) {
+            jobTarget = argv[++i];
+        } else if(strcmp("--serve", argv[i]) == 0 && i + 1 < argc) {
+            serveTarget = argv[++i];
+        } else if(strcmp("--lockstep", argv[i]) == 0) {
+            lockstep = 1;
+        } else if(strcmp("--fuzz", argv[i]) == 0 && i + 1 < argc) {
+            fuzz.outDir = argv[++i];
+        } else if(strcmp("--fuzz-seed", argv[i]) == 0 && i + 1 < argc) {
+            seeds[fuzz.numSeeds++] = argv[++i];
+        } else if(strcmp("--fuzz-runs", argv[i]) == 0 && i + 1 < argc) {
+            fuzz.runs = strtoull(argv[++i], NULL, 0);
+        } else if(strcmp("--fuzz-image", argv[i]) == 0) {
+            fuzz.mutateImage = 1;
+        } else if(strcmp("--gang", argv[i]) == 0 && i + 1 < argc) {
+            gangList = argv[++i];
+        } else if(strcmp("--gang-width", argv[i]) == 0 && i + 1 < argc) {
+            gangWidth = atoi(argv[++i]);
+        } else if(strcmp("--cpus", argv[i]) == 0 && i + 1 < argc) {
+            cpus = atoi(argv[++i]);
+        } else if(strcmp("--turbo", argv[i]) == 0) {
+            turbo = 1;
+        } else if(strcmp("--stack", argv[i]) == 0 && i + 1 < argc) {
+            char *end;
+            stackLow = (int32_t)strtol(argv[++i], &end, 16);
+            if(*end != ':') {
+                fprintf(stderr, "ERROR: --stack takes <hexlo>:<hexhi>\n");
+                return 1;
+            }
+            stackHigh = (int32_t)strtol(end + 1, NULL, 16);
+            turbo = 1;
+        } else if(strcmp("--workers", argv[i]) == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if(strcmp("--queue", argv[i]) == 0 && i + 1 < argc) {
+            queueLimit = atoi(argv[++i]);
+        } else if(strcmp("-p", argv[i]) == 0 && i + 1 < argc) {
+            profileFile = argv[++i];
+        } else if(strcmp("-pi", argv[i]) == 0 && i + 1 < argc) {
+            profileEvery = strtoull(argv[++i], NULL, 0);
+        } else if(strcmp("-pt", argv[i]) == 0 && i + 1 < argc) {
+            profileTimer = atoi(argv[++i]);
+        } else if(strcmp("-y", argv[i]) == 0 && i + 1 < argc) {
+            symbolFile = argv[++i];
+        } else {
+            fileName = argv[i];
+        }
+    }
+    if(jobTarget) {
+        /* The job runs as the server was told to run it */
+        if(argc != 3) {
+            fprintf(stderr, "ERROR: --job takes no other options; the fork server's command line sets them\n");
+            return 1;
+        }
+        return submitJob(jobTarget) ? 0 : 1;
+    }
+    if(serveTarget) {
+        if(workers < 1 || queueLimit < 1) {
+            fprintf(stderr, "ERROR: --workers and --queue must be at least 1\n");
+            return 1;
+        }
+        return serveJobs(serveTarget, workers, queueLimit, budget, timeout, extensions) ? 0 : 1;
+    }
+    if(!fileName) {
+        fprintf(stderr, "ERROR: No input file given\n");
+        return 1;
+    }
+    if(forkTarget && (profileFile || debug || gdbTarget)) {
+        fprintf(stderr, "ERROR: --fork-server cannot be combined with -p, -d or --gdb\n");
+        return 1;
+    }
+    if(lockstep && (profileFile || debug || gdbTarget || forkTarget || numBreakpoints || numWatchpoints)) {
+        fprintf(stderr, "ERROR: --lockstep cannot be combined with -p, -d, -b, -w, --gdb or --fork-server\n");
+        return 1;
     }
-	if(!loadFileIntoMemory(argv[1])) {
+    if(fuzz.outDir && (lockstep || profileFile || debug || gdbTarget || forkTarget || numBreakpoints || numWatchpoints)) {
+        fprintf(stderr, "ERROR: --fuzz cannot be combined with --lockstep, -p, -d, -b, -w, --gdb or --fork-server\n");
         return 1;
     }
-    status_t stat = execute();
-    char *status;
-    if(stat == HLT) {
-        status = "HLT";
-    } else if(stat == ADR) {
-        status = "ADR";
-    } else if(stat == INS) {
-        status = "INS";
+    if(turbo && (gangList || fuzz.outDir || lockstep || cpus)) {
+        fprintf(stderr, "ERROR: --turbo cannot be combined with --gang, --fuzz, --lockstep or --cpus\n");
+        return 1;
+    }
+    if(cpus) {
+        if(gangList || fuzz.outDir || lockstep || profileFile || debug || gdbTarget || forkTarget || numBreakpoints || numWatchpoints) {
+            fprintf(stderr, "ERROR: --cpus cannot be combined with --gang, --fuzz, --lockstep, -p, -d, -b, -w, --gdb or --fork-server\n");
+            return 1;
+        }
+        if(cpus < 1 || cpus > SMP_MAX_CPUS) {
+            fprintf(stderr, "ERROR: --cpus must be between 1 and %d\n", SMP_MAX_CPUS);
+            return 1;
+        }
+        extensions = 1;
+    }
+    if(gangList) {
+        if(fuzz.outDir || lockstep || profileFile || debug || gdbTarget || forkTarget || numBreakpoints || numWatchpoints) {
+            fprintf(stderr, "ERROR: --gang cannot be combined with --fuzz, --lockstep, -p, -d, -b, -w, --gdb or --fork-server\n");
+            return 1;
+        }
+        if(gangWidth < 1 || gangWidth > GANG_WIDTH) {
+            fprintf(stderr, "ERROR: --gang-width must be between 1 and %d\n", GANG_WIDTH);
+            return 1;
+        }
+        /* A guest that never stops would hold up the whole sweep */
+        return runInputSweep(fileName, gangList, gangWidth, budget ? budget : 100000, extensions) ? 0 : 1;
+    }
+    y86_t *guest = y86Create();
+    if(!guest) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 1;
+    }
+	if(!y86LoadFile(guest, fileName)) {
+        y86Destroy(guest);
+        return 1;
+    }
+    y86UseReference(guest, reference);
+    y86EnableExtensions(guest, extensions);
+    y86SetBudget(guest, budget, timeout);
+    if(turbo) {
+        y86Verify(guest, stackLow, stackHigh);
+    }
+    if(metricsTarget && !startMetricsDump(&guest->metrics, metricsTarget, metricsInterval)) {
+        fprintf(stderr, "ERROR: Could not start the statistics dump\n");
+        y86Destroy(guest);
+        return 1;
+    }
+    if(profileFile) {
+        if(!profileEvery && !profileTimer) {
+            profileEvery = 10000;
+        }
+        if(!(profiler = createProfiler(profileEvery, profileTimer, symbolFile))) {
+            fprintf(stderr, "ERROR: Could not start the profiler\n");
+            y86Destroy(guest);
+            return 1;
+        }
+    }
+    for(i = 0; i < numBreakpoints; i++) {
+        y86AddBreakpoint(guest, breakpoints[i]);
+    }
+    for(i = 0; i < numWatchpoints; i++) {
+        y86AddWatchpoint(guest, watchpoints[i], 4);
+    }
+    if(fuzz.outDir) {
+        fuzz.seeds = seeds;
+        fuzz.budget = budget ? budget : 100000;
+        int fuzzed = fuzzGuest(guest, &fuzz);
+        stopMetricsDump();
+        y86Destroy(guest);
+        return fuzzed ? 0 : 1;
+    } else if(lockstep) {
+        y86_t *ref = y86Create();
+        if(!ref || !y86LoadFile(ref, fileName)) {
+            y86Destroy(ref);
+            y86Destroy(guest);
+            return 1;
+        }
+        y86SetBudget(ref, budget, 0);
+        y86EnableExtensions(ref, extensions);
+        int agreed = runLockstep(ref, guest);
+        stopMetricsDump();
+        printEndStatus(ref, stats);
+        y86Destroy(ref);
+        y86Destroy(guest);
+        return agreed ? 0 : 1;
+    } else if(forkTarget) {
+        job_t job = { budget, timeout, stats };
+        int served = forkServe(guest, forkTarget, runJob, &job);
+        stopMetricsDump();
+        destroyProfiler(profiler);
+        y86Destroy(guest);
+        return served ? 0 : 1;
+    } else if(gdbTarget) {
+        if(!gdbServe(guest, gdbTarget)) {
+            y86Destroy(guest);
+            return 1;
+        }
+    } else if(debug) {
+        debugShell(guest);
+    } else if(cpus > 1) {
+        if(!runSmp(guest, cpus)) {
+            stopMetricsDump();
+            y86Destroy(guest);
+            return 1;
+        }
+    } else {
+        runGuest(guest, profiler);
+    }
+    stopMetricsDump();
+    if(profiler) {
+        FILE *out = fopen(profileFile, "w");
+        if(out) {
+            writeFoldedStacks(profiler, out);
+            fclose(out);
+        } else {
+            fprintf(stderr, "ERROR: Could not write the profile to %s\n", profileFile);
+        }
+        destroyProfiler(profiler);
     }
-    printf("\nEnd Status: %s\n", status);
+    printEndStatus(guest, stats);
+    y86Destroy(guest);
     return 0;
 }
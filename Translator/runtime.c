@@ -0,0 +1,352 @@
+/*
+    Runtime of a translated program. y86aot copies this file to the top of
+    every program it generates; it is not compiled by itself. The generated
+    code defines SIZE, ENTRY, SEGMENTS and RANGES before it and provides
+    after it:
+        R, ZF, SF, OF   - the registers and condition flags, initialized
+        image           - the initialized bytes of guest memory, SEGMENTS
+                          entries ending with an empty one
+        code            - the ranges of guest memory that were translated,
+                          RANGES entries ending with an empty one
+        step()          - the interpreter of a single instruction
+        dispatch()      - the translated block starting at an address
+    Everything here behaves exactly like the emulator on stdin and stdout,
+    down to the messages printed for faults.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+enum { AOK, HLT, ADR, INS };
+
+static const char *statusNames[] = { "AOK", "HLT", "ADR", "INS" };
+
+/*
+    What runs next: a translated block or the interpreter, each returning
+    what runs after it. A NULL function stops the program.
+*/
+typedef struct next_s next_t;
+struct next_s {
+    next_t (*fn)(void);
+};
+
+#define STOP ((next_t){ NULL })
+#define BLOCK(fn) ((next_t){ fn })
+
+typedef struct segment_s {
+    int32_t addr;
+    int32_t len;
+    const uint8_t *bytes;
+} segment_t;
+
+typedef struct range_s {
+    int32_t start;
+    int32_t end;
+} range_t;
+
+/* Defined by the generated code */
+static int32_t R[8];
+static int ZF, SF, OF;
+static const segment_t image[SEGMENTS];
+static const range_t code[RANGES];
+
+static uint8_t *M;          /* guest memory */
+static uint8_t *codeBits;   /* a bit for every translated byte */
+static int32_t PC;
+static int status = AOK;
+static int leaving;         /* translated code must return after this instruction */
+static int codeWritten;     /* translated code was overwritten; only interpret from now on */
+
+static void outOfBounds(int32_t addr) {
+    printf("Attemped to access out of bound address 0x%x\n", addr);
+    status = ADR;
+    leaving = 1;
+}
+
+static inline int checkrange(int32_t addr, int32_t n) {
+    if((uint32_t)addr > (uint32_t)SIZE || (uint32_t)(SIZE - addr) < (uint32_t)n) {
+        outOfBounds(addr);
+        return 0;
+    }
+    return 1;
+}
+
+static inline int checkbound(int32_t addr) {
+    return checkrange(addr, 1);
+}
+
+static inline uint32_t loadLE32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void storeLE32(uint8_t *p, uint32_t val) {
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+    p[2] = (uint8_t)(val >> 16);
+    p[3] = (uint8_t)(val >> 24);
+}
+
+/*
+    Called after every store. Overwriting translated code hands the rest
+    of the run to the interpreter, starting with the next instruction.
+*/
+static inline void stored(int32_t addr, int32_t len) {
+    int32_t a;
+    for(a = addr; a < addr + len; a++) {
+        if(codeBits[a >> 3] & (1 << (a & 7))) {
+            codeWritten = 1;
+            leaving = 1;
+            return;
+        }
+    }
+}
+
+/*
+    The effective address D(rB), wrapping around like the emulator's.
+*/
+#define EA(base, disp) ((int32_t)((uint32_t)(base) + (uint32_t)(disp)))
+
+static inline int32_t ld32(int32_t addr) {
+    return checkrange(addr, 4) ? (int32_t)loadLE32(M + addr) : 0;
+}
+
+static inline int st32(int32_t addr, int32_t val) {
+    if(!checkrange(addr, 4)) {
+        return 0;
+    }
+    storeLE32(M + addr, (uint32_t)val);
+    stored(addr, 4);
+    return 1;
+}
+
+static inline int32_t ld8s(int32_t addr) {
+    return checkbound(addr) ? (int8_t)M[addr] : 0;
+}
+
+static inline void push(int32_t val) {
+    R[4] -= 4;
+    st32(R[4], val);
+}
+
+static inline int32_t pop(void) {
+    int32_t val = ld32(R[4]);
+    R[4] += 4;
+    return val;
+}
+
+/*
+    The arithmetic of addl, subl, andl, xorl, mull and cmpl. The sums and
+    products wrap like the 32 bit registers of the guest.
+*/
+static inline int32_t flagged(int32_t result) {
+    ZF = result == 0;
+    SF = result < 0;
+    return result;
+}
+
+static inline int32_t opAdd(int32_t b, int32_t a) {
+    int32_t result = (int32_t)((uint32_t)b + (uint32_t)a);
+    OF = (a > 0 && b > 0 && result < 0) || (a < 0 && b < 0 && result > 0);
+    return flagged(result);
+}
+
+static inline int32_t opSub(int32_t b, int32_t a) {
+    int32_t result = (int32_t)((uint32_t)b - (uint32_t)a);
+    OF = (b < 0 && a > 0 && result > 0) || (b > 0 && a < 0 && result < 0);
+    return flagged(result);
+}
+
+static inline int32_t opAnd(int32_t b, int32_t a) {
+    OF = 0;
+    return flagged(b & a);
+}
+
+static inline int32_t opXor(int32_t b, int32_t a) {
+    OF = 0;
+    return flagged(b ^ a);
+}
+
+static inline int32_t opMul(int32_t b, int32_t a) {
+    int32_t result = (int32_t)((uint32_t)b * (uint32_t)a);
+    OF = (a > 0 && b > 0 && result < 0) ||
+         (a < 0 && b < 0 && result < 0) ||
+         (((a < 0) ^ (b < 0)) && ((a > 0) ^ (b > 0)) && result > 0);
+    return flagged(result);
+}
+
+/*
+    readb and readl. A byte read to an address outside of memory stops the
+    program without a message, like the emulator's putByte().
+*/
+static void inByte(int32_t dst) {
+    char c = 0;
+    int consumed = 0;
+    int set = scanf("%c%n", &c, &consumed);
+    ZF = set == EOF;
+    if((uint32_t)dst >= (uint32_t)SIZE) {
+        status = ADR;
+        leaving = 1;
+        return;
+    }
+    M[dst] = (uint8_t)c;
+    stored(dst, 1);
+}
+
+static void inLong(int32_t dst) {
+    int32_t l = 0;
+    int consumed = 0;
+    int set = scanf("%i%n", &l, &consumed);
+    ZF = set == EOF;
+    if(!st32(dst, l)) {
+        status = ADR;
+    }
+}
+
+static void outByte(int32_t src) {
+    if(checkbound(src)) {
+        printf("%c", (char)M[src]);
+    }
+}
+
+static void outLong(int32_t src) {
+    int32_t val = ld32(src);
+    if(status == AOK) {
+        printf("%d", val);
+    }
+}
+
+/*
+    readn and writen.
+*/
+static inline void readN(int32_t dst, int32_t *len) {
+    if(!checkrange(dst, *len)) {
+        return;
+    }
+    int32_t total = (int32_t)fread(M + dst, 1, *len, stdin);
+    if(total > 0) {
+        stored(dst, total);
+    }
+    ZF = total < *len;
+    *len = total;
+}
+
+static inline void writeN(int32_t src, int32_t len) {
+    if(checkrange(src, len)) {
+        fwrite(M + src, 1, len, stdout);
+    }
+}
+
+/*
+    cas and xadd. A translated program has a single CPU, so spawn always
+    fails and the atomic instructions need no atomic operations.
+*/
+static inline int atomicWord(int32_t addr) {
+    if(addr & 3) {
+        printf("Misaligned atomic access at address 0x%x\n", addr);
+        status = ADR;
+        leaving = 1;
+        return 0;
+    }
+    return checkrange(addr, 4);
+}
+
+static inline void cas(int32_t addr, int32_t val) {
+    if(!atomicWord(addr)) {
+        return;
+    }
+    int32_t old = (int32_t)loadLE32(M + addr);
+    if(old == R[0]) {
+        storeLE32(M + addr, (uint32_t)val);
+        stored(addr, 4);
+        ZF = 1;
+    } else {
+        R[0] = old;
+        ZF = 0;
+    }
+}
+
+static inline void xadd(int32_t addr, int32_t *reg) {
+    if(!atomicWord(addr)) {
+        return;
+    }
+    int32_t old = (int32_t)loadLE32(M + addr);
+    storeLE32(M + addr, (uint32_t)old + (uint32_t)*reg);
+    stored(addr, 4);
+    *reg = old;
+}
+
+/*
+    Decodes the operands of the instruction at pc for step(). uses holds 1
+    if rA names a register and 2 if rB does.
+    Return:
+        1 if the instruction lies inside memory and only names existing
+        registers; 0 otherwise
+*/
+static inline int decodeAt(int32_t pc, int32_t length, int uses, int *a, int *b, int32_t *v) {
+    if(SIZE - pc < length) {
+        return 0;
+    }
+    if(length == 2 || length == 6) {
+        *a = M[pc + 1] >> 4;
+        *b = M[pc + 1] & 0xF;
+        if(((uses & 1) && *a >= 8) || ((uses & 2) && *b >= 8)) {
+            return 0;
+        }
+    }
+    if(length == 6) {
+        *v = (int32_t)loadLE32(M + pc + 2);
+    } else if(length == 5) {
+        *v = (int32_t)loadLE32(M + pc + 1);
+    }
+    return 1;
+}
+
+static void step(void);
+static next_t dispatch(int32_t);
+
+static next_t interpret(void) {
+    step();
+    return status == AOK ? dispatch(PC) : STOP;
+}
+
+#define INTERPRET ((next_t){ interpret })
+
+/*
+    Leaves translated code for the interpreter at the given address.
+*/
+static next_t resume(int32_t pc) {
+    PC = pc;
+    return status == AOK ? INTERPRET : STOP;
+}
+
+static void loadImage(void) {
+    int i;
+    int32_t a;
+    M = calloc((size_t)SIZE + 4, 1);
+    codeBits = calloc((size_t)SIZE / 8 + 1, 1);
+    if(!M || !codeBits) {
+        fprintf(stderr, "ERROR: Failed to allocate guest memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for(i = 0; image[i].len; i++) {
+        memcpy(M + image[i].addr, image[i].bytes, image[i].len);
+    }
+    for(i = 0; i < RANGES; i++) {
+        for(a = code[i].start; a < code[i].end; a++) {
+            codeBits[a >> 3] |= 1 << (a & 7);
+        }
+    }
+}
+
+int main(void) {
+    loadImage();
+    next_t next = dispatch(ENTRY);
+    while(next.fn) {
+        next = next.fn();
+    }
+    printf("\nEnd Status: %s\n", statusNames[status]);
+    free(M);
+    free(codeBits);
+    return 0;
+}
@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "translate.h"
+#include "metrics.h"
+#include "disasm.h"
+#include "cfg.h"
+
+/*
+    The runtime every translated program starts with; see runtime.c.
+*/
+static const char runtime[] =
+#include "runtime.inc"
+;
+
+/*
+    Conditions of the jXX instructions, indexed by fn.
+*/
+static const char *conditions[] = {
+    "1", "(SF ^ OF) || ZF", "SF ^ OF", "ZF", "!ZF", "!(SF ^ OF)", "!(SF ^ OF) && !ZF"
+};
+
+/*
+    Runtime helpers carrying out the arithmetic of addl to cmpl, indexed
+    by fn.
+*/
+static const char *operations[] = {
+    "opAdd", "opSub", "opAnd", "opXor", "opMul", "opSub"
+};
+
+/*
+    Zero bytes that end a segment of the memory image; shorter runs of zeros
+    are kept inside it.
+*/
+#define SEGMENT_GAP 32
+
+/*
+    The C expressions standing for the operands of an instruction: its
+    registers and its immediate, displacement or destination.
+*/
+typedef struct operands_s {
+    char rA[8];
+    char rB[8];
+    char val[16];
+} operands_t;
+
+/*
+    Writes the statements carrying out an instruction that continues with
+    the following one. The instruction pointer is not touched.
+    Arguments:
+        FILE *out - the generated program
+        uint8_t opcode - the opcode of the instruction
+        const operands_t *o - its operands
+    Return:
+        1 if the instruction may store to memory or stop the program; 0 if
+        it only changes registers and flags
+*/
+static int emitEffect(FILE *out, uint8_t opcode, const operands_t *o) {
+    int fn = opFns[opcode];
+    switch(opClasses[opcode]) {
+        case CLASS_MOV:
+            switch(fn) {
+                case RR:
+                    fprintf(out, "    %s = %s;\n", o->rB, o->rA);
+                    return 0;
+                case IR:
+                    fprintf(out, "    %s = %s;\n", o->rB, o->val);
+                    return 0;
+                case RM:
+                    fprintf(out, "    st32(EA(%s, %s), %s);\n", o->rB, o->val, o->rA);
+                    return 1;
+                case MR:
+                    fprintf(out, "    %s = ld32(EA(%s, %s));\n", o->rA, o->rB, o->val);
+                    return 1;
+                case SB:
+                    fprintf(out, "    %s = ld8s(EA(%s, %s));\n", o->rA, o->rB, o->val);
+                    return 1;
+            }
+        break;
+        case CLASS_OP:
+            if(fn == CMP) {
+                fprintf(out, "    %s(%s, %s);\n", operations[fn], o->rB, o->rA);
+            } else {
+                fprintf(out, "    %s = %s(%s, %s);\n", o->rB, operations[fn], o->rB, o->rA);
+            }
+            return 0;
+        case CLASS_PUSH:
+            fprintf(out, "    push(%s);\n", o->rA);
+            return 1;
+        case CLASS_POP:
+            fprintf(out, "    %s = pop();\n", o->rA);
+            return 1;
+        case CLASS_READ:
+            if(fn == N) {
+                fprintf(out, "    readN(EA(%s, %s), &%s);\n", o->rB, o->val, o->rA);
+            } else {
+                fprintf(out, "    %s(EA(%s, %s));\n", fn == B ? "inByte" : "inLong", o->rA, o->val);
+            }
+            return 1;
+        case CLASS_WRITE:
+            if(fn == N) {
+                fprintf(out, "    writeN(EA(%s, %s), %s);\n", o->rB, o->val, o->rA);
+            } else {
+                fprintf(out, "    %s(EA(%s, %s));\n", fn == B ? "outByte" : "outLong", o->rA, o->val);
+            }
+            return 1;
+        case CLASS_SMP:
+            switch(fn) {
+                case CAS:
+                    fprintf(out, "    cas(EA(%s, %s), %s);\n", o->rB, o->val, o->rA);
+                    return 1;
+                case XADD:
+                    fprintf(out, "    xadd(EA(%s, %s), &%s);\n", o->rB, o->val, o->rA);
+                    return 1;
+                case SPAWN:
+                    fprintf(out, "    %s = -1;\n", o->rA);
+                    return 0;
+            }
+        break;
+    }
+    return 0;
+}
+
+static void formatValue(char *buf, size_t size, int32_t val) {
+    if(val == INT32_MIN) {
+        snprintf(buf, size, "INT32_MIN");
+    } else {
+        snprintf(buf, size, "%d", val);
+    }
+}
+
+/*
+    Writes step(), which carries out the instruction at PC exactly like the
+    reference interpreter of the emulator. Translated code falls back on it
+    for code it does not know.
+*/
+static void emitStep(FILE *out) {
+    operands_t o = { "R[a]", "R[b]", "v" };
+    int op;
+    fprintf(out, "static void step(void) {\n");
+    fprintf(out, "    int32_t pc = PC;\n");
+    fprintf(out, "    int a = 0, b = 0;\n");
+    fprintf(out, "    int32_t v = 0;\n");
+    fprintf(out, "    if(!checkbound(pc)) {\n        return;\n    }\n");
+    fprintf(out, "    switch(M[pc]) {\n");
+    for(op = 0; op < 256; op++) {
+        const opdesc_t *desc = &opcodeTable[op];
+        if(!desc->mnemonic) {
+            continue;
+        }
+        fprintf(out, "    case 0x%02X: /* %s */\n", op, desc->mnemonic);
+        fprintf(out, "    if(!decodeAt(pc, %d, %d, &a, &b, &v)) {\n        break;\n    }\n",
+                desc->length, opRegisters[op]);
+        fprintf(out, "    PC = pc + %d;\n", desc->length);
+        switch(desc->flow) {
+            case FLOW_NEXT:
+                emitEffect(out, op, &o);
+            break;
+            case FLOW_JUMP:
+            case FLOW_BRANCH:
+                fprintf(out, "    checkbound(v);\n");
+                fprintf(out, "    if(%s) {\n        PC = v;\n    }\n", conditions[opFns[op]]);
+            break;
+            case FLOW_CALL:
+                fprintf(out, "    checkbound(v);\n");
+                fprintf(out, "    push(pc + %d);\n", desc->length);
+                fprintf(out, "    PC = v;\n");
+            break;
+            case FLOW_RET:
+                fprintf(out, "    PC = pop();\n");
+            break;
+            case FLOW_HALT:
+                fprintf(out, "    status = HLT;\n");
+            break;
+        }
+        fprintf(out, "    return;\n");
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    status = INS;\n");
+    fprintf(out, "    printf(\"Unknown Instruction Encountered\\n\");\n");
+    fprintf(out, "}\n\n");
+}
+
+/*
+    Writes the statement passing control to the code at addr: the block
+    starting there if there is one, the interpreter otherwise.
+*/
+static void emitGoto(FILE *out, const cfg_t *cfg, int32_t addr) {
+    const block_t *block = findBlock(cfg, addr);
+    if(block && block->start == addr && block->count) {
+        fprintf(out, "    return BLOCK(b_%X);\n", addr);
+    } else {
+        fprintf(out, "    return dispatch(0x%X);\n", addr);
+    }
+}
+
+/*
+    Writes the function carrying out a block. Each instruction that may
+    store or fault is followed by a check that leaves for the interpreter
+    if it stopped the program or overwrote translated code. Instructions
+    the translation cannot prove valid, such as ones naming a register
+    outside of the register file or jumping outside of memory, are left to
+    the interpreter as well, which reports them exactly like the emulator.
+*/
+static void emitBlock(FILE *out, const uint8_t *mem, int32_t size, const cfg_t *cfg, const block_t *block) {
+    int32_t addr = block->start;
+    insn_t insn;
+    sink_t text;
+    sinkInit(&text, NULL);
+    fprintf(out, "static next_t b_%X(void) {\n", block->start);
+    while(addr < block->end) {
+        decodeInstruction(mem + addr, size - addr, addr, &insn);
+        const opdesc_t *desc = &opcodeTable[insn.opcode];
+        int32_t next = addr + insn.length;
+        operands_t o;
+        text.len = 0;
+        formatInstruction(&insn, &text);
+        fprintf(out, "    /* %.*s */\n", (int)(text.len ? text.len - 1 : 0), text.buf);
+        if(((opRegisters[insn.opcode] & USES_A) && insn.rA >= 8) ||
+           ((opRegisters[insn.opcode] & USES_B) && insn.rB >= 8) ||
+           (desc->operands == OPND_DEST && (uint32_t)insn.val >= (uint32_t)size)) {
+            fprintf(out, "    return resume(0x%X);\n}\n\n", addr);
+            sinkFree(&text);
+            return;
+        }
+        snprintf(o.rA, sizeof(o.rA), "R[%d]", insn.rA);
+        snprintf(o.rB, sizeof(o.rB), "R[%d]", insn.rB);
+        formatValue(o.val, sizeof(o.val), insn.val);
+        switch(desc->flow) {
+            case FLOW_NEXT:
+                if(emitEffect(out, insn.opcode, &o)) {
+                    fprintf(out, "    if(leaving) {\n        return resume(0x%X);\n    }\n", next);
+                }
+            break;
+            case FLOW_JUMP:
+                emitGoto(out, cfg, insn.val);
+            break;
+            case FLOW_BRANCH:
+                fprintf(out, "    if(%s) {\n    ", conditions[opFns[insn.opcode]]);
+                emitGoto(out, cfg, insn.val);
+                fprintf(out, "    }\n");
+                emitGoto(out, cfg, next);
+            break;
+            case FLOW_CALL:
+                fprintf(out, "    push(0x%X);\n", next);
+                fprintf(out, "    if(leaving) {\n        return resume(0x%X);\n    }\n", insn.val);
+                emitGoto(out, cfg, insn.val);
+            break;
+            case FLOW_RET:
+                fprintf(out, "    return dispatch(pop());\n");
+            break;
+            case FLOW_HALT:
+                fprintf(out, "    PC = 0x%X;\n", next);
+                fprintf(out, "    status = HLT;\n");
+                fprintf(out, "    return STOP;\n");
+            break;
+        }
+        addr = next;
+    }
+    if(block->exit == FLOW_NEXT) {
+        if(block->bad) {
+            fprintf(out, "    return resume(0x%X);\n", addr);
+        } else {
+            emitGoto(out, cfg, addr);
+        }
+    }
+    fprintf(out, "}\n\n");
+    sinkFree(&text);
+}
+
+/*
+    Writes the initialized bytes of guest memory as segments separated by
+    runs of zeros, followed by an empty segment. Only counts them if out
+    is NULL.
+    Return:
+        The number of segments, the empty one included
+*/
+static int emitImage(FILE *out, const uint8_t *mem, int32_t size) {
+    int segments = 0;
+    int32_t addr = 0;
+    if(out) {
+        fprintf(out, "static const segment_t image[SEGMENTS] = {\n");
+    }
+    while(addr < size) {
+        if(!mem[addr]) {
+            addr++;
+            continue;
+        }
+        int32_t start = addr;
+        int32_t end = addr;
+        int32_t i;
+        while(addr < size && addr - end < SEGMENT_GAP) {
+            if(mem[addr++]) {
+                end = addr;
+            }
+        }
+        segments++;
+        if(!out) {
+            continue;
+        }
+        fprintf(out, "    { 0x%X, %d, (const uint8_t[]){", start, end - start);
+        for(i = start; i < end; i++) {
+            fprintf(out, "%s0x%02X,", (i - start) % 16 ? " " : "\n        ", mem[i]);
+        }
+        fprintf(out, "\n    } },\n");
+    }
+    if(out) {
+        fprintf(out, "    { 0, 0, NULL }\n};\n\n");
+    }
+    return segments + 1;
+}
+
+/*
+    Translates a loaded program into a C program that runs it natively. Code
+    reachable from the entry point through jumps, calls and fall-through is
+    translated block by block, each block into a function; ret goes
+    through a table of all blocks. Code that is only found while running,
+    and everything after the program overwrites its translated code, runs
+    on an interpreter built into the program.
+    Arguments:
+        y86_t *guest - the machine holding the loaded program
+        int extensions - 1 if the program may use the extension instructions
+        FILE *out - receives the C program
+    Return:
+        1 if the program was translated; 0 otherwise
+*/
+int translateImage(y86_t *guest, int extensions, FILE *out) {
+    int32_t size = y86MemorySize(guest);
+    int32_t entry = y86GetRegister(guest, Y86_PC);
+    int flags = y86GetFlags(guest);
+    uint8_t *mem = malloc(size ? size : 1);
+    cfg_t cfg;
+    size_t i;
+    int reg;
+    if(!mem) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 0;
+    }
+    y86ReadMemory(guest, 0, mem, size);
+    enableExtensions(extensions);
+    if(!buildCFG(mem, size, 0, entry, &cfg)) {
+        free(mem);
+        return 0;
+    }
+    int ranges = 0;
+    for(i = 0; i < cfg.numBlocks; i++) {
+        ranges += cfg.blocks[i].start < cfg.blocks[i].end;
+    }
+
+    /* Everything the runtime needs to know up front */
+    fprintf(out, "#define SIZE 0x%X\n", size);
+    fprintf(out, "#define ENTRY 0x%X\n", entry);
+    fprintf(out, "#define SEGMENTS %d\n", emitImage(NULL, mem, size));
+    fprintf(out, "#define RANGES %d\n\n", ranges + 1);
+    fputs(runtime, out);
+    fprintf(out, "\n");
+
+    /* The state of the loaded machine */
+    fprintf(out, "static int32_t R[8] = {");
+    for(reg = 0; reg < 8; reg++) {
+        fprintf(out, "%s%d", reg ? ", " : " ", y86GetRegister(guest, reg));
+    }
+    fprintf(out, " };\n");
+    fprintf(out, "static int ZF = %d, SF = %d, OF = %d;\n\n",
+            (flags & Y86_ZF) != 0, (flags & Y86_SF) != 0, (flags & Y86_OF) != 0);
+    emitImage(out, mem, size);
+    fprintf(out, "static const range_t code[RANGES] = {\n");
+    for(i = 0; i < cfg.numBlocks; i++) {
+        if(cfg.blocks[i].start < cfg.blocks[i].end) {
+            fprintf(out, "    { 0x%X, 0x%X },\n", cfg.blocks[i].start, cfg.blocks[i].end);
+        }
+    }
+    fprintf(out, "    { 0, 0 }\n};\n\n");
+
+    /* The code */
+    emitStep(out);
+    for(i = 0; i < cfg.numBlocks; i++) {
+        if(cfg.blocks[i].count) {
+            fprintf(out, "static next_t b_%X(void);\n", cfg.blocks[i].start);
+        }
+    }
+    fprintf(out, "\nstatic next_t dispatch(int32_t pc) {\n");
+    fprintf(out, "    if(leaving) {\n        return resume(pc);\n    }\n");
+    fprintf(out, "    switch(pc) {\n");
+    for(i = 0; i < cfg.numBlocks; i++) {
+        if(cfg.blocks[i].count) {
+            fprintf(out, "    case 0x%X: return BLOCK(b_%X);\n", cfg.blocks[i].start, cfg.blocks[i].start);
+        }
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return resume(pc);\n");
+    fprintf(out, "}\n\n");
+    for(i = 0; i < cfg.numBlocks; i++) {
+        if(cfg.blocks[i].count) {
+            emitBlock(out, mem, size, &cfg, &cfg.blocks[i]);
+        }
+    }
+    freeCFG(&cfg);
+    free(mem);
+    return !ferror(out);
+}
@@ -0,0 +1,10 @@
+#ifndef translate_h
+#define translate_h
+
+#include <stdio.h>
+
+#include "y86.h"
+
+int translateImage(y86_t*, int, FILE*);
+
+#endif
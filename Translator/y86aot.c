@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "y86.h"
+#include "translate.h"
+
+static void usage() {
+    printf("Usage: y86aot [options] <inputfile>\n");
+    printf("Translates a y86 program into a native executable that behaves like\n");
+    printf("running it with y86emul.\n");
+    printf("Options:\n");
+    printf("    -o <file>   name of the executable (defaults to the input file\n");
+    printf("                without .y86)\n");
+    printf("    -c <file>   write the generated C program to the file instead of\n");
+    printf("                compiling it\n");
+    printf("    -x          accept the extension instructions readn, writen, cas,\n");
+    printf("                xadd and spawn; spawn never finds a CPU to start\n");
+    printf("The C compiler is taken from $CC and defaults to gcc.\n");
+}
+
+/*
+    Derives the name of the executable from the name of the program.
+    Return:
+        The name; NULL if it could not be allocated
+*/
+static char *outputName(const char *fileName) {
+    size_t len = strlen(fileName);
+    char *name = malloc(len + 5);
+    if(!name) {
+        return NULL;
+    }
+    strcpy(name, fileName);
+    if(len > 4 && strcmp(name + len - 4, ".y86") == 0) {
+        name[len - 4] = '\0';
+    } else {
+        strcat(name, ".out");
+    }
+    return name;
+}
+
+/*
+    Translates the program and pipes the C program into the compiler.
+    Return:
+        1 if the executable was built; 0 otherwise
+*/
+static int compile(y86_t *guest, int extensions, const char *exe) {
+    const char *cc = getenv("CC");
+    if(!cc || !*cc) {
+        cc = "gcc";
+    }
+    if(strchr(exe, '\'')) {
+        fprintf(stderr, "ERROR: The name of the executable may not contain a quote\n");
+        return 0;
+    }
+    size_t len = strlen(cc) + strlen(exe) + 32;
+    char *command = malloc(len);
+    if(!command) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 0;
+    }
+    snprintf(command, len, "%s -O2 -o '%s' -x c -", cc, exe);
+    FILE *pipe = popen(command, "w");
+    free(command);
+    if(!pipe) {
+        fprintf(stderr, "ERROR: Could not run %s\n", cc);
+        return 0;
+    }
+    int translated = translateImage(guest, extensions, pipe);
+    int status = pclose(pipe);
+    if(translated && status != 0) {
+        fprintf(stderr, "ERROR: %s failed to compile the translated program\n", cc);
+    }
+    return translated && status == 0;
+}
+
+int main(int argc, char **argv) {
+    int extensions = 0;
+    char *fileName = NULL;
+    char *exe = NULL;
+    char *source = NULL;
+    int i;
+    for(i = 1; i < argc; i++) {
+        if(strcmp("-h", argv[i]) == 0) {
+            usage();
+            return 0;
+        } else if(strcmp("-o", argv[i]) == 0 && i + 1 < argc) {
+            exe = argv[++i];
+        } else if(strcmp("-c", argv[i]) == 0 && i + 1 < argc) {
+            source = argv[++i];
+        } else if(strcmp("-x", argv[i]) == 0) {
+            extensions = 1;
+        } else {
+            fileName = argv[i];
+        }
+    }
+    if(!fileName) {
+        fprintf(stderr, "ERROR: No input file given\n");
+        return 1;
+    }
+    y86_t *guest = y86Create();
+    if(!guest) {
+        fprintf(stderr, "ERROR: Memory allocation failed\n");
+        return 1;
+    }
+    if(!y86LoadFile(guest, fileName)) {
+        y86Destroy(guest);
+        return 1;
+    }
+    y86EnableExtensions(guest, extensions);
+    int ok;
+    if(source) {
+        FILE *out = fopen(source, "w");
+        if(!out) {
+            fprintf(stderr, "ERROR: Could not open %s\n", source);
+            y86Destroy(guest);
+            return 1;
+        }
+        ok = translateImage(guest, extensions, out);
+        ok = fclose(out) == 0 && ok;
+    } else {
+        char *name = exe ? exe : outputName(fileName);
+        ok = name && compile(guest, extensions, name);
+        if(name != exe) {
+            free(name);
+        }
+    }
+    y86Destroy(guest);
+    return ok ? 0 : 1;
+}